@@ -9,11 +9,182 @@
 
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
+#include <string.h>
+#include <stdlib.h>
 #include "W25Qxx.h"
+#include "FTL.h"
+#include "fsmount.h"
 
 /* Definitions of physical drive number for each drive */
 #define DEV_W25Q16	(0)
 
+/*-----------------------------------------------------------------------*/
+/* Write-back sector cache (2025 FEB 20)                                 */
+/*-----------------------------------------------------------------------*/
+/* Every sector write to the W25Qxx erases the whole 4k sector, but one  */
+/* FatFS operation (f_write() + f_close(), f_rename(), ...) usually      */
+/* writes the same FAT and directory sectors several times. The sectors  */
+/* written are kept in RAM and programmed to the flash only when FatFS   */
+/* requests CTRL_SYNC (f_sync(), f_close(), f_unlink(), unmount) or the  */
+/* slot is required for another sector. Read hits are served from RAM.   */
+/* The cache is invalidated after flush, because the USB mass storage    */
+/* accesses the flash directly. Every slot takes 4096 bytes of RAM,      */
+/* define DISK_CACHE_SLOTS as 0 to disable the cache.                    */
+/* The sector numbers are logical ones, the flash translation layer      */
+/* remaps them to the physical flash sectors (2025 FEB 22), see FTL.h    */
+/* The trimmed sectors are released by the FTL on CTRL_SYNC, when the    */
+/* FAT has been written, and erased in background (2025 FEB 26)          */
+/* The cache buffer is lent as the sector size work area to f_mkfs() and */
+/* file copying, see disk_buffer_acquire(). The dirty data is flushed    */
+/* and the cache is bypassed until the buffer is returned (2025 FEB 28)  */
+/* The cached sectors are not read from the flash, the multi-sector read */
+/* is split at the cache hits (2025 MAR 08)                              */
+/*-----------------------------------------------------------------------*/
+
+#ifndef DISK_CACHE_SLOTS
+#define DISK_CACHE_SLOTS	(1)
+#endif
+
+#define DISK_SECTOR_SIZE	(4096)
+
+#if FF_FS_READONLY == 0 && DISK_CACHE_SLOTS > 0
+
+static BYTE		cache_buff[DISK_CACHE_SLOTS][DISK_SECTOR_SIZE];
+static LBA_t	cache_sector[DISK_CACHE_SLOTS];
+static BYTE		cache_valid[DISK_CACHE_SLOTS];		/* The slot keeps the sector data */
+static BYTE		cache_dirty[DISK_CACHE_SLOTS];		/* The slot data is not written to the flash yet */
+static DWORD	cache_used[DISK_CACHE_SLOTS];		/* Last access time of the slot, to find least recently used one */
+static DWORD	cache_tick = 0;
+static BYTE		cache_lent = 0;						/* The cache buffer is used as a work area */
+
+#endif
+
+static DRESULT read_result (W25Qxx_RET r)
+{
+	switch (r) {
+	case W25Qxx_RET_OK:
+		return RES_OK;
+	case W25Qxx_RET_ADDR:
+	case W25Qxx_RET_SIZE:
+		return RES_PARERR;
+	case W25Qxx_RES_BUSY:
+		return RES_NOTRDY;
+	default:
+		break;
+	}
+	return RES_ERROR;
+}
+
+#if FF_FS_READONLY == 0
+
+static DRESULT write_result (W25Qxx_RET r)
+{
+	switch (r) {
+	case W25Qxx_RET_OK:
+		return RES_OK;
+	case W25Qxx_RET_ALIGN:
+	case W25Qxx_RET_SIZE:
+	case W25Qxx_RET_ADDR:
+		return RES_PARERR;
+	case W25Qxx_RES_BUSY:
+		return RES_NOTRDY;
+	case W25Qxx_RES_RO:
+		return RES_WRPRT;
+	default:
+		break;
+	}
+	return RES_ERROR;
+}
+
+#if DISK_CACHE_SLOTS > 0
+
+/* Returns the cache slot of the sector or -1 if the sector is not cached */
+static int cache_find (LBA_t sector)
+{
+	if (cache_lent)
+		return -1;
+	for (int i = 0; i < DISK_CACHE_SLOTS; ++i) {
+		if (cache_valid[i] && cache_sector[i] == sector)
+			return i;
+	}
+	return -1;
+}
+
+/* Program the dirty slot to the flash */
+static DRESULT cache_flush_slot (int i)
+{
+	if (!cache_valid[i] || !cache_dirty[i])
+		return RES_OK;
+	DRESULT res = write_result(FTL_Write(cache_sector[i], cache_buff[i]));
+	if (res == RES_OK)
+		cache_dirty[i] = 0;
+	return res;
+}
+
+/* Copy the cached sector into the buffer. Returns 0 if the sector is not cached */
+static int cache_read (LBA_t sector, BYTE *buff)
+{
+	int i = cache_find(sector);
+	if (i < 0)
+		return 0;
+	memcpy(buff, cache_buff[i], DISK_SECTOR_SIZE);
+	cache_used[i] = ++cache_tick;
+	return 1;
+}
+
+/* Number of the sectors from the first one (up to count) that are not cached */
+static UINT cache_miss (LBA_t sector, UINT count)
+{
+	UINT n = 0;
+	while (n < count && cache_find(sector + n) < 0)
+		++n;
+	return n;
+}
+
+/* Write all dirty slots to the flash and empty the cache */
+static DRESULT cache_sync (void)
+{
+	DRESULT res = RES_OK;
+	for (int i = 0; i < DISK_CACHE_SLOTS; ++i) {
+		DRESULT r = cache_flush_slot(i);
+		if (r != RES_OK) {
+			res = r;							/* Keep the dirty slot, the next sync will try again */
+		} else {
+			cache_valid[i] = 0;
+		}
+	}
+	return res;
+}
+
+/* Put the sector data into the cache. The least recently used slot is flushed when there is no free slot */
+static DRESULT cache_write (LBA_t sector, const BYTE *buff)
+{
+	int i = cache_find(sector);
+	if (i < 0) {
+		i = 0;
+		for (int s = 0; s < DISK_CACHE_SLOTS; ++s) {
+			if (!cache_valid[s]) {
+				i = s;
+				break;
+			}
+			if (cache_used[s] < cache_used[i])
+				i = s;
+		}
+		DRESULT res = cache_flush_slot(i);
+		if (res != RES_OK)
+			return res;
+		cache_sector[i]	= sector;
+		cache_valid[i]	= 1;
+	}
+	memcpy(cache_buff[i], buff, DISK_SECTOR_SIZE);
+	cache_dirty[i]	= 1;
+	cache_used[i]	= ++cache_tick;
+	return RES_OK;
+}
+
+#endif
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -25,7 +196,7 @@ DSTATUS disk_status (
 
 	switch (pdrv) {
 	case DEV_W25Q16:
-		if (W25Qxx_SectorCount() > 0)
+		if (FTL_SectorCount() > 0)
 		return 0;
 		break;
 	}
@@ -45,6 +216,9 @@ DSTATUS disk_initialize (
 
 	switch (pdrv) {
 	case DEV_W25Q16:
+#if FF_FS_READONLY == 0 && DISK_CACHE_SLOTS > 0
+		cache_sync();
+#endif
 		return 0;
 		break;
 	}
@@ -65,30 +239,27 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-	DRESULT res	 = RES_OK;
-
 	switch (pdrv) {
 	case DEV_W25Q16:
-		{
-		uint32_t addr = sector << 12;	/* sector size is 4096 bytes */
-		uint16_t size = count  << 12;
-		W25Qxx_RET r = W25Qxx_Read(addr, buff, size);
-		switch (r) {
-		case W25Qxx_RET_ADDR:
-		case W25Qxx_RET_SIZE:
-			res = RES_PARERR;
-			break;
-		case W25Qxx_RET_READ:
-			res = RES_ERROR;
-			break;
-		case W25Qxx_RES_BUSY:
-			res = RES_NOTRDY;
-			break;
-		default:
-			break;
-		}
-		return res;
+		while (count > 0) {
+			UINT n = (count > 8)?8:count;	/* Read by 32k chunks, the size is 16-bits value */
+#if FF_FS_READONLY == 0 && DISK_CACHE_SLOTS > 0
+			if (cache_read(sector, buff)) {	/* The cached data is newer than the flash data */
+				++sector;
+				buff += DISK_SECTOR_SIZE;
+				--count;
+				continue;
+			}
+			n = cache_miss(sector, n);		/* The flash is read up to the next cached sector */
+#endif
+			DRESULT res = read_result(FTL_Read(sector, buff, n));
+			if (res != RES_OK)
+				return res;
+			sector	+= n;
+			buff	+= n << 12;
+			count	-= n;
 		}
+		return RES_OK;
 	}
 	return RES_PARERR;
 }
@@ -108,35 +279,21 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-	DRESULT res  = RES_OK;
-
 	switch (pdrv) {
 	case DEV_W25Q16:
-		{
-		uint32_t addr = sector << 12;	/* sector size is 4096 bytes */
-		uint16_t size = count  << 12;
-		W25Qxx_RET r = W25Qxx_Write(addr, (uint8_t*)buff, size);
-		switch (r) {
-		case W25Qxx_RET_ALIGN:
-		case W25Qxx_RET_SIZE:
-		case W25Qxx_RET_ADDR:
-			res = RES_PARERR;
-			break;
-		case W25Qxx_RET_ERASE:
-		case W25Qxx_RET_WRITE:
-			res = RES_ERROR;
-			break;
-		case W25Qxx_RES_BUSY:
-			res = RES_NOTRDY;
-			break;
-		case W25Qxx_RES_RO:
-			res = RES_WRPRT;
-			break;
-		default:
-			break;
-		}
-		return res;
+		if (sector + count > FTL_SectorCount())
+			return RES_PARERR;
+		fsMediaWritten();				/* The USB host should re-read the volume, see fsmount.h */
+		for ( ; count > 0; --count, ++sector, buff += DISK_SECTOR_SIZE) {
+#if DISK_CACHE_SLOTS > 0
+			DRESULT res = cache_lent?write_result(FTL_Write(sector, (uint8_t*)buff)):cache_write(sector, buff);
+#else
+			DRESULT res = write_result(FTL_Write(sector, (uint8_t*)buff));
+#endif
+			if (res != RES_OK)
+				return res;
 		}
+		return RES_OK;
 	}
 	return RES_PARERR;
 }
@@ -144,6 +301,42 @@ DRESULT disk_write (
 #endif
 
 
+/*-----------------------------------------------------------------------*/
+/* Lend the sector size work buffer                                      */
+/*-----------------------------------------------------------------------*/
+
+BYTE* disk_buffer_acquire (
+	BYTE pdrv		/* Physical drive number (0..) */
+)
+{
+	if (pdrv != DEV_W25Q16)
+		return 0;
+#if FF_FS_READONLY == 0 && DISK_CACHE_SLOTS > 0
+	if (cache_lent || cache_sync() != RES_OK)
+		return 0;
+	cache_lent = 1;
+	return cache_buff[0];
+#else
+	return (BYTE *)malloc(DISK_SECTOR_SIZE);
+#endif
+}
+
+void disk_buffer_release (
+	BYTE pdrv,		/* Physical drive number (0..) */
+	BYTE* buff		/* The buffer returned by disk_buffer_acquire() */
+)
+{
+	if (pdrv != DEV_W25Q16 || buff == 0)
+		return;
+#if FF_FS_READONLY == 0 && DISK_CACHE_SLOTS > 0
+	cache_lent = 0;
+#else
+	free(buff);
+#endif
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Miscellaneous Functions                                               */
 /*-----------------------------------------------------------------------*/
@@ -159,12 +352,18 @@ DRESULT disk_ioctl (
 	if (pdrv == DEV_W25Q16) {
 		switch (cmd) {
 		case CTRL_SYNC:
-			res = RES_OK;
+#if FF_FS_READONLY == 0
+#if DISK_CACHE_SLOTS > 0
+			res = cache_sync();
+#endif
+			if (res == RES_OK)
+				res = write_result(FTL_Sync());	/* Release the trimmed sectors */
+#endif
 		    break;
 		case GET_SECTOR_COUNT:
 			{
 			LBA_t *sc = buff;
-			*sc =  W25Qxx_SectorCount(); /* 4k sector number */
+			*sc =  FTL_SectorCount(); /* 4k logical sector number */
 			}
 			break;
 		case GET_SECTOR_SIZE:
@@ -183,7 +382,13 @@ DRESULT disk_ioctl (
 			{
 				LBA_t *lba = buff;
 				uint16_t size = lba[1] - lba[0] + 1;
-				W25Qxx_RET r = W25Qxx_Erase(lba[0], size);
+#if FF_FS_READONLY == 0 && DISK_CACHE_SLOTS > 0
+				for (int i = 0; i < DISK_CACHE_SLOTS; ++i) {	/* Drop cached data of the erased sectors */
+					if (cache_valid[i] && cache_sector[i] >= lba[0] && cache_sector[i] <= lba[1])
+						cache_valid[i] = 0;
+				}
+#endif
+				W25Qxx_RET r = FTL_Trim(lba[0], size);
 				switch (r) {
 				case W25Qxx_RET_ADDR:
 				case W25Qxx_RET_SIZE:
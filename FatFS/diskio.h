@@ -32,6 +32,10 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+/* Sector size work buffer shared with the disk cache (not used by FatFs) */
+BYTE* disk_buffer_acquire (BYTE pdrv);
+void disk_buffer_release (BYTE pdrv, BYTE* buff);
+
 
 /* Disk Status Bits (DSTATUS) */
 
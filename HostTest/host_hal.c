@@ -0,0 +1,92 @@
+/*
+ * host_hal.c
+ *
+ *  2025 MAR 07
+ *  	The HAL functions of the host test build, the time is advanced by the test, see stm32f1xx_hal.h
+ *  2025 MAR 08
+ *  	The MCU flash page is mapped at its address, so snapshot.cpp reads it the same way as on the MCU.
+ *  	The half-word can be programmed only if it is erased or to zero. The host_test is linked as the position
+ *  	dependent executable, so the linker symbols of the firmware image (_sidata, _sdata, _edata) are below the page
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stm32f1xx_hal.h"
+
+#define MCU_PAGE_SIZE			(2048)
+
+GPIO_TypeDef			host_gpio[4];
+uint32_t				host_tick			= 1;
+uint32_t				host_flash_erases	= 0;
+uint8_t					_sidata, _sdata, _edata;				// The firmware image is empty
+static bool				usb_irq				= true;				// The USB interrupt is enabled
+static bool				flash_locked		= true;
+static uint32_t			flash_page			= 0;				// The mapped MCU flash page address
+
+uint32_t HAL_GetTick(void) {
+	return host_tick;
+}
+
+void HAL_Delay(uint32_t delay) {
+	host_tick += delay;
+}
+
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irq) {
+	return (irq == USB_LP_CAN1_RX0_IRQn && usb_irq)?1:0;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type irq) {
+	if (irq == USB_LP_CAN1_RX0_IRQn)
+		usb_irq = true;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type irq) {
+	if (irq == USB_LP_CAN1_RX0_IRQn)
+		usb_irq = false;
+}
+
+bool host_flash_map(uint32_t addr) {
+	if (flash_page == addr) {								// Mapped already, erase the page
+		memset((void *)(uintptr_t)addr, 0xFF, MCU_PAGE_SIZE);
+		return true;
+	}
+	uintptr_t	start	= addr & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+	void*		p		= mmap((void *)start, addr + MCU_PAGE_SIZE - start, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != (void *)start)
+		return false;
+	flash_page = addr;
+	memset((void *)(uintptr_t)addr, 0xFF, MCU_PAGE_SIZE);
+	return true;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+	flash_locked = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+	flash_locked = true;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t addr, uint64_t data) {
+	if (flash_locked || type != FLASH_TYPEPROGRAM_HALFWORD || (addr & 1) || addr < flash_page || addr + 2 > flash_page + MCU_PAGE_SIZE)
+		return HAL_ERROR;
+	volatile uint16_t *hw = (volatile uint16_t *)(uintptr_t)addr;
+	if (*hw != 0xFFFF && (uint16_t)data != 0)
+		return HAL_ERROR;
+	*hw = (uint16_t)data;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *er, uint32_t *page_error) {
+	if (flash_locked || er->PageAddress != flash_page || er->NbPages != 1) {
+		*page_error = er->PageAddress;
+		return HAL_ERROR;
+	}
+	memset((void *)(uintptr_t)flash_page, 0xFF, MCU_PAGE_SIZE);
+	++host_flash_erases;
+	*page_error = 0xFFFFFFFF;
+	return HAL_OK;
+}
@@ -0,0 +1,104 @@
+/*
+ * host_test.cpp
+ *
+ *  2025 MAR 07
+ *  	The flash drive code (W25Qxx driver, FTL, FatFS disk cache, USB mass storage cache, configuration store
+ *  	and the tip catalogue) built on the host computer against the flash IC emulator, see w25q_emu.h
+ *  2025 MAR 08
+ *  	The tests are split by the checked change into test_*.cpp files, see host_test.h
+ *
+ *  Every test checks the data and prints the flash operation counters used to estimate the flash wear.
+ *  The power loss tests run the interrupted operation in the child process: the RAM state is lost together with
+ *  the process and the flash content is passed back through the image file, then the parent process "reboots".
+ *  Usage: host_test [repository root] [image file]
+ */
+
+#include "host_test.h"
+#include "W25Qxx.h"
+
+int				failures	= 0;
+const char*		root		= "..";
+const char*		image		= "w25q.img";
+FATFS			fs;
+HOST_TEST*		HOST_TEST::first = 0;
+
+// Erase the chip and create the file system, the same way W25Q::formatFlashDrive() does
+bool freshDrive(bool ftl) {
+	w25q_emu_erase_chip();
+	if (!W25Qxx_Init())
+		return false;
+	FTL_Init();
+	if (ftl && !FTL_Format())
+		return false;
+	MKFS_PARM p = { FM_FAT | FM_SFD, 1, 0, 128, 4096 };
+	static BYTE work[4096];
+	return (FR_OK == f_mkfs("0:/", &p, work, sizeof(work)));
+}
+
+bool writeFile(const char *name, const void *data, UINT size, bool rewrite) {
+	FIL f;
+	UINT bw = 0;
+	if (FR_OK != f_mount(&fs, "0:/", 1))
+		return false;
+	bool ok = (FR_OK == f_open(&f, name, rewrite?(FA_WRITE | FA_OPEN_ALWAYS):(FA_WRITE | FA_CREATE_ALWAYS)));
+	if (ok) {
+		ok = (FR_OK == f_write(&f, data, size, &bw)) && bw == size;
+		ok = (FR_OK == f_close(&f)) && ok;
+	}
+	f_mount(0, "0:/", 0);
+	return ok;
+}
+
+bool readFile(const char *name, void *data, UINT size) {
+	FIL f;
+	UINT br = 0;
+	if (FR_OK != f_mount(&fs, "0:/", 1))
+		return false;
+	bool ok = (FR_OK == f_open(&f, name, FA_READ));
+	if (ok) {
+		ok = (FR_OK == f_read(&f, data, size, &br)) && br == size;
+		f_close(&f);
+	}
+	f_mount(0, "0:/", 0);
+	return ok;
+}
+
+bool saveValue(const char *name, uint8_t value) {
+	uint8_t data[200];
+	memset(data, value, sizeof(data));
+	return writeFile(name, data, sizeof(data), true);
+}
+
+int loadValue(const char *name) {
+	uint8_t data[200];
+	if (!readFile(name, data, sizeof(data)))
+		return -1;
+	for (uint16_t i = 1; i < sizeof(data); ++i) {
+		if (data[i] != data[0])
+			return -1;
+	}
+	return data[0];
+}
+
+// Insert the test into the list sorted by the change number, the tests of the same change keep the registration order
+HOST_TEST::HOST_TEST(uint16_t change, HOST_TEST_FUNC test) : change(change), test(test), next(0) {
+	HOST_TEST** p = &first;
+	while (*p && (*p)->change <= change)
+		p = &(*p)->next;
+	next	= *p;
+	*p		= this;
+}
+
+void HOST_TEST::runAll(void) {
+	for (HOST_TEST* t = first; t; t = t->next)
+		t->test();
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) root	= argv[1];
+	if (argc > 2) image	= argv[2];
+	w25q_emu_open(image);
+	HOST_TEST::runAll();
+	printf(failures?"%d check(s) failed\n":"All checks passed\n", failures);
+	return failures?1:0;
+}
@@ -0,0 +1,73 @@
+/*
+ * host_test.h
+ *
+ *  2025 MAR 08
+ *  	The common part of the host tests: the checks, the flash drive helpers and the test registration.
+ *  	Every test_*.cpp file checks one change of the flash drive code and registers its tests by HOST_TEST_CASE(),
+ *  	the tests run in the order of the change number, see host_test.cpp
+ */
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "w25q_emu.h"
+#include "ff.h"
+#include "FTL.h"
+
+#define CHECK(cond)	do { if (!(cond)) { printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+extern int			failures;
+extern const char*	root;										// The repository root, NLS/tip_list.txt is read from there
+extern const char*	image;										// The flash image file of the power loss tests
+extern FATFS		fs;
+
+bool	freshDrive(bool ftl);									// Erase the chip and create the file system
+bool	writeFile(const char *name, const void *data, UINT size, bool rewrite = false);
+bool	readFile(const char *name, void *data, UINT size);
+bool	saveValue(const char *name, uint8_t value);				// The small file filled by the value
+int		loadValue(const char *name);							// The value of the small file or -1 if the file is damaged
+
+/*
+ * Run the operation in the child process breaking the flash operation op (counted from now).
+ * The flash content is read back from the image file as it was when the power was lost
+ */
+template <typename F> void powerLoss(uint32_t op, F operation) {
+	uint32_t fail_at = w25q_emu_ops() + op;
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		jmp_buf jb;
+		if (setjmp(jb) == 0) {
+			w25q_emu_power_loss(fail_at, &jb);
+			operation();
+		}
+		w25q_emu_save();
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	w25q_emu_open(image);
+	FTL_Init();													// Reboot
+}
+
+typedef void (*HOST_TEST_FUNC)(void);
+
+class HOST_TEST {
+	public:
+		HOST_TEST(uint16_t change, HOST_TEST_FUNC test);		// change is the number of the checked change, the test order
+		static void		runAll(void);
+	private:
+		uint16_t		change;
+		HOST_TEST_FUNC	test;
+		HOST_TEST*		next;
+		static HOST_TEST*	first;
+};
+
+#define HOST_TEST_CASE(change, func)	static HOST_TEST func##_case(change, func)
+
+#endif
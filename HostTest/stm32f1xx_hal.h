@@ -0,0 +1,105 @@
+/*
+ * stm32f1xx_hal.h
+ *
+ *  2025 MAR 07
+ *  	The subset of the STM32 HAL used by the flash drive code, built on the host computer, see host_test.cpp.
+ *  	Inc/main.h includes this file instead of the HAL, the flash IC is emulated by w25q_emu.c, see w25q_emu.h
+ *  2025 MAR 08
+ *  	The MCU flash page of the working data snapshot (snapshot.cpp) is mapped at its address, see host_hal.c
+ */
+
+#ifndef HOST_STM32F1XX_HAL_H_
+#define HOST_STM32F1XX_HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+
+typedef struct { volatile uint32_t ODR; } GPIO_TypeDef;
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+
+extern GPIO_TypeDef		host_gpio[4];
+#define GPIOA			(&host_gpio[0])
+#define GPIOB			(&host_gpio[1])
+#define GPIOC			(&host_gpio[2])
+#define GPIOD			(&host_gpio[3])
+
+#define GPIO_PIN_0		((uint16_t)0x0001)
+#define GPIO_PIN_1		((uint16_t)0x0002)
+#define GPIO_PIN_2		((uint16_t)0x0004)
+#define GPIO_PIN_3		((uint16_t)0x0008)
+#define GPIO_PIN_4		((uint16_t)0x0010)
+#define GPIO_PIN_5		((uint16_t)0x0020)
+#define GPIO_PIN_6		((uint16_t)0x0040)
+#define GPIO_PIN_7		((uint16_t)0x0080)
+#define GPIO_PIN_8		((uint16_t)0x0100)
+#define GPIO_PIN_9		((uint16_t)0x0200)
+#define GPIO_PIN_10		((uint16_t)0x0400)
+#define GPIO_PIN_11		((uint16_t)0x0800)
+#define GPIO_PIN_12		((uint16_t)0x1000)
+#define GPIO_PIN_13		((uint16_t)0x2000)
+#define GPIO_PIN_14		((uint16_t)0x4000)
+#define GPIO_PIN_15		((uint16_t)0x8000)
+
+// The DMA handles of the flash SPI port are left empty, so W25Qxx transfers the data by HAL_SPI_Transmit()/HAL_SPI_Receive()
+typedef struct { volatile uint32_t CCR; } DMA_Channel_TypeDef;
+typedef struct { DMA_Channel_TypeDef *Instance; } DMA_HandleTypeDef;
+typedef struct { volatile uint32_t CR1, CR2, SR, DR; } SPI_TypeDef;
+typedef struct { SPI_TypeDef *Instance; DMA_HandleTypeDef *hdmatx, *hdmarx; } SPI_HandleTypeDef;
+typedef struct { volatile uint32_t ARR, CCR1; } TIM_TypeDef;
+typedef struct { TIM_TypeDef *Instance; } TIM_HandleTypeDef;
+
+#define DMA_CCR_MINC				(1u << 7)
+#define SPI_CR2_RXDMAEN				(1u << 0)
+#define SPI_CR2_TXDMAEN				(1u << 1)
+#define HAL_DMA_FULL_TRANSFER		(0)
+#define SET_BIT(REG, BIT)			((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)			((REG) &= ~(BIT))
+#define MODIFY_REG(REG, CLR, SET)	((REG) = (((REG) & ~(CLR)) | (SET)))
+#define __HAL_SPI_ENABLE(h)			((void)(h))
+#define __HAL_SPI_CLEAR_OVRFLAG(h)	((void)(h))
+#ifndef UNUSED
+#define UNUSED(X)					(void)(X)
+#endif
+
+typedef enum { USB_LP_CAN1_RX0_IRQn = 20 } IRQn_Type;
+
+#define FLASH_BANK1_END				(0x0807FFFFu)
+#define FLASH_BANK_1				(1u)
+#define FLASH_TYPEERASE_PAGES		(0u)
+#define FLASH_TYPEPROGRAM_HALFWORD	(1u)
+typedef struct { uint32_t TypeErase, Banks, PageAddress, NbPages; } FLASH_EraseInitTypeDef;
+
+extern uint32_t		host_tick;									// The emulated HAL_GetTick() value, ms
+extern uint32_t		host_flash_erases;							// The MCU flash page erases, see HAL_FLASHEx_Erase()
+
+bool				host_flash_map(uint32_t addr);				// Map the erased MCU flash page at its address or erase it
+
+uint32_t			HAL_GetTick(void);
+void				HAL_Delay(uint32_t delay);
+void				HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+HAL_StatusTypeDef	HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef	HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef	HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef	HAL_DMA_Start(DMA_HandleTypeDef *hdma, uint32_t src, uint32_t dst, uint32_t length);
+HAL_StatusTypeDef	HAL_DMA_PollForTransfer(DMA_HandleTypeDef *hdma, uint32_t level, uint32_t timeout);
+HAL_StatusTypeDef	HAL_DMA_Abort(DMA_HandleTypeDef *hdma);
+uint32_t			NVIC_GetEnableIRQ(IRQn_Type irq);
+void				HAL_NVIC_EnableIRQ(IRQn_Type irq);
+void				HAL_NVIC_DisableIRQ(IRQn_Type irq);
+HAL_StatusTypeDef	HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef	HAL_FLASH_Lock(void);
+HAL_StatusTypeDef	HAL_FLASH_Program(uint32_t type, uint32_t addr, uint64_t data);
+HAL_StatusTypeDef	HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *er, uint32_t *page_error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * test_diskbuf.cpp
+ *
+ *  2025 MAR 08
+ *  	The disk cache buffer lent as the sector size work area (diskio.c, disk_buffer_acquire())
+ */
+
+#include "host_test.h"
+#include "diskio.h"
+
+// The dirty sector is written before the buffer is lent, the cache is bypassed until the buffer is returned
+static void testDiskBuffer(void) {
+	printf("Disk cache buffer lending\n");
+	CHECK(freshDrive(true));
+	static BYTE data[4096], check[4096];
+	memset(data, 0xA5, sizeof(data));
+	CHECK(disk_write(0, data, 100, 1) == RES_OK);				// Dirty sector in the cache
+	BYTE *buff = disk_buffer_acquire(0);
+	CHECK(buff != 0);
+	CHECK(FTL_Read(100, check, 1) == W25Qxx_RET_OK && memcmp(data, check, sizeof(data)) == 0);
+	CHECK(disk_buffer_acquire(0) == 0);							// One buffer only
+	if (buff) {
+		memset(buff, 0x11, 4096);								// The work area data never reaches the flash
+		memset(data, 0x5A, sizeof(data));
+		CHECK(disk_write(0, data, 101, 1) == RES_OK);			// Written through while the buffer is lent
+		CHECK(FTL_Read(101, check, 1) == W25Qxx_RET_OK && memcmp(data, check, sizeof(data)) == 0);
+		CHECK(disk_read(0, check, 100, 1) == RES_OK && check[0] == 0xA5 && check[4095] == 0xA5);
+		disk_buffer_release(0, buff);
+	}
+	CHECK(disk_read(0, check, 101, 1) == RES_OK && memcmp(data, check, sizeof(data)) == 0);
+	CHECK(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+	CHECK(FTL_Read(100, check, 1) == W25Qxx_RET_OK && check[0] == 0xA5);
+	buff = disk_buffer_acquire(0);
+	CHECK(buff != 0);
+	disk_buffer_release(0, buff);
+}
+
+HOST_TEST_CASE(39, testDiskBuffer);
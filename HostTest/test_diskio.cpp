@@ -0,0 +1,62 @@
+/*
+ * test_diskio.cpp
+ *
+ *  2025 MAR 08
+ *  	The write-back sector cache of the FatFS disk driver (diskio.c)
+ */
+
+#include "host_test.h"
+#include "diskio.h"
+
+#ifndef DISK_CACHE_SLOTS
+#define DISK_CACHE_SLOTS	(1)									// The default of diskio.c, see Makefile
+#endif
+
+// Ten small files are created, then the single record is updated. The FatFS sectors are combined in the disk cache
+static void testDiskCache(void) {
+	printf("Disk cache, %d slot(s)\n", DISK_CACHE_SLOTS);
+	CHECK(freshDrive(true));
+	w25q_emu_reset_stat();
+	uint8_t data[6144];
+	for (uint8_t i = 0; i < 10; ++i) {
+		char name[16];
+		snprintf(name, sizeof(name), "file%d.txt", i);
+		memset(data, 'a' + i, sizeof(data));
+		CHECK(writeFile(name, data, sizeof(data)));
+	}
+	printf("  ten 6k files: %u erases, %u page programs\n", w25q_emu_stat.erases, w25q_emu_stat.programs);
+	w25q_emu_reset_stat();
+	CHECK(saveValue("config.dat", 1));
+	CHECK(saveValue("config.dat", 2));
+	printf("  record update: %u erases, %u page programs\n", w25q_emu_stat.erases / 2, w25q_emu_stat.programs / 2);
+	FTL_Init();
+	for (uint8_t i = 0; i < 10; ++i) {
+		char name[16];
+		snprintf(name, sizeof(name), "file%d.txt", i);
+		uint8_t check[6144];
+		memset(data, 'a' + i, sizeof(data));
+		CHECK(readFile(name, check, sizeof(check)) && memcmp(data, check, sizeof(data)) == 0);
+	}
+	CHECK(loadValue("config.dat") == 2);
+}
+
+// The cached sector is not read from the flash, the read is split at the cache hit
+static void testDiskCacheRead(void) {
+	printf("Disk cache read hits, %d slot(s)\n", DISK_CACHE_SLOTS);
+	CHECK(freshDrive(true));
+	static BYTE data[5][4096], check[5][4096];
+	for (uint8_t s = 0; s < 5; ++s) {
+		memset(data[s], 0x40 + s, sizeof(data[s]));
+		CHECK(FTL_Write(100 + s, data[s]) == W25Qxx_RET_OK);
+	}
+	memset(data[2], 0x7E, sizeof(data[2]));
+	CHECK(disk_write(0, data[2], 102, 1) == RES_OK);			// The newer data of the sector is cached
+	w25q_emu_reset_stat();
+	CHECK(disk_read(0, check[0], 100, 5) == RES_OK && memcmp(data, check, sizeof(data)) == 0);
+	printf("  5 sectors with a cache hit: %u flash reads\n", w25q_emu_stat.reads);
+	CHECK(w25q_emu_stat.reads == 4);
+	CHECK(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+}
+
+HOST_TEST_CASE(31, testDiskCache);
+HOST_TEST_CASE(31, testDiskCacheRead);
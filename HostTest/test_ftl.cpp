@@ -0,0 +1,165 @@
+/*
+ * test_ftl.cpp
+ *
+ *  2025 MAR 08
+ *  	The wear leveling flash translation layer (FTL.c): the wear, the power loss during the update
+ *  	and the in place update of the mapped sector, the migration of the legacy flash drive
+ */
+
+#include "host_test.h"
+#include "flash.h"
+#include "fsmount.h"
+
+// The same files are rewritten many times on the drive with the cold file, the wear is compared with and without FTL
+static void testFtlWear(void) {
+	printf("FTL wear leveling, 20000 saves\n");
+	static uint8_t cold[200000];
+	static uint8_t check[200000];
+	for (uint32_t i = 0; i < sizeof(cold); ++i)
+		cold[i] = i * 7;
+	uint32_t max_erases[2] = { 0, 0 };
+	for (uint8_t ftl = 0; ftl < 2; ++ftl) {
+		CHECK(freshDrive(ftl));
+		CHECK(writeFile("font.bin", cold, sizeof(cold)));
+		w25q_emu_reset_stat();
+		for (uint16_t k = 0; k < 20000; ++k) {
+			for (uint8_t q = 0; q < 8; ++q)
+				FTL_Poll();
+			if (!saveValue((k % 3)?"config.dat":"tipcal.dat", k & 0xFF)) {
+				CHECK(false);
+				break;
+			}
+		}
+		max_erases[ftl] = w25q_emu_max_erases();
+		printf("  %s: %u erases, the most erased sector %u\n", ftl?"FTL   ":"no FTL", w25q_emu_stat.erases, max_erases[ftl]);
+		FTL_Init();
+		CHECK(readFile("font.bin", check, sizeof(check)) && memcmp(cold, check, sizeof(cold)) == 0);
+		CHECK(loadValue("config.dat") == (19999 & 0xFF));
+		CHECK(loadValue("tipcal.dat") == (19998 & 0xFF));
+	}
+	CHECK(max_erases[1] * 10 < max_erases[0]);
+}
+
+// The power is lost during the file update: the file is either old or new, the cold file is intact
+static void testFtlPowerLoss(void) {
+	printf("FTL power loss, 300 trials\n");
+	static uint8_t cold[200000];
+	static uint8_t check[200000];
+	for (uint32_t i = 0; i < sizeof(cold); ++i)
+		cold[i] = i * 7;
+	CHECK(freshDrive(true));
+	CHECK(writeFile("font.bin", cold, sizeof(cold)));
+	CHECK(saveValue("config.dat", 0));
+	srand(5);
+	uint16_t bad = 0;
+	for (uint16_t t = 0; t < 300; ++t) {
+		int before = loadValue("config.dat");
+		uint8_t v = (before + 1) & 0xFF;
+		powerLoss(1 + rand() % 12, [v]() { saveValue("config.dat", v); });
+		int after = loadValue("config.dat");
+		if (after != before && after != v)
+			++bad;
+		if (after < 0)
+			saveValue("config.dat", 0);
+		if (!readFile("font.bin", check, sizeof(check)) || memcmp(cold, check, sizeof(cold)) != 0) {
+			CHECK(false);
+			break;
+		}
+	}
+	printf("  inconsistent: %d\n", bad);
+	CHECK(bad == 0);
+}
+
+// The sector is programmed in place only if one page changes by 1->0 bits, otherwise it is remapped
+static void testFtlInPlace(void) {
+	printf("FTL in place update\n");
+	w25q_emu_erase_chip();
+	CHECK(W25Qxx_Init() && FTL_Format());
+	static uint8_t b[4096], r[4096];
+	memset(b, 0x5A, sizeof(b));
+	CHECK(FTL_Write(10, b) == W25Qxx_RET_OK);
+	w25q_emu_reset_stat();
+	b[0] = 0x10;
+	CHECK(FTL_Write(10, b) == W25Qxx_RET_OK);
+	printf("  one page: %u page programs, %u erases\n", w25q_emu_stat.programs, w25q_emu_stat.erases);
+	CHECK(w25q_emu_stat.programs == 1 && w25q_emu_stat.erases == 0);
+	w25q_emu_reset_stat();
+	b[300] = 0x10;
+	b[600] = 0x10;
+	CHECK(FTL_Write(10, b) == W25Qxx_RET_OK);
+	printf("  two pages: %u page programs (remapped)\n", w25q_emu_stat.programs);
+	CHECK(w25q_emu_stat.programs > 16);
+	w25q_emu_reset_stat();
+	CHECK(FTL_Write(10, b) == W25Qxx_RET_OK);
+	CHECK(w25q_emu_stat.programs == 0);
+	FTL_Init();
+	CHECK(FTL_Read(10, r, 1) == W25Qxx_RET_OK && memcmp(r, b, sizeof(b)) == 0);
+}
+
+// The legacy flash drive with the files, the volume covers the whole flash
+static bool legacyDrive(uint8_t cold[], UINT size) {
+	if (!freshDrive(false) || FTL_Active())
+		return false;
+	return writeFile("font.bin", cold, size) && saveValue("config.dat", 7);
+}
+
+// Mount the drive the way the firmware does at startup
+static FLASH_STATUS startup(void) {
+	fsmount.invalidate();
+	W25Q w;
+	FLASH_STATUS ret = w.init();
+	w.umount();
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+	return ret;
+}
+
+// The legacy drive is migrated at startup keeping the files, the power loss leaves the drive legacy or migrated
+static void testFtlMigrate(void) {
+	printf("FTL migration of the legacy flash drive\n");
+	static uint8_t cold[200000];
+	static uint8_t check[200000];
+	for (uint32_t i = 0; i < sizeof(cold); ++i)
+		cold[i] = i * 13;
+	CHECK(legacyDrive(cold, sizeof(cold)));
+	uint32_t ops = w25q_emu_ops();
+	CHECK(startup() == FLASH_OK);
+	ops = w25q_emu_ops() - ops;
+	printf("  %u flash operations, %u logical sectors\n", ops, FTL_SectorCount());
+	CHECK(FTL_Active() && FTL_SectorCount() == FTL_MigrateSectors());
+	FTL_Init();
+	CHECK(FTL_Active());
+	CHECK(readFile("font.bin", check, sizeof(check)) && memcmp(cold, check, sizeof(cold)) == 0);
+	CHECK(loadValue("config.dat") == 7);
+	CHECK(saveValue("config.dat", 8) && loadValue("config.dat") == 8);
+	CHECK(f_mount(&fs, "0:/", 1) == FR_OK && fs.n_fatent - 2 == (FTL_SectorCount() - fs.database) / fs.csize);
+	f_mount(0, "0:/", 0);
+
+	uint16_t bad = 0;
+	for (uint32_t op = 1; op <= ops; ++op) {
+		if (!legacyDrive(cold, sizeof(cold))) {
+			CHECK(false);
+			break;
+		}
+		powerLoss(op, []() { startup(); });
+		bool ok = readFile("font.bin", check, sizeof(check)) && memcmp(cold, check, sizeof(cold)) == 0;
+		ok = ok && loadValue("config.dat") == 7;
+		ok = ok && startup() == FLASH_OK && FTL_Active();		// The migration is completed at next startup
+		ok = ok && readFile("font.bin", check, sizeof(check)) && memcmp(cold, check, sizeof(cold)) == 0;
+		if (!ok)
+			++bad;
+	}
+	printf("  power loss at every operation, lost drives: %u\n", bad);
+	CHECK(bad == 0);
+
+	CHECK(freshDrive(false));									// The file at the end of the volume, not migrated
+	static uint8_t big[(512 - 8) * 4096];
+	memset(big, 0x3C, sizeof(big));
+	CHECK(writeFile("big.bin", big, sizeof(big)));
+	CHECK(startup() == FLASH_OK && !FTL_Active());
+	CHECK(readFile("big.bin", big, sizeof(big)));
+}
+
+HOST_TEST_CASE(33, testFtlWear);
+HOST_TEST_CASE(33, testFtlPowerLoss);
+HOST_TEST_CASE(33, testFtlInPlace);
+HOST_TEST_CASE(33, testFtlMigrate);
@@ -0,0 +1,41 @@
+/*
+ * test_ftlready.cpp
+ *
+ *  2025 MAR 08
+ *  	The configuration record is written only when the erased free sectors are available (FTL_Ready()),
+ *  	so the write does not wait for the sector erase, see CFG::commitConfig()
+ */
+
+#include "host_test.h"
+#include "flash.h"
+
+// The main loop erases the free sectors in background and saves the record when the flash is ready
+static void testFtlReady(void) {
+	printf("FTL ready to write, 1000 saves\n");
+	W25Q w;
+	CHECK(freshDrive(false));
+	CHECK(!w.writeReady());										// The legacy flash drive always erases before write
+	CHECK(freshDrive(true));
+	CHECK(!w.writeReady());										// The free sectors are not checked yet
+	uint32_t erases = 0, polls = 0, max_polls = 0;
+	for (uint16_t k = 0; k < 1000; ++k) {
+		uint32_t n = 0;
+		while (!w.writeReady() && n < 1000) {
+			FTL_Poll();
+			host_tick += 5;
+			++n;
+		}
+		polls += n;
+		if (n > max_polls)
+			max_polls = n;
+		w25q_emu_reset_stat();
+		CHECK(saveValue("config.dat", k & 0xFF));
+		erases += w25q_emu_stat.erases;
+	}
+	printf("  %u erases while saving, main loop passes before the save: %u average, %u max\n", erases, polls / 1000, max_polls);
+	CHECK(erases == 0);
+	FTL_Init();
+	CHECK(loadValue("config.dat") == (999 & 0xFF));
+}
+
+HOST_TEST_CASE(35, testFtlReady);
@@ -0,0 +1,108 @@
+/*
+ * test_kvstore.cpp
+ *
+ *  2025 MAR 08
+ *  	The log-structured configuration store (kvstore.cpp): the record appending, the power loss during the save
+ *  	and the configuration and PID records of W25Q in config.kv
+ */
+
+#include "host_test.h"
+#include "kvstore.h"
+#include "flash.h"
+#include "fsmount.h"
+
+static KVSTORE	kv;
+
+typedef struct { uint16_t v[20]; } KV_TEST;
+
+static bool kvSave(uint8_t key, uint16_t value) {
+	KV_TEST rec;
+	for (uint8_t i = 0; i < 20; ++i)
+		rec.v[i] = value;
+	FIL f;
+	if (FR_OK != f_mount(&fs, "0:/", 1))
+		return false;
+	bool ok = (FR_OK == f_open(&f, "config.kv", FA_READ | FA_WRITE | FA_OPEN_ALWAYS));
+	if (ok) {
+		ok = kv.save(&f, key, &rec, sizeof(rec));
+		f_close(&f);
+	}
+	f_mount(0, "0:/", 0);
+	return ok;
+}
+
+static int kvLoad(uint8_t key) {
+	KV_TEST rec;
+	FIL f;
+	if (FR_OK != f_mount(&fs, "0:/", 1))
+		return -1;
+	bool ok = (FR_OK == f_open(&f, "config.kv", FA_READ | FA_WRITE | FA_OPEN_ALWAYS));
+	if (ok) {
+		ok = kv.load(&f, key, &rec, sizeof(rec));
+		f_close(&f);
+	}
+	f_mount(0, "0:/", 0);
+	if (!ok)
+		return -1;
+	for (uint8_t i = 1; i < 20; ++i) {
+		if (rec.v[i] != rec.v[0])
+			return -1;
+	}
+	return rec.v[0];
+}
+
+// The configuration records are appended to config.kv, the record survives the power loss
+static void testKVStore(void) {
+	printf("Configuration store\n");
+	CHECK(freshDrive(true));
+	kv.reset();
+	w25q_emu_reset_stat();
+	for (uint16_t k = 0; k < 1000; ++k) {
+		if (!kvSave(k % 2, k)) {
+			CHECK(false);
+			break;
+		}
+	}
+	printf("  1000 saves: %u erases, %u page programs\n", w25q_emu_stat.erases, w25q_emu_stat.programs);
+	CHECK(kvLoad(0) == 998 && kvLoad(1) == 999);
+	kv.reset();
+	CHECK(kvLoad(0) == 998 && kvLoad(1) == 999);
+	srand(3);
+	uint16_t bad = 0;
+	for (uint16_t t = 0; t < 500; ++t) {
+		int before[2] = { kvLoad(0), kvLoad(1) };
+		uint16_t v = 5000 + t;
+		uint8_t key = t % 2;
+		powerLoss(1 + rand() % 4, [key, v]() { kvSave(key, v); });
+		kv.reset();
+		int after[2] = { kvLoad(0), kvLoad(1) };
+		if ((after[key] != before[key] && after[key] != v) || after[1 - key] != before[1 - key])
+			++bad;
+	}
+	printf("  500 power losses: %d records lost or damaged\n", bad);
+	CHECK(bad == 0);
+}
+
+// The whole configuration and PID records are saved with the header in config.kv and read back
+static void testKVRecords(void) {
+	printf("Configuration and PID records, %u and %u bytes\n", (unsigned)sizeof(RECORD), (unsigned)sizeof(PID_PARAMS));
+	CHECK(freshDrive(true));
+	fsmount.invalidate();
+	W25Q w;
+	CHECK(w.init() == FLASH_OK);
+	RECORD cfg, cfg_read;
+	PID_PARAMS pid, pid_read;
+	memset((void *)&cfg, 0x35, sizeof(cfg));
+	memset((void *)&pid, 0x47, sizeof(pid));
+	memset((void *)&cfg_read, 0, sizeof(cfg_read));
+	memset((void *)&pid_read, 0, sizeof(pid_read));
+	CHECK(w.saveRecord(&cfg) && w.savePIDparams(&pid));
+	w.umount();
+	W25Q r;														// Read the store index again
+	CHECK(r.loadRecord(&cfg_read) && memcmp(&cfg, &cfg_read, sizeof(cfg)) == 0);
+	CHECK(r.loadPIDparams(&pid_read) && memcmp(&pid, &pid_read, sizeof(pid)) == 0);
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+}
+
+HOST_TEST_CASE(34, testKVStore);
+HOST_TEST_CASE(34, testKVRecords);
@@ -0,0 +1,99 @@
+/*
+ * test_msc.cpp
+ *
+ *  2025 MAR 08
+ *  	The USB mass storage write-combining and read-ahead cache (usbd_storage_if.c) and the flash access arbiter
+ *  	between the USB host and the firmware (fsmount.cpp)
+ */
+
+#include "host_test.h"
+#include "fsmount.h"
+#include "usbd_storage_if.h"
+
+static uint8_t	host_img[W25Q_EMU_SECTORS][4096];			// The drive content written by the host
+
+static void hostWrite(uint16_t sector, uint8_t value) {
+	memset(host_img[sector], value, 4096);
+	CHECK(USBD_OK == USBD_Storage_Interface_fops_FS.Write(0, host_img[sector], sector, 1));
+	host_tick += 3;
+}
+
+// The host copies the files, the FAT and the directory sectors are rewritten after every chunk
+static void testMSC(void) {
+	printf("USB mass storage cache\n");
+	uint32_t programs[2] = { 0, 0 };
+	for (uint8_t cache = 0; cache < 2; ++cache) {
+		w25q_emu_erase_chip();
+		CHECK(W25Qxx_Init() && FTL_Format());
+		uint16_t n = FTL_SectorCount();
+		for (uint16_t s = 0; s < n; ++s)
+			FTL_Read(s, host_img[s], 1);
+		CHECK(USBD_OK == USBD_Storage_Interface_fops_FS.Init(0));
+		if (cache)
+			fsmount.poll();
+		w25q_emu_reset_stat();
+		uint8_t v = 1;
+		for (uint8_t file = 0; file < 5; ++file) {				// 5 files by 64k, FAT and directory updated after every 16k
+			for (uint8_t c = 0; c < 4; ++c) {
+				for (uint8_t d = 0; d < 4; ++d)
+					hostWrite(10 + file*16 + c*4 + d, v++);
+				hostWrite(2, v++);
+				hostWrite(3, v++);
+				cache?fsmount.poll():FTL_Poll();
+			}
+		}
+		for (uint8_t i = 0; i < 20; ++i) {						// Appending the log file
+			hostWrite(200, v++);
+			hostWrite(2, v++);
+			hostWrite(3, v++);
+			host_tick += 50;
+			cache?fsmount.poll():FTL_Poll();
+		}
+		host_tick += 1000;
+		cache?fsmount.poll():FTL_Poll();
+		programs[cache] = w25q_emu_stat.programs;
+		printf("  %s: 180 host sector writes, %u page programs, %u erases\n", cache?"cache   ":"no cache",
+				w25q_emu_stat.programs, w25q_emu_stat.erases);
+		uint16_t bad = 0, hits = 0;
+		static uint8_t b[4096];
+		for (uint16_t s = 0; s < n; ++s) {
+			FTL_Read(s, b, 1);
+			if (memcmp(b, host_img[s], 4096))
+				++bad;
+		}
+		CHECK(bad == 0);
+		for (uint16_t s = 0; s < n; ++s) {						// Sequential read, the next sector is read ahead
+			if (cache)
+				fsmount.poll();
+			uint32_t reads = w25q_emu_stat.reads;
+			USBD_Storage_Interface_fops_FS.Read(0, b, s, 1);
+			if (reads == w25q_emu_stat.reads)
+				++hits;
+			if (memcmp(b, host_img[s], 4096))
+				++bad;
+		}
+		CHECK(bad == 0);
+		if (cache) {
+			printf("  %d of %d sequential reads served from the read-ahead buffer\n", hits, n);
+			hostWrite(2, 0xAB);									// The host data is read from the buffer before written back
+			USBD_Storage_Interface_fops_FS.Read(0, b, 2, 1);
+			CHECK(memcmp(b, host_img[2], 4096) == 0);
+			host_tick += 1000;
+			w25q_emu_protect(true);								// The write back fails: the data remains in RAM, the firmware waits
+			CHECK(!fsmount.lock());
+			CHECK(!fsmount.mount());
+			USBD_Storage_Interface_fops_FS.Read(0, b, 2, 1);
+			CHECK(memcmp(b, host_img[2], 4096) == 0);
+			w25q_emu_protect(false);
+			fsmount.poll();
+			CHECK(fsmount.lock());
+			FTL_Read(2, b, 1);
+			CHECK(memcmp(b, host_img[2], 4096) == 0);
+			fsmount.unlock();
+		}
+	}
+	CHECK(programs[1] < programs[0]);
+}
+
+
+HOST_TEST_CASE(41, testMSC);
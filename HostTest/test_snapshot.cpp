@@ -0,0 +1,64 @@
+/*
+ * test_snapshot.cpp
+ *
+ *  2025 MAR 08
+ *  	The fast startup from the working data snapshot (config.cpp, CFG::loadSnapshot() and CFG::reconcile()):
+ *  	the tips of the snapshot are checked when the tip table is loaded, the configuration is not written before
+ */
+
+#include "host_test.h"
+#include "config.h"
+#include "fsmount.h"
+
+static const char tip_list[] = "T12-B\r\nT12-BC2\r\nT12-D24\r\nT12-K\r\nC245-907\r\n";	// Global tip index 1-5
+
+// The snapshot keeps the tip deactivated by the USB host, the nearest activated tip is selected by reconcile()
+static void testSnapshotBoot(void) {
+	printf("Snapshot boot\n");
+	CHECK(host_flash_map(SNAP_PAGE_ADDR));
+	CHECK(freshDrive(true));
+	CHECK(writeFile("tip_list.txt", tip_list, strlen(tip_list)));
+	fsmount.invalidate();
+	RADIX bc2, k;
+	bc2.init("T12-BC2", 7);
+	k.init("T12-K", 5);
+	RECORD rec;
+	{
+		CFG c;													// The first startup, no snapshot
+		c.init();
+		CHECK(c.tipsTotal() == 6);
+		CHECK(c.toggleTipActivation(2) && c.toggleTipActivation(4) && c.toggleTipActivation(5));
+		c.changeTip(bc2);
+		c.commitConfig(true, true);
+		CHECK(!c.isConfigPending() && c.currentTip(d_t12).match(bc2));
+		CHECK(c.toggleTipActivation(2));						// Deactivated, the snapshot is not changed
+		c.umount();
+		fsmount.invalidate();
+	}
+	CFG c;
+	CHECK(c.init() == CFG_OK);
+	CHECK(c.currentTip(d_t12).match(bc2));						// The tip of the snapshot, the tip table is not loaded yet
+	c.savePresetTempHuman(333, d_t12);
+	c.saveConfig();
+	uint8_t steps = 0;
+	for ( ; steps < 10 && c.isConfigPending(); ++steps) {
+		c.commitConfig(true, true);
+		if (c.isConfigPending()) {								// Not written, check the configuration in the flash drive
+			W25Q w;
+			CHECK(w.loadRecord(&rec) && rec.t12_temp != 333);
+			w.umount();
+		}
+		c.reconcile();
+	}
+	printf("  the configuration is written after %d main loop passes\n", steps);
+	CHECK(steps == 4);											// Three reconcile() steps
+	CHECK(c.currentTip(d_t12).match(k));						// The nearest activated tip
+	c.umount();
+	fsmount.invalidate();
+	W25Q w;
+	CHECK(w.loadRecord(&rec) && rec.t12_temp == 333 && rec.t12_tip.match(k));
+	w.umount();
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+}
+
+HOST_TEST_CASE(50, testSnapshotBoot);
@@ -0,0 +1,62 @@
+/*
+ * test_tipdata.cpp
+ *
+ *  2025 MAR 08
+ *  	The additional tip data files (flash.cpp, W25Q::saveTipRecord()): the record written beyond the end of file
+ */
+
+#include "host_test.h"
+#include "flash.h"
+#include "fsmount.h"
+
+/*
+ * The free cluster keeps the valid tip PID records of the removed file, as it happens when the USB host removes the file.
+ * The record written beyond the end of new file should not make these records valid again
+ */
+static void testTipRecordGap(void) {
+	printf("Tip data file gap\n");
+	CHECK(freshDrive(true));
+	fsmount.invalidate();
+	W25Q w;
+	TIP_PID pid = TIP_PID();
+	for (uint8_t i = 0; i < 5; ++i) {
+		pid.name.init(TIP_T12, "BC2", 3);
+		pid.Kp = 100 + i;
+		CHECK(w.saveTipPIDparams(&pid, i));
+	}
+	static BYTE stale[4096];
+	memset(stale, 0, sizeof(stale));
+	CHECK(fsmount.mount());
+	FIL f;
+	UINT br = 0;
+	CHECK(FR_OK == f_open(&f, "tippid.dat", FA_READ) && FR_OK == f_read(&f, stale, sizeof(stale), &br));
+	CHECK(br == 6 * 16);										// The header and 5 records, 16 bytes slot
+	DWORD clst = f.obj.sclust;									// The first cluster of the file
+	f_close(&f);
+	CHECK(FR_OK == f_unlink("tippid.dat"));
+	FATFS *vol = fsmount.fs();
+	LBA_t sector = vol->database + (clst - 2) * vol->csize;
+	fsmount.release();
+	CHECK(FTL_Write(sector, stale) == W25Qxx_RET_OK);			// The stale data in the free cluster
+	fsmount.invalidate();										// The first free cluster is allocated to new file
+
+	pid.Kp = 200;
+	CHECK(w.saveTipPIDparams(&pid, 5));
+	TIP_PID check;
+	uint8_t valid = 0;
+	for (uint8_t i = 0; i < 5; ++i) {
+		if (w.loadTipPIDparams(&check, i))
+			++valid;
+	}
+	CHECK(valid == 0);
+	CHECK(w.loadTipPIDparams(&check, 5) && check.Kp == 200);
+	CHECK(fsmount.mount());
+	CHECK(FR_OK == f_open(&f, "tippid.dat", FA_READ));
+	printf("  the record 5 is in the cluster %s\n", (f.obj.sclust == clst)?"of the removed file":"other than removed one");
+	f_close(&f);
+	fsmount.release();
+	w.umount();
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+}
+
+HOST_TEST_CASE(28, testTipRecordGap);
@@ -0,0 +1,119 @@
+/*
+ * test_tipfiles.cpp
+ *
+ *  2025 MAR 08
+ *  	The tip data files with the version header and CRC-32 of every record (flash.cpp, W25Q::openTipFile()):
+ *  	the conversion of the previous file format, the power loss during the conversion, the damaged record
+ */
+
+#include "host_test.h"
+#include "flash.h"
+#include "fsmount.h"
+
+// The tip records in the previous file format, the checksum is calculated the same way as W25Q::TIP_checkSum() does
+static void oldTips(TIP tip[3]) {
+	for (uint8_t i = 0; i < 3; ++i) {
+		char name[8];
+		snprintf(name, sizeof(name), "B%d", i);
+		tip[i] = TIP();
+		tip[i].name.init(TIP_JBC, name, 2);
+		tip[i].t200 = 100 + i;
+		tip[i].t400 = 400 + i;
+		uint32_t summ = tip[i].t200;
+		summ <<= 1; summ += tip[i].t260;
+		summ <<= 1; summ += tip[i].t330;
+		summ <<= 1; summ += tip[i].t400;
+		summ <<= 1; summ += tip[i].name.word32();
+		summ <<= 1; summ += tip[i].ambient;
+		tip[i].crc = (summ + 117) & 0xFF;
+	}
+	tip[1].crc += 1;											// The damaged record
+}
+
+// The tip PID records in the previous file format, see W25Q::TPID_checkSum()
+static void oldPIDs(TIP_PID pid[2]) {
+	for (uint8_t i = 0; i < 2; ++i) {
+		pid[i] = TIP_PID();
+		pid[i].name.init(TIP_T12, "BC2", 3);
+		pid[i].Kp = 300 + i;
+		uint32_t summ = pid[i].name.word32();
+		summ <<= 1; summ += pid[i].Kp;
+		summ <<= 1; summ += pid[i].Ki;
+		summ <<= 1; summ += pid[i].Kd;
+		pid[i].crc = (summ + 117) & 0xFF;
+	}
+}
+
+// Check the tip data files are converted: the correct records are kept at their index, the damaged one is invalid
+static bool converted(W25Q &w) {
+	TIP		tip;
+	TIP_PID	pid;
+	bool ok = (w.loadTipData(&tip, 0) == TIP_OK && tip.t200 == 100 && tip.t400 == 400);
+	ok = ok && w.loadTipData(&tip, 1) == TIP_CHECKSUM;
+	ok = ok && w.loadTipData(&tip, 2) == TIP_OK && tip.t200 == 102;
+	ok = ok && w.loadTipPIDparams(&pid, 0) && pid.Kp == 300;
+	ok = ok && w.loadTipPIDparams(&pid, 1) && pid.Kp == 301;
+	w.umount();
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+	return ok;
+}
+
+static bool oldDrive(void) {
+	TIP		tip[3];
+	TIP_PID	pid[2];
+	oldTips(tip);
+	oldPIDs(pid);
+	return freshDrive(true) && writeFile("tipcal.dat", tip, sizeof(tip)) && writeFile("tippid.dat", pid, sizeof(pid));
+}
+
+// The files of the previous format are converted when opened, the conversion interrupted by the power loss is completed
+static void testTipFileUpgrade(void) {
+	printf("Tip data files upgrade\n");
+	CHECK(oldDrive());
+	fsmount.invalidate();
+	W25Q w;
+	uint32_t ops = w25q_emu_ops();
+	CHECK(converted(w));
+	ops = w25q_emu_ops() - ops;
+	uint8_t hdr[32];
+	CHECK(readFile("tipcal.dat", hdr, sizeof(hdr)) && memcmp(hdr, "TIPF", 4) == 0);
+	static uint8_t data[4 * 32 + 1];
+	CHECK(readFile("tipcal.dat", data, 4 * 32) && !readFile("tipcal.dat", data, 4 * 32 + 1));	// The header and 3 slots
+	CHECK(converted(w));										// The converted files are not changed
+
+	uint16_t bad = 0;
+	for (uint32_t op = 1; op <= ops; op += 3) {
+		if (!oldDrive()) {
+			CHECK(false);
+			break;
+		}
+		powerLoss(op, [&w]() { converted(w); });
+		if (!converted(w))
+			++bad;
+	}
+	printf("  %u flash operations, power loss every 3 operations, lost records: %u\n", ops, bad);
+	CHECK(bad == 0);
+}
+
+// The changed byte of one record invalidates this record only
+static void testTipFileDamage(void) {
+	printf("Tip data file damaged record\n");
+	CHECK(oldDrive());
+	fsmount.invalidate();
+	W25Q w;
+	CHECK(converted(w));
+	static uint8_t data[4 * 32];
+	CHECK(readFile("tipcal.dat", data, sizeof(data)));
+	data[3 * 32 + 5] ^= 0x10;									// The tip 2 record
+	CHECK(writeFile("tipcal.dat", data, sizeof(data)));
+	TIP tip;
+	CHECK(w.loadTipData(&tip, 0) == TIP_OK && tip.t200 == 100);
+	CHECK(w.loadTipData(&tip, 1) == TIP_CHECKSUM);
+	CHECK(w.loadTipData(&tip, 2) == TIP_CHECKSUM);
+	CHECK(w.loadTipData(&tip, 3) == TIP_IO);
+	w.umount();
+	fsmount.invalidate();
+}
+
+HOST_TEST_CASE(49, testTipFileUpgrade);
+HOST_TEST_CASE(49, testTipFileDamage);
@@ -0,0 +1,58 @@
+/*
+ * test_tiplookup.cpp
+ *
+ *  2025 MAR 08
+ *  	The tip lookup by binary search in the sorted catalogue (iron_tips.cpp, TIPS::buildIndex() and TIPS::find())
+ */
+
+#include "host_test.h"
+#include "iron_tips.h"
+
+// The random tip name of 2 letters from the short alphabet, so many names are duplicated
+static void randomTip(RADIX &r) {
+	static const char		letters[] = "ABC12";
+	static const TIP_TYPE_t	types[] = { TIP_T12, TIP_N1, TIP_JBC, TIP_C245 };
+	char name[2] = { letters[rand() % 5], letters[rand() % 5] };
+	r.init(types[rand() % 4], name, 1 + rand() % 2);
+}
+
+// The binary search finds the same tip as the linear scan of the catalogue: the first one of the duplicated names
+static void testTipLookup(void) {
+	printf("Tip lookup, 600 tips, 2000 probes\n");
+	const uint16_t size = 600;
+	static RADIX names[size];
+	TIPS tips;
+	CHECK(tips.create(size));
+	srand(11);
+	names[0].init(TIP_HOTGUN, "GUN", 3);
+	tips.initTip(0, names[0]);
+	for (uint16_t i = 1; i < size; ++i) {
+		randomTip(names[i]);
+		tips.initTip(i, names[i]);
+	}
+	tips.buildIndex();
+	uint16_t bad = 0, found = 0;
+	for (uint16_t p = 0; p < 2000; ++p) {
+		RADIX probe;
+		if (p % 2)
+			probe.init(names[rand() % size]);
+		else
+			randomTip(probe);
+		int16_t expected = -1;
+		for (uint16_t i = 0; i < size; ++i) {
+			if (names[i].match(probe)) {
+				expected = i;
+				break;
+			}
+		}
+		int16_t index = tips.index(probe);
+		if (index != expected)
+			++bad;
+		if (index >= 0)
+			++found;
+	}
+	printf("  %u found, %u mismatches\n", found, bad);
+	CHECK(bad == 0);
+}
+
+HOST_TEST_CASE(42, testTipLookup);
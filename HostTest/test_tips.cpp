@@ -0,0 +1,153 @@
+/*
+ * test_tips.cpp
+ *
+ *  2025 MAR 08
+ *  	The two-tier tip catalogue (iron_tips.cpp): the catalogue cached in tipindex.bin and read from the flash by pages,
+ *  	only the activated and calibrated tips are kept in RAM
+ */
+
+#include <string>
+#include <vector>
+#include "host_test.h"
+#include "flash.h"
+#include "fsmount.h"
+
+// The tip catalogue loaded the same way as CFG::loadGlobalTipList() does
+class HOST_CFG : public W25Q {
+	public:
+		TIPS		tips;
+		uint16_t	parsed		= 0;							// tip_list.txt has been parsed
+		uint16_t	loaded		= 0;							// tipLoaded() calls
+		bool		attach		= true;							// Use the catalogue on the flash drive
+		uint16_t loadTipList(void) {
+			if (attach && loadTipIndex(tips))
+				return tips.total();
+			++parsed;
+			uint8_t tip_name[16];
+			uint16_t tip_count = 0;
+			uint8_t br = 0;
+			RADIX r;
+			while ((br = tipListReadNextItem((const char *)tip_name, 16))) {
+				if (r.init((const char *)tip_name, br))
+					++tip_count;
+			}
+			tipListEnd();
+			++tip_count;
+			if (tips.create(tip_count)) {
+				r.init(TIP_HOTGUN, "GUN", 3);
+				tips.initTip(0, r);
+				for (uint16_t tip = 1; tip < tip_count;) {
+					br = tipListReadNextItem((const char *)tip_name, 16);
+					if (br == 0) break;
+					if (r.init((const char *)tip_name, br)) {
+						if (!tips.initTip(tip, r))
+							break;
+						++tip;
+					}
+				}
+				tipListEnd();
+				tips.buildIndex();
+				if (attach && saveTipIndex(tips))
+					loadTipIndex(tips);
+			}
+			return tip_count;
+		}
+	protected:
+		bool tipLoaded(TIP* tip, uint8_t tip_index) {
+			++loaded;
+			return tips.applyCalibtationIndex(tip->name, tip_index);
+		}
+};
+
+// The catalogue read from the flash by pages matches the catalogue in RAM: names, lookups and navigation
+static void testTips(void) {
+	printf("Tip catalogue\n");
+	std::string path = std::string(root) + "/NLS/tip_list.txt";
+	FILE *src = fopen(path.c_str(), "rb");
+	CHECK(src != 0);
+	if (!src)
+		return;
+	std::vector<char> list(200000);
+	size_t size = fread(list.data(), 1, list.size(), src);
+	fclose(src);
+	std::string all(list.data(), size);
+	for (uint8_t k = 0; k < 6; ++k)								// Make the list longer, the duplicated names as well
+		all += std::string(list.data(), size);
+	w25q_emu_erase_chip();
+	CHECK(W25Qxx_Init());
+	HOST_CFG w;
+	CHECK(w.formatFlashDrive());
+	CHECK(w.init() == FLASH_OK);
+	CHECK(fsmount.mount());
+	FIL f;
+	UINT bw = 0;
+	CHECK(FR_OK == f_open(&f, "tip_list.txt", FA_CREATE_ALWAYS | FA_WRITE));
+	f_write(&f, all.data(), all.size(), &bw);
+	f_close(&f);
+	fsmount.release();
+
+	HOST_CFG ref;
+	ref.attach = false;
+	ref.loadTipList();
+	uint16_t total = ref.tips.total();
+	uint16_t saved = 0;
+	for (uint16_t i = 1; i < total; i += 37) {					// Activate and calibrate some tips
+		TIP tip = TIP();
+		tip.name = ref.tips.radix(i);
+		if (i % 2) tip.name.setActivated();
+		if (i % 3) tip.name.setCalibrated();
+		if (w.saveTipData(&tip, false, NO_TIP_CHUNK) >= 0)
+			++saved;
+	}
+	ref.loadTipTable();
+
+	HOST_CFG a;
+	a.loadTipList();
+	a.loadTipTable();
+	HOST_CFG b;
+	uint32_t reads = w25q_emu_stat.reads;
+	b.loadTipList();
+	reads = w25q_emu_stat.reads - reads;
+	b.loadTipTable();
+	printf("  %d tips, %d records; parsed %d, then %d times; cached catalogue load: %u flash reads\n",
+			total, saved, a.parsed, b.parsed, reads);
+	CHECK(a.parsed == 1 && b.parsed == 0);
+	CHECK(b.tips.total() == total);
+	CHECK(b.tips.calibrated() == ref.tips.calibrated());
+	std::vector<uint32_t> names(total), keys(total);
+	for (uint16_t i = 0; i < total; ++i) {
+		names[i]	= ref.tips.radix(i).word32();
+		keys[i]		= ref.tips.radix(i).tip();				// The name without the activation flags
+	}
+	uint16_t bad = 0;
+	for (uint16_t i = 0; i < total; ++i) {
+		RADIX r = ref.tips.radix(i);
+		uint16_t first = 0;										// The linear search: the first tip of the name
+		while (first < total && keys[first] != keys[i])
+			++first;
+		if (b.tips.radix(i).word32() != names[i] || b.tips.index(r) != first || ref.tips.index(r) != first)
+			++bad;
+		if (b.tips.tipCalibrationIndex(i) != ref.tips.tipCalibrationIndex(i))
+			++bad;
+		for (uint8_t active = 0; active < 2; ++active) {
+			int16_t next = -1, prev = -1;
+			for (uint16_t j = i + 1; j < total; ++j) {
+				if (!active || ref.tips.radix(j).isActivated()) { next = j; break; }
+			}
+			for (uint16_t j = i - 1; j > 0 && j < i; --j) {
+				if (!active || ref.tips.radix(j).isActivated()) { prev = j; break; }
+			}
+			if (b.tips.nextTip(i, active) != next || b.tips.prevTip(i, active) != prev)
+				++bad;
+		}
+	}
+	RADIX missing;
+	missing.init(TIP_T12, "ZZZZZ", 5);
+	CHECK(b.tips.index(missing) < 0);
+	printf("  mismatches: %d\n", bad);
+	CHECK(bad == 0);
+	w.umount();
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+}
+
+HOST_TEST_CASE(46, testTips);
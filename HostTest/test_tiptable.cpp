@@ -0,0 +1,54 @@
+/*
+ * test_tiptable.cpp
+ *
+ *  2025 MAR 08
+ *  	The tip records loaded from tipcal.dat in one pass (flash.cpp, W25Q::loadTipTable())
+ */
+
+#include "host_test.h"
+#include "flash.h"
+#include "fsmount.h"
+
+// Counts the tip records passed by loadTipTable()
+class TABLE_W25Q : public W25Q {
+	public:
+		uint16_t	loaded		= 0;
+	protected:
+		bool tipLoaded(TIP*, uint8_t) {
+			++loaded;
+			return true;
+		}
+};
+
+// The tip records are read from tipcal.dat in one pass, every correct record is passed to tipLoaded()
+static void testTipTable(void) {
+	printf("Tip table load\n");
+	w25q_emu_erase_chip();
+	CHECK(W25Qxx_Init());
+	TABLE_W25Q w;
+	CHECK(w.formatFlashDrive());
+	CHECK(w.init() == FLASH_OK);
+	uint16_t bad = 0;
+	for (uint16_t i = 0; i <= NO_TIP_CHUNK; ++i) {				// The last record does not fit
+		TIP tip = TIP();
+		char name[8];
+		snprintf(name, sizeof(name), "B%04d", i);
+		tip.name.init(TIP_JBC, name, 5);
+		tip.t200 = i;
+		int16_t index = w.saveTipData(&tip, false, NO_TIP_CHUNK);
+		if ((i < NO_TIP_CHUNK && index != i) || (i == NO_TIP_CHUNK && index >= 0))
+			++bad;
+	}
+	CHECK(bad == 0);
+	uint32_t reads = w25q_emu_stat.reads;
+	w.loaded = 0;
+	w.loadTipTable();
+	printf("  %d records loaded, %u flash reads\n", w.loaded, w25q_emu_stat.reads - reads);
+	CHECK(w.loaded == NO_TIP_CHUNK);
+	TIP tip;
+	CHECK(w.loadTipData(&tip, 150) == TIP_OK && tip.t200 == 150);
+	w.umount();
+	fsmount.invalidate();										// The helpers mount the volume by their own FATFS
+}
+
+HOST_TEST_CASE(43, testTipTable);
@@ -0,0 +1,30 @@
+/*
+ * usbd_msc.h
+ *
+ *  2025 MAR 07
+ *  	The USB mass storage class types used by usbd_storage_if.c, built on the host computer, see host_test.cpp
+ */
+
+#ifndef HOST_USBD_MSC_H_
+#define HOST_USBD_MSC_H_
+
+#include "stm32f1xx_hal.h"
+
+#define STANDARD_INQUIRY_DATA_LEN	(36)
+
+typedef enum { USBD_OK = 0, USBD_BUSY, USBD_EMEM, USBD_FAIL } USBD_StatusTypeDef;
+
+typedef struct {
+	int8_t	(*Init)(uint8_t lun);
+	int8_t	(*GetCapacity)(uint8_t lun, uint32_t *block_num, uint16_t *block_size);
+	int8_t	(*IsReady)(uint8_t lun);
+	int8_t	(*IsWriteProtected)(uint8_t lun);
+	int8_t	(*Read)(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+	int8_t	(*Write)(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+	int8_t	(*GetMaxLun)(void);
+	int8_t	*pInquiry;
+} USBD_StorageTypeDef;
+
+typedef struct { void *pClassData; } USBD_HandleTypeDef;
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * w25q_emu.c
+ *
+ *  2025 MAR 07
+ *  	W25Q16 flash IC emulator on the SPI bus, see w25q_emu.h
+ */
+
+#include <stdio.h>
+#include "w25q_emu.h"
+#include "main.h"
+
+#define EMU_CMD_SIZE	(8 + 256)									// Command, address, dummy byte and the page data
+
+SPI_HandleTypeDef		hspi2	= { 0, 0, 0 };						// No DMA channels, the data is transferred by HAL_SPI_Transmit()
+W25Q_EMU_STAT			w25q_emu_stat;
+
+static uint8_t			flash[W25Q_EMU_SIZE];
+static const char*		image_file	= 0;
+static bool				selected	= false;
+static uint8_t			cmd[EMU_CMD_SIZE];							// The bytes sent while the chip is selected
+static uint16_t			cmd_len		= 0;
+static uint32_t			read_addr	= 0;							// The next byte to be read
+static bool				wel			= false;						// Write enable latch
+static bool				protect		= false;
+static uint32_t			ops			= 0;
+static uint32_t			fail_op		= 0;
+static jmp_buf*			fail_jump	= 0;
+
+bool w25q_emu_open(const char *image) {
+	image_file = image;
+	memset(flash, 0xFF, W25Q_EMU_SIZE);
+	FILE *f = fopen(image, "rb");
+	if (!f)
+		return false;
+	bool ok = (fread(flash, 1, W25Q_EMU_SIZE, f) == W25Q_EMU_SIZE);
+	fclose(f);
+	return ok;
+}
+
+bool w25q_emu_save(void) {
+	if (!image_file)
+		return false;
+	FILE *f = fopen(image_file, "wb");
+	if (!f)
+		return false;
+	bool ok = (fwrite(flash, 1, W25Q_EMU_SIZE, f) == W25Q_EMU_SIZE);
+	fclose(f);
+	return ok;
+}
+
+void w25q_emu_erase_chip(void) {
+	memset(flash, 0xFF, W25Q_EMU_SIZE);
+}
+
+uint8_t* w25q_emu_data(void) {
+	return flash;
+}
+
+void w25q_emu_reset_stat(void) {
+	memset(&w25q_emu_stat, 0, sizeof(W25Q_EMU_STAT));
+}
+
+uint32_t w25q_emu_max_erases(void) {
+	uint32_t max = 0;
+	for (uint16_t i = 0; i < W25Q_EMU_SECTORS; ++i) {
+		if (w25q_emu_stat.sector_erases[i] > max)
+			max = w25q_emu_stat.sector_erases[i];
+	}
+	return max;
+}
+
+void w25q_emu_power_loss(uint32_t op, jmp_buf *jb) {
+	fail_op		= op;
+	fail_jump	= jb;
+}
+
+uint32_t w25q_emu_ops(void) {
+	return ops;
+}
+
+void w25q_emu_protect(bool on) {
+	protect = on;
+}
+
+static uint32_t cmdAddr(void) {
+	return ((uint32_t)cmd[1] << 16) | ((uint32_t)cmd[2] << 8) | cmd[3];
+}
+
+// The power is lost during this operation: the operation is done partially, the test continues after setjmp()
+static bool powerLost(void) {
+	if (++ops != fail_op || !fail_jump)
+		return false;
+	fail_op = 0;
+	wel		= false;
+	return true;
+}
+
+// The command is executed when the chip select pin goes high
+static void execute(void) {
+	if (cmd_len == 0)
+		return;
+	uint32_t addr = cmdAddr() % W25Q_EMU_SIZE;
+	switch (cmd[0]) {
+		case 0x06:
+			wel = !protect;
+			break;
+		case 0x04:
+			wel = false;
+			break;
+		case 0x20:
+			if (!wel || cmd_len < 4)
+				break;
+			addr &= ~0xFFFu;
+			if (powerLost()) {
+				memset(flash + addr, 0xFF, 2048);
+				longjmp(*fail_jump, 1);
+			}
+			memset(flash + addr, 0xFF, 4096);
+			++w25q_emu_stat.erases;
+			++w25q_emu_stat.sector_erases[addr >> 12];
+			wel = false;
+			break;
+		case 0x02:
+		{
+			if (!wel || cmd_len < 4)
+				break;
+			uint16_t size = cmd_len - 4;
+			if (powerLost())
+				size /= 2;
+			for (uint16_t i = 0; i < size; ++i) {			// The address wraps inside the page
+				uint32_t a = (addr & ~0xFFu) | ((addr + i) & 0xFFu);
+				flash[a] &= cmd[4 + i];
+			}
+			if (size < cmd_len - 4)
+				longjmp(*fail_jump, 1);
+			++w25q_emu_stat.programs;
+			wel = false;
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+	if (port != FLASH_CS_GPIO_Port || pin != FLASH_CS_Pin)
+		return;
+	if (state == GPIO_PIN_RESET) {
+		selected	= true;
+		cmd_len		= 0;
+		return;
+	}
+	if (selected) {
+		selected = false;
+		execute();
+	}
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout) {
+	UNUSED(hspi);
+	UNUSED(timeout);
+	if (!selected || cmd_len + size > EMU_CMD_SIZE)
+		return HAL_ERROR;
+	memcpy(cmd + cmd_len, data, size);
+	cmd_len += size;
+	if (cmd[0] == 0x03 || cmd[0] == 0x0B)
+		read_addr = cmdAddr();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout) {
+	UNUSED(hspi);
+	UNUSED(timeout);
+	if (!selected || cmd_len == 0)
+		return HAL_ERROR;
+	if (cmd[0] == 0x9F) {
+		for (uint16_t i = 0; i < size; ++i)
+			data[i] = (i < 3)?(W25Q_EMU_JEDEC_ID >> (16 - 8*i)) & 0xFF:0;
+		return HAL_OK;
+	}
+	if (cmd[0] == 0x03 || cmd[0] == 0x0B) {
+		if (read_addr == cmdAddr())
+			++w25q_emu_stat.reads;
+		for (uint16_t i = 0; i < size; ++i)
+			data[i] = flash[(read_addr + i) % W25Q_EMU_SIZE];
+		read_addr += size;
+		return HAL_OK;
+	}
+	return HAL_ERROR;
+}
+
+// Status registers, the operations are complete immediately, so the BUSY bit is never set
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout) {
+	UNUSED(hspi);
+	UNUSED(timeout);
+	if (!selected)
+		return HAL_ERROR;
+	memset(rx, 0, size);
+	if (size > 1) {
+		if (tx[0] == 0x05)
+			rx[1] = wel?0x02:0;
+		else if (tx[0] == 0x35)
+			rx[1] = 0x02;									// Quad enable bit
+	}
+	cmd[0]	= tx[0];
+	cmd_len	= 1;
+	return HAL_OK;
+}
+
+// The DMA is not used: the flash SPI port has no DMA channels, see hspi2
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef *hdma, uint32_t src, uint32_t dst, uint32_t length) {
+	UNUSED(hdma);
+	UNUSED(src);
+	UNUSED(dst);
+	UNUSED(length);
+	return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_DMA_PollForTransfer(DMA_HandleTypeDef *hdma, uint32_t level, uint32_t timeout) {
+	UNUSED(hdma);
+	UNUSED(level);
+	UNUSED(timeout);
+	return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma) {
+	UNUSED(hdma);
+	return HAL_OK;
+}
@@ -0,0 +1,54 @@
+/*
+ * w25q_emu.h
+ *
+ *  2025 MAR 07
+ *  	W25Q16 flash IC emulator for the host tests of the flash drive code, see host_test.cpp
+ *
+ *  The emulator implements the SPI commands used by W25Qxx.c (JEDEC ID, status, write enable, read, page program,
+ *  sector erase) behind HAL_SPI_Transmit()/HAL_SPI_Receive() and the FLASH_CS pin. The flash content is kept in RAM
+ *  and can be loaded from and saved to the image file, so the same drive can be checked by several test runs.
+ *  Programming only clears the bits, as the real flash does. The erase and program operations are counted
+ *  (per sector as well) to measure the flash wear. The power loss is emulated by breaking the n-th erase or program
+ *  operation in the middle (a half of the page is programmed or a half of the sector is erased) and jumping
+ *  to the point saved by setjmp(). The write protection makes the write enable command fail, as the locked chip does.
+ */
+
+#ifndef W25Q_EMU_H_
+#define W25Q_EMU_H_
+
+#include <setjmp.h>
+#include "stm32f1xx_hal.h"
+
+#define W25Q_EMU_JEDEC_ID	(0xEF4015)								// W25Q16: 2 MB
+#define W25Q_EMU_SECTORS	(512)
+#define W25Q_EMU_SIZE		(W25Q_EMU_SECTORS * 4096)
+
+typedef struct {
+	uint32_t	erases;												// Sector erase operations
+	uint32_t	programs;											// Page program operations
+	uint32_t	reads;												// Read commands
+	uint32_t	sector_erases[W25Q_EMU_SECTORS];					// Erase operations of every sector
+} W25Q_EMU_STAT;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern SPI_HandleTypeDef	hspi2;
+extern W25Q_EMU_STAT		w25q_emu_stat;
+
+bool		w25q_emu_open(const char *image);						// Load the image file, the erased chip if the file does not exist
+bool		w25q_emu_save(void);									// Write the flash content to the image file
+void		w25q_emu_erase_chip(void);
+uint8_t*	w25q_emu_data(void);									// The flash content
+void		w25q_emu_reset_stat(void);
+uint32_t	w25q_emu_max_erases(void);								// Erase operations of the most worn sector
+void		w25q_emu_power_loss(uint32_t ops, jmp_buf *jb);			// Break the ops-th erase or program operation, 0 to disable
+uint32_t	w25q_emu_ops(void);										// Erase and program operations since start
+void		w25q_emu_protect(bool on);								// Write protection: the write enable command is ignored
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
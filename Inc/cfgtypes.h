@@ -3,6 +3,14 @@
  *
  *  2024 NOV 16
  *  	Ported from JBC controller source code, tailored to the new hardware
+ *  2025 FEB 14
+ *  	Added TIP_CURVE record: the complete tip calibration data
+ *  2025 FEB 17
+ *  	Added TIP_PID record: the tip specific PID parameters
+ *  2025 FEB 19
+ *  	Added TIP_FPRINT record: the tip heat-up signature
+ *  2025 MAR 08
+ *  	The tip data files keep every record in the slot with CRC-32, crc field is the checksum of the previous file format
  */
 
 #ifndef CFGTYPES_H_
@@ -78,7 +86,7 @@ struct s_pid_params {
 };
 
 /*
- * Configuration data of each initialized tip are saved in the tipcal.dat file (16 bytes per tip record).
+ * Configuration data of each initialized tip are saved in the tipcal.dat file (16 bytes per tip record, 32 bytes slot with CRC-32).
  * The tip configuration record has the following format:
  * 4 reference temperature points
  * tip name in RADIX encoding
@@ -90,7 +98,56 @@ struct s_tip {
 	RADIX		name;								// Tip name + tip calibration mask
 	int8_t		ambient;							// The ambient temperature in Celsius when the tip being calibrated
 	uint8_t		reserved[2];						// Not used
-	uint8_t		crc;								// CRC checksum
+	uint8_t		crc;								// The checksum of the previous file format
+};
+
+/*
+ * The complete calibration data of the tip, collected by automatic calibration procedure, are saved
+ * in the tipcurve.dat file. The record index in the file is the same as the index of the tip record in tipcal.dat
+ * The tip calibration curve is a monotone piecewise linear function built through the calibration points.
+ * The record is valid if the version is correct and the reference points are the same as in the tip record of tipcal.dat,
+ * so the tips calibrated by old firmware (or manually) use 4 reference points from tipcal.dat only
+ */
+#define TIP_CURVE_VERSION	(1)
+#define TIP_CURVE_POINTS	(8)
+typedef struct s_tip_curve TIP_CURVE;
+struct s_tip_curve {
+	uint8_t		version;							// The record format version, TIP_CURVE_VERSION
+	uint8_t		points;								// Number of calibration points
+	int8_t		ambient;							// The ambient temperature in Celsius when the tip being calibrated
+	uint8_t		crc;								// The checksum of the previous file format
+	RADIX		name;								// Tip name
+	uint16_t	ref[4];								// The internal temperature in reference points, the same as in the tip record
+	uint16_t	real[TIP_CURVE_POINTS];				// The real temperature of calibration points (Celsius)
+	uint16_t	internal[TIP_CURVE_POINTS];			// The internal temperature of calibration points
+};
+
+/*
+ * The tip specific PID parameters are saved in the tippid.dat file. The record index in the file
+ * is the same as the index of the tip record in tipcal.dat. If the tip has no valid record,
+ * the common PID parameters of the device are used (see PID_PARAMS)
+ */
+typedef struct s_tip_pid TIP_PID;
+struct s_tip_pid {
+	RADIX		name;								// Tip name
+	uint16_t	Kp, Ki, Kd;							// The tip PID coefficients
+	uint8_t		reserved;							// Not used
+	uint8_t		crc;								// The checksum of the previous file format
+};
+
+/*
+ * The tip fingerprint is the heat-up signature of the tip: the temperature rise and the current through the tip
+ * when the fixed power probe pulse is applied to the just inserted cold tip. The temperature rise depends on the
+ * tip thermal mass, the current depends on the heater resistance. The fingerprints are saved in the tipfp.dat file,
+ * the record index in the file is the same as the index of the tip record in tipcal.dat
+ */
+typedef struct s_tip_fprint TIP_FPRINT;
+struct s_tip_fprint {
+	RADIX		name;								// Tip name
+	uint16_t	rise;								// The temperature rise during the probe pulse, internal units
+	uint16_t	current;							// The average current through the tip during the probe pulse
+	uint8_t		samples;							// Number of probe measurements averaged in the fingerprint
+	uint8_t		crc;								// The checksum of the previous file format
 };
 
 // This tip structure is used to show available tips when tip is activating
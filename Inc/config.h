@@ -3,6 +3,17 @@
  *
  *  2024 NOV 28, v.1.00
  *  	Ported from JBC controller source code, tailored to the new hardware
+ *  2025 FEB 12
+ *  	Added temperature translation table (TEMP_LUT) for tempToHuman() and humanToTemp()
+ *  2025 FEB 14
+ *  	The tip calibration curve built through all calibration points (TIP_CURVE)
+ *  2025 FEB 17
+ *  	The tip specific PID parameters (TIP_PID)
+ *  2025 FEB 19
+ *  	The tip fingerprints (TIP_FPRINT)
+ *  2025 MAR 07
+ *  	The configuration is written to the flash after a quiet period, see CFG::commitConfig()
+ *  	The working data is mirrored in the MCU flash page for the fast startup, see CFG_SNAPSHOT
  */
 
 #ifndef CONFIG_H_
@@ -16,6 +27,10 @@
 #include "cfgtypes.h"
 #include "iron_tips.h"
 #include "buzzer.h"
+#include "snapshot.h"
+
+#define CFG_COMMIT_DELAY	(5000)						// The quiet period (ms) after the last configuration change to write it to the flash
+#define CFG_COMMIT_MAX		(60000)						// Maximum time (ms) the changed configuration can be kept in RAM
 
 typedef enum {CFG_OK = 0, CFG_NO_TIP, CFG_NO_TIP_LIST, CFG_READ_ERROR, CFG_NO_FILESYSTEM} CFG_STATUS;
 
@@ -66,7 +81,9 @@ class CFG_CORE: public TIPS {
 		void		setDefaults(void);
 		void		setPIDdefaults(void);
 		void		syncConfig(void);
-		bool		areConfigsIdentical(void);
+		bool		areConfigsIdentical(void)			{ return areConfigsIdentical(a_cfg);		}
+		bool		areConfigsIdentical(RECORD &r_cfg);
+		RECORD*		spareConfig(void)					{ return &s_cfg;							}
 		PID_PARAMS	pid;								// PID parameters of all devices
 		RECORD		a_cfg;								// active configuration
 	private:
@@ -77,32 +94,80 @@ typedef struct s_TIP_RECORD	TIP_RECORD;
 struct s_TIP_RECORD {
 	uint16_t	calibration[4];
 	int8_t		ambient;
+	uint8_t		curve_points;							// Number of calibration curve points, 0 if only 4 reference points available
+	uint16_t	curve_real[TIP_CURVE_POINTS];			// The calibration curve: real temperature (Celsius)
+	uint16_t	curve_temp[TIP_CURVE_POINTS];			// The calibration curve: internal temperature
+	bool		has_pid;								// Whether the tip specific PID parameters loaded
+	PIDparam	pid;									// The tip specific PID parameters
+};
+
+/*
+ * Temperature translation table of the tip. Built when the tip calibration data is loaded or changed
+ * and rebuilt when the ambient temperature changes.
+ * The interval [0; last point] is split into segments by the calibration points:
+ * point 0 is (0, ambient), next points are (calibration[i], reference temperature[i] + ambient correction)
+ * or the calibration curve points if the tip calibration curve is loaded.
+ * Above the last point the temperature is extrapolated by the line (ext_temp[0], ext_celsius[0]) - (ext_temp[1], ext_celsius[1])
+ */
+#define TEMP_LUT_SIZE	(TIP_CURVE_POINTS+1)
+typedef struct s_TEMP_LUT	TEMP_LUT;
+struct s_TEMP_LUT {
+	uint16_t	temp[TEMP_LUT_SIZE];					// Internal temperature of the segment points
+	int16_t		celsius[TEMP_LUT_SIZE];					// Celsius temperature of the segment points
+	uint8_t		size;									// Number of the segment points
+	uint16_t	ext_temp[2];							// Extrapolation line: internal temperature points
+	int16_t		ext_celsius[2];							// Extrapolation line: Celsius temperature points
+	int16_t		ambient;								// The ambient temperature the table was built for
 };
 
 class TIP_CFG {
 	public:
-		TIP_CFG(void)									{ }
+		TIP_CFG(void)									{ for (uint8_t i = 0; i < 3; ++i) { resetTipCalibration(tDevice(i)); clearTipPID(tDevice(i)); } }
 		void		load(const TIP& tip, tDevice dev = d_t12);
+		void		loadCurve(const TIP_CURVE& curve, tDevice dev = d_t12);
 		void		dump(TIP* tip, tDevice dev = d_t12);
 		int8_t		ambientTemp(tDevice dev);
 		uint16_t	calibration(uint8_t index, tDevice dev);
 		uint16_t	referenceTemp(uint8_t index, tDevice dev);
 		uint16_t	tempCelsius(uint16_t temp, int16_t ambient, tDevice dev);
+		uint16_t	tempInternal(uint16_t celsius, int16_t ambient, tDevice dev);
 		void		getTipCalibtarion(uint16_t temp[4], tDevice dev);
 		void		resetTipCalibration(tDevice dev);
 		bool		isValidTipConfig(TIP *tip);
+		bool		hasTipPID(tDevice dev);
 	protected:
+		void		loadTipPID(const TIP_PID& tip_pid, tDevice dev);
+		void		applyTipPID(const PIDparam& pp, tDevice dev);
+		void		clearTipPID(tDevice dev);
+		bool		tipPID(tDevice dev, PIDparam& pp);
 		void		defaultCalibration(TIP *tip);
+		void		saveTipRecords(TIP_RECORD rec[3])	{ for (uint8_t i = 0; i < 3; ++i) rec[i] = tip[i];	}
+		void		loadTipRecords(const TIP_RECORD rec[3]);
 		tDevice		hardwareType(RADIX &tip_name);
 		void		changeTipCalibtarion(uint16_t temp[4], int8_t ambient, tDevice dev);
 	private:
+		void		buildTempLUT(int16_t ambient, uint8_t i);
 		TIP_RECORD	tip[3];								// Active T12 IRON tip (0), JBC IRON (1) and Hot Air Gun virtual tip (2)
+		TEMP_LUT	lut[3];								// Temperature translation tables of the active tips
 		const uint16_t	temp_ref_iron[4]	= { 200, 260, 330, 400};
 		const uint16_t	temp_ref_gun[4]		= { 200, 300, 400, 500};
 		const uint16_t	calib_default[4]	= {	1200, 1900, 2500, 2900};
 		const uint16_t	min_temp_diff		= 100;		// Minimal temperature difference between nearest reference points
 };
 
+/*
+ * The working data: the configuration, PID parameters and active tips calibration. The copy is kept
+ * in the MCU flash (see snapshot.h), so the working mode starts without reading the flash drive,
+ * the tip list and the tip table are loaded by CFG::reconcile() from the main loop then
+ */
+#define CFG_SNAP_VERSION	(1)
+typedef struct s_CFG_SNAPSHOT	CFG_SNAPSHOT;
+struct s_CFG_SNAPSHOT {
+	RECORD		cfg;
+	PID_PARAMS	pid;
+	TIP_RECORD	tip[3];
+};
+
 class CFG : public W25Q, public CFG_CORE, public TIP_CFG, public BUZZER {
 	public:
 		CFG(void)				{ }
@@ -116,22 +181,65 @@ class CFG : public W25Q, public CFG_CORE, public TIP_CFG, public BUZZER {
 		uint16_t	currentTipIndex(tDevice dev);
 		RADIX&		currentTip(tDevice dev);
 		bool 		isTipCalibrated(tDevice dev);
-		bool		saveTipCalibtarion(tDevice dev, uint16_t temp[4], uint8_t mask, int8_t ambient);
+		bool		saveTipCalibtarion(tDevice dev, uint16_t temp[4], uint8_t mask, int8_t ambient, TIP_CURVE *curve = 0);
 		bool		toggleTipActivation(uint16_t global_tip_index);
-		uint8_t		tipList(uint8_t second, TIP_ITEM list[], uint8_t list_len, bool active_only, bool manual_change, tDevice dev_type);
+		uint8_t		tipList(uint16_t second, TIP_ITEM list[], uint8_t list_len, bool active_only, bool manual_change, tDevice dev_type);
 		RADIX		nearActiveTip(RADIX& current_tip);
 		void		saveConfig(void);
+		void		commitConfig(bool force = false, bool idle = false);
+		bool		isConfigPending(void)				{ return cfg_pending;						}
+		void		reconcile(void);
+		void		dropSnapshot(void)					{ snap.invalidate();						}
 		void		savePID(PIDparam &pp, tDevice dev = d_t12);
+		bool		saveTipPID(PIDparam &pp, tDevice dev);
+		bool		resetTipPID(tDevice dev);
+		int16_t		findTipByFprint(TIP_FPRINT &probe, tDevice dev);
+		bool		learnTipFprint(TIP_FPRINT &probe, tDevice dev);
+		PIDparam	pidParams(tDevice dev);
 		void 		initConfig(void);
 		bool		clearAllTipsCalibration(void);		// Remove tip calibration data
-		void		applyTipCalibtarion(uint16_t temp[4], int8_t ambient, tDevice dev, bool calibrated);
+		void		applyTipCalibtarion(uint16_t temp[4], int8_t ambient, tDevice dev, bool calibrated, const TIP_CURVE *curve = 0);
+	protected:
+		bool		tipLoaded(TIP* tip, uint8_t tip_index);
+		void		fprintLoaded(TIP_FPRINT* fp, uint8_t tip_index);
 	private:
 		void		correctConfig(RECORD *cfg);
+		void		clampConfig(RECORD *cfg);
+		void		correctTips(RECORD *cfg);
 		bool 		selectTip(RADIX& tip_name);
 		uint8_t		buildTipTable(void);
 		uint16_t	loadGlobalTipList(void);
+		bool		loadSnapshot(void);
+		void		saveSnapshot(bool may_erase = true);
 		int16_t		tipIndex(RADIX &tip);				// Index of the tip in tip_table
+		typedef struct {
+			uint16_t	*index;							// Sorted global indexes of the activated tips of the device
+			uint16_t	size;							// Allocated size of the index array
+			uint16_t	count;							// Number of the tips in the list
+			uint16_t	version;						// TIPS::version() when the list has been built
+			bool		manual;							// The list has been built for manual tip selection
+			bool		valid;
+		} ACTIVE_LIST;
+		ACTIVE_LIST*	activeList(tDevice dev, bool manual_change);
+		typedef struct {
+			TIP_FPRINT	*probe;							// The fingerprint to look for, see findTipByFprint()
+			tDevice		dev;
+			int16_t		best;							// Global index of the closest tip
+			uint32_t	best_diff;
+		} FPRINT_SEARCH;
 		TIPS		tips;
+		bool		cfg_pending		= false;			// The accepted configuration (s_cfg) has not been written yet
+		uint32_t	commit_due		= 0;				// Time (ms) to write the configuration, see commitConfig()
+		uint32_t	first_change	= 0;				// Time (ms) of the first not written configuration change
+		SNAPSHOT	snap;
+		bool		snap_changed	= false;			// The working data has been changed, see saveSnapshot()
+		bool		snap_full		= false;			// The snapshot page should be erased before the next save
+		uint8_t		reconcile_step	= 0;				// Next step of the data loading after the fast startup, see reconcile()
+		bool		tip_retry		= false;			// The tip data could not be read, the flash drive was busy, see selectTip()
+		ACTIVE_LIST	active_list[2]	= { {0, 0, 0, 0, false, false}, {0, 0, 0, 0, false, false} }; // T12 and JBC activated tips
+		FPRINT_SEARCH	fp_search	= { 0, d_t12, -1, 0 };
+		const uint8_t	fprint_max_diff		= 20;		// Maximal difference between the probe and the tip fingerprint (percents)
+		const uint8_t	fprint_max_samples	= 8;		// Maximal number of probe measurements averaged in the fingerprint
 };
 
 #endif
@@ -0,0 +1,35 @@
+/*
+ * crc.h
+ *
+ * 2025 MAR 07
+ * 		CRC-32 of the stored records and files. The algorithm is the one of the STM32F1 CRC calculation unit:
+ * 		polynomial 0x04C11DB7, initial value 0xFFFFFFFF, no reflection, no final XOR (CRC-32/MPEG-2).
+ * 		The unit processes 32-bits words, the data is read by words in the memory (little endian) byte order,
+ * 		the last incomplete word is padded by zero bytes.
+ * 		On the target the CRC unit is used, the other builds (without CRC_BASE defined) use the table-driven calculation
+ * 		with the same result.
+ *
+ * 		crc32()				- CRC of the data buffer
+ * 		crc32Start(), crc32Update(), crc32Value() - CRC of the data read by chunks of any size, i.e. the file.
+ * 		The CRC unit is shared, so one calculation at a time only, do not call crc32() between crc32Start() and crc32Value()
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		crc32Start(void);
+void		crc32Update(const void* data, uint32_t size);
+uint32_t	crc32Value(void);
+uint32_t	crc32(const void* data, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,6 +3,8 @@
  *
  *  2024 NOV 16
  *  	Ported from JBC controller source code, tailored to the new hardware
+ *  2025 MAR 07
+ *  	The decoded tip names of the tip list are cached, see DSPL::tipName()
  */
 
 #ifndef DISPLAY_H_
@@ -21,6 +23,8 @@
 #define TFT_TIM		htim5
 extern TIM_HandleTypeDef TFT_TIM;
 
+#define TIP_NAME_CACHE	(8)								// Number of the decoded tip names kept by DSPL, the tip list length is 7
+
 class BRGT {
 	public:
 					BRGT(void)								{ }
@@ -73,7 +77,7 @@ class DSPL : public tft_ILI9341, public BRGT, public GRAPH, public NLS_MSG {
 		void 		msgBoost(tUnitPos pos);
 		void 		timeToOff(tUnitPos pos, uint8_t time);
 		void 		animatePower(tUnitPos pos, int16_t t);
-		void		drawTipList(TIP_ITEM list[], uint8_t list_len, uint8_t index, bool name_only);
+		void		drawTipList(TIP_ITEM list[], uint8_t list_len, uint16_t index, bool name_only);
 		void		menuShow(t_msg_id menu_id, uint8_t item, const char* value, bool modify);
 		void		directoryShow(const std::vector<std::string> &dir_list, uint16_t item, std::string status);
 		void 		calibShow(uint8_t ref_point, uint16_t current_temp, uint16_t real_temp, bool celsius, uint8_t power, bool on, uint8_t ready_pcnt, uint8_t int_temp_pcnt, uint16_t manual_power);
@@ -90,7 +94,7 @@ class DSPL : public tft_ILI9341, public BRGT, public GRAPH, public NLS_MSG {
 		void		pidDestroyData(void);
 		void		errorMessage(t_msg_id err_id, uint16_t y);
 		void		showDialog(t_msg_id msg_id, uint16_t y, bool yes, const char *parameter = 0);
-		void 		showVersion(void);
+		void 		showVersion(bool wear_leveling);
 		void		debugShow(uint16_t data[11], bool iron_on, bool gun_on, bool iron_connected, bool gun_connected, bool gun_reed, bool type_jbc, bool tilt_stby, bool jbc_change, bool gtim_ok);
 		void		debugMessage(const char *msg, uint16_t x, uint16_t y, uint16_t len);
 	private:
@@ -100,6 +104,7 @@ class DSPL : public tft_ILI9341, public BRGT, public GRAPH, public NLS_MSG {
 		void		drawHGauge(uint16_t len, uint16_t g_width, uint16_t x, uint16_t y, uint16_t g_color, int16_t label = -1, uint8_t intervals = 0);
 		void		drawValue(uint16_t value, uint16_t x, uint16_t y, BM_ALIGN align, uint16_t color);
 		void		update(void);
+		const char*	tipName(RADIX &tip);
 		uint8_t*	letter_font			= (uint8_t*)u8g_font_profont22r;
 		uint16_t	bg_color			= 0;
 		uint16_t	fg_color			= 0xFFFF;
@@ -118,6 +123,9 @@ class DSPL : public tft_ILI9341, public BRGT, public GRAPH, public NLS_MSG {
 		uint16_t	fan_icon_y			= 0;
 		uint16_t	active_icon_x		= 0;				// Iron active icon coordinates
 		uint16_t	active_icon_y		= 0;
+		uint32_t	name_cache_key[TIP_NAME_CACHE]	= {0};	// The tip name code of the cached name, see tipName()
+		char		name_cache[TIP_NAME_CACHE][tip_full_name_sz];
+		uint8_t		name_cache_next		= 0;				// The cache entry to be replaced
 		const uint16_t	tip_name_width	= 200;
 		const uint16_t	fan_pcnt_width	= 110;
 		const uint16_t	ref_point_width	= 90;
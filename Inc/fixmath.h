@@ -0,0 +1,42 @@
+/*
+ * fixmath.h
+ *
+ * 2025 FEB 10
+ * 		Fixed-point math library. The STM32F103 has no FPU, so every float or double operation
+ * 		pulls the soft-float library (__aeabi_fadd, __aeabi_ddiv, logf, sqrt, ...) into the firmware.
+ * 		These routines use integer arithmetic only:
+ * 		fxLog2(), fxLn()	- logarithm of the integer value, result in Q16 format (value * 65536), table-based
+ * 		isqrt32(), isqrt64()- integer square root (floor)
+ * 		fxDivRound()		- rounded signed division of 64-bit values
+ * 		fxMulDiv()			- scaled division: a * b / c with 64-bit intermediate result, rounded
+ *
+ * 		To make sure the soft-float library is not linked anymore, check the elf file after the build:
+ * 		arm-none-eabi-nm F103RE_UNITED_Rework.elf | grep -E "__aeabi_(f|d)(add|sub|mul|div|2iz|2f)|__aeabi_(i|ui|l|ul)2(f|d)"
+ * 		The command should print nothing.
+ */
+
+#ifndef FIXMATH_H_
+#define FIXMATH_H_
+
+#include <stdint.h>
+
+#define FX_SHIFT		(16)								// Q16 fixed point format
+#define FX_ONE			(1L << FX_SHIFT)
+#define FX_LN2			(45426)								// ln(2) in Q16 format
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int32_t		fxLog2(uint32_t value);
+int32_t		fxLn(uint32_t value);
+uint32_t	isqrt32(uint32_t value);
+uint32_t	isqrt64(uint64_t value);
+int32_t		fxDivRound(int64_t num, int64_t den);
+int32_t		fxMulDiv(int32_t a, int32_t b, int32_t c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
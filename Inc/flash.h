@@ -4,6 +4,30 @@
  *  2023 OCT 19
  *  	Ported from JBC controller source code, tailored to the new hardware
  *
+ *  2025 FEB 14
+ *  	Added tipcurve.dat file, the complete tip calibration data
+ *  2025 FEB 17
+ *  	Added tippid.dat file, the tip specific PID parameters
+ *  2025 FEB 19
+ *  	Added tipfp.dat file, the tip fingerprints
+ *  2025 FEB 23
+ *  	The configuration and PID parameters are saved in the config.kv key-value store
+ *  2025 FEB 26
+ *  	The free clusters are trimmed at startup, see trimFree()
+ *  2025 FEB 28
+ *  	FatFS is configured in tiny mode (FF_FS_TINY), FIL object does not keep the sector buffer
+ *  2025 MAR 05
+ *  	Added tipindex.bin file, the binary cache of the sorted tip list built from tip_list.txt
+ *  	saveTipData() accepts the known tip index in tipcal.dat: NO_TIP_CHUNK for new tip, -1 if unknown
+ *  2025 MAR 06
+ *  	W25Q implements TIP_STORE, the tip catalogue is read from tipindex.bin by pages
+ *  2025 MAR 07
+ *  	The configuration and PID records in config.kv have the version header and CRC-32, see REC_HDR
+ *  2025 MAR 08
+ *  	The legacy flash drive is migrated to the flash translation layer at startup, see migrateFTL()
+ *  	The tip data files (tipcal.dat, tipcurve.dat, tippid.dat, tipfp.dat) have the version header and CRC-32
+ *  	of every record, see TIP_FILE_HDR
+ *  	writeReady() checks the configuration record can be written without waiting for the sector erase
  */
 
 #ifndef _FLASH_H_
@@ -12,11 +36,12 @@
 #include "cfgtypes.h"
 #include "ff.h"
 #include "vars.h"
+#include "kvstore.h"
 
 typedef enum tip_io_status	{TIP_OK = 0, TIP_IO, TIP_CHECKSUM, TIP_INDEX} TIP_IO_STATUS;
-typedef enum active_file  	{W25Q_NOT_MOUNTED = 0, W25Q_NONE, W25Q_TIPS_CURRENT, W25Q_TIPS_BACKUP, W25Q_CONFIG_CURRENT, W25Q_CONFIG_BACKUP, W25Q_CONFIG_TIP_LIST} ACT_FILE;
+typedef enum active_file  	{W25Q_NOT_MOUNTED = 0, W25Q_NONE, W25Q_TIPS_CURRENT, W25Q_TIPS_BACKUP, W25Q_CONFIG_CURRENT, W25Q_CONFIG_BACKUP, W25Q_CONFIG_TIP_LIST, W25Q_CONFIG_KV, W25Q_TIP_INDEX} ACT_FILE;
 
-class W25Q {
+class W25Q : public TIP_STORE {
 	public:
 		W25Q(void)			{ }
 		FLASH_STATUS	init(void);								// Initialize flash, read tip configuration
@@ -29,31 +54,110 @@ class W25Q {
 		bool			loadPIDparams(PID_PARAMS* pid_params);
 		bool			savePIDparams(PID_PARAMS* pid_params);
 		TIP_IO_STATUS	loadTipData(TIP* tip, uint8_t tip_index, bool keep = false);
-		int16_t 		saveTipData(TIP* tip, bool keep = false); // Return tip index in the file or -1 if error
+		uint16_t		loadTipTable(void);						// Read all tip records, see tipLoaded()
+		uint16_t		scanTipFprints(void);					// Read all tip fingerprints, see fprintLoaded()
+		int16_t 		saveTipData(TIP* tip, bool keep = false, int16_t tip_index = -1); // Return tip index in the file or -1 if error
+		bool			loadTipCurve(TIP_CURVE* curve, uint8_t tip_index);
+		bool			saveTipCurve(TIP_CURVE* curve, uint8_t tip_index);
+		bool			loadTipPIDparams(TIP_PID* tip_pid, uint8_t tip_index);
+		bool			saveTipPIDparams(TIP_PID* tip_pid, uint8_t tip_index);
+		bool			loadTipFprint(TIP_FPRINT* fprint, uint8_t tip_index);
+		bool			saveTipFprint(TIP_FPRINT* fprint, uint8_t tip_index);
 		bool			formatFlashDrive(void);
+		bool			wearLeveling(void);						// The flash translation layer is active, see FTL.h
+		bool			writeReady(void);						// The record can be saved without waiting for the sector erase
 		bool			clearTips(void);
 		bool			clearConfig(void);
 		bool			canDelete(const TCHAR *file_name);
 		const TCHAR*	fileName(uint8_t index);
 		void			keepMounted(bool keep)					{ keep_mounted = keep; }
+		bool			keptMounted(void)						{ return keep_mounted; }
 		uint8_t			tipListReadNextItem(const char data[], uint8_t size);
 		void			tipListEnd(void);
+		bool			loadTipIndex(TIPS& tips);				// Use the tip catalogue in tipindex.bin if it matches tip_list.txt
+		bool			saveTipIndex(TIPS& tips);
+		bool			readTipNames(uint16_t first, RADIX names[], uint16_t count);
+		bool			readTipKeys(uint16_t first, TIP_KEY keys[], uint16_t count);
+	protected:
+		virtual bool	tipLoaded(TIP*, uint8_t)				{ return false; }	// Correct tip record read by loadTipTable()
+		virtual void	fprintLoaded(TIP_FPRINT*, uint8_t)		{ }		// Correct fingerprint read by scanTipFprints()
 	private:
+		typedef struct {										// The tipindex.bin header
+			uint32_t	magic;
+			uint32_t	src_size;								// Size of the tip_list.txt the index was built from
+			uint32_t	src_crc;								// CRC-32 of the tip_list.txt
+			uint32_t	crc;									// CRC-32 of the tip names and sorted tip names
+			uint16_t	count;									// Number of tips in the table
+			uint16_t	reserved;
+		} TIP_INDEX_HDR;
+		typedef struct {										// The header of the tip data files, the first record slot
+			uint32_t	magic;
+			uint16_t	version;								// The file format version
+			uint16_t	size;									// The record size
+			uint16_t	slot;									// The record slot size: the record, zero padding and CRC-32
+			uint16_t	reserved;
+			uint32_t	crc;									// CRC-32 of the header
+		} TIP_FILE_HDR;
+		typedef struct {										// The header of the record in config.kv
+			uint16_t	version;								// The record format version
+			uint16_t	size;									// The record data size
+			uint32_t	crc;									// CRC-32 of the record data
+		} REC_HDR;
+		static_assert(sizeof(REC_HDR) + sizeof(RECORD) <= 255, "RECORD does not fit the config.kv record");
+		static_assert(sizeof(REC_HDR) + sizeof(PID_PARAMS) <= 255, "PID_PARAMS does not fit the config.kv record");
 		TIP_IO_STATUS	returnStatus(bool keep, TIP_IO_STATUS ret_code);
+		uint16_t		scanTips(uint16_t *applied);
+		bool			loadTipRecord(const TCHAR* fn, void* record, UINT size, uint8_t tip_index);
+		bool			saveTipRecord(const TCHAR* fn, void* record, UINT size, uint8_t tip_index);
+		UINT			tipSlot(UINT size);						// The record slot size in the tip data file
+		void			tipFileHeader(BYTE slot[], UINT size);
+		bool			openTipFile(const TCHAR* fn, UINT size, BYTE mode);
+		bool			upgradeTipFile(const TCHAR* fn, UINT size);
+		bool			oldTipRecord(const TCHAR* fn, void* record);
+		bool			validSlot(const BYTE slot[], UINT slot_size);
+		TIP_IO_STATUS	readTipSlot(void* record, UINT size, uint8_t tip_index);
+		bool			writeTipSlot(const void* record, UINT size, uint8_t tip_index);
 		uint8_t 		TIP_checkSum(TIP* tip, bool write);
+		uint8_t			CURVE_checkSum(TIP_CURVE* curve, bool write);
+		uint8_t			TPID_checkSum(TIP_PID* tip_pid, bool write);
+		uint8_t			FPRINT_checkSum(TIP_FPRINT* fprint, bool write);
 		uint8_t			CFG_checkSum(RECORD* cfg, bool write);
 		uint8_t			PID_checkSum(PID_PARAMS* pid_params, bool write);
+		bool			tipListCheckSum(uint32_t *size, uint32_t *crc);
+		bool			readTipIndex(uint32_t pos, void* buff, UINT size);
 		bool			backup(ACT_FILE type);
+		bool			openKV(void);
+		bool			loadKVRecord(uint8_t key, void* data, uint8_t size, uint16_t version);
+		bool			saveKVRecord(uint8_t key, const void* data, uint8_t size, uint16_t version);
+		bool			trimFree(void);							// Trim free clusters, they will be erased in background
+		bool			migrateFTL(void);						// Activate the FTL on the legacy flash drive
+		bool			fatEntry(FATFS* fs, DWORD clst, BYTE* buff, LBA_t* loaded, DWORD* entry);
+		KVSTORE			kv;										// The configuration records store
 		bool			keep_mounted	= false;
 		FIL				cfg_f;
 		ACT_FILE		act_f = W25Q_NOT_MOUNTED;				// Open file
+		FIL				idx_f;									// The tip catalogue file, see readTipIndex()
+		bool			idx_open		= false;
+		uint16_t		idx_count		= 0;					// Number of tips in the catalogue file
 		const uint16_t	blk_size		= 4096;
+		const BYTE		fs_drive		= 0;					// Physical drive number of the flash drive
 		const TCHAR*	fn_tip_calib	= "tipcal.dat";
 		const TCHAR*	fn_tip_backup	= "tipcal.bak";
+		const TCHAR*	fn_tip_curve	= "tipcurve.dat";
+		const TCHAR*	fn_tip_pid		= "tippid.dat";
+		const TCHAR*	fn_tip_fprint	= "tipfp.dat";
 		const TCHAR*	fn_cfg			= "config.dat";
 		const TCHAR*	fn_cfg_backup	= "config.bak";
 		const TCHAR*	fn_pid			= "pid.dat";
 		const TCHAR*	fn_tip_list		= "tip_list.txt";
+		const TCHAR*	fn_kv			= "config.kv";
+		const TCHAR*	fn_tip_index	= "tipindex.bin";
+		const uint32_t	tip_index_magic	= 0x33584954;			// "TIX3"
+		const uint32_t	tip_file_magic	= 0x46504954;			// "TIPF", see TIP_FILE_HDR
+		const uint16_t	tip_file_version = 1;					// The format version of the tip data files
+		static const UINT tip_slot_max	= 64;					// The biggest record slot (TIP_CURVE)
+		const uint16_t	cfg_version		= 1;					// The RECORD format version in config.kv
+		const uint16_t	pid_version		= 1;					// The PID_PARAMS format version in config.kv
 };
 
 #endif
@@ -0,0 +1,86 @@
+/*
+ * fsmount.h
+ *
+ *  2025 FEB 27
+ *  	Shared mount of the flash drive file system
+ *
+ *  The configuration (W25Q) and the language data (NLS) use the same FATFS object. The volume is mounted once
+ *  and it remains mounted when all users have released it, so the boot sector is not read again on every load or save
+ *  and FatFS keeps the free cluster number counted by the first f_getfree(). The opened files are synchronized by f_close().
+ *  The volume is mounted again when the USB host has written the flash drive (fsMediaChanged()) and nobody uses it.
+ *
+ *  2025 MAR 01
+ *  	Flash access arbiter between the firmware and the USB host, so the station keeps working while attached to the computer.
+ *  	The USB mass storage is served from the USB interrupt. While the firmware uses the volume (mount() ... release())
+ *  	or the flash translation layer (lock() ... unlock()), the USB interrupt is masked: the USB peripheral answers NAK
+ *  	to the host and the host repeats the transfer later, so the firmware never sees the half-written volume.
+ *  	The firmware waits for the host to finish writing (FS_HOST_IDLE ms without writes) before the volume is acquired,
+ *  	then the volume is mounted again and the FatFS data are re-read.
+ *  	When the firmware has written the volume, the drive is reported to the host as not ready for FS_HOST_EJECT ms
+ *  	(see fsHostReady()), so the host drops its own cached copy of the file system as if the media had been replaced.
+ *
+ *  2025 MAR 02
+ *  	poll() runs the background flash work of the main loop: the USB host data cache (see usbd_storage_if.c)
+ *  	and erasing the free sectors (see FTL_Poll()). lock() writes the cached host data to the flash first.
+ *
+ *  2025 MAR 07
+ *  	mount() does not wait for the USB host to finish writing: it fails at once while the host is writing (see hostBusy()),
+ *  	the main loop callers try again later
+ *  	lock() fails if the cached USB host data cannot be written to the flash, the firmware does not use the flash then
+ */
+
+#ifndef FSMOUNT_H_
+#define FSMOUNT_H_
+
+#include <stdbool.h>
+#include "ff.h"
+
+#define FS_HOST_IDLE		(500)							// The USB host finished writing if there was no write during this time, ms
+#define FS_HOST_EJECT		(2000)							// The drive is not ready for the host after the firmware changed it, ms
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		fsMediaChanged(void);							// The flash drive data has been changed by USB host
+void		fsMediaWritten(void);							// The flash drive data has been changed by the firmware, see diskio.c
+bool		fsHostReady(void);								// The flash drive can be accessed by USB host
+
+#ifdef __cplusplus
+}
+
+class FSMOUNT {
+	public:
+		FSMOUNT(void)										{ }
+		bool			mount(void);						// Acquire the mounted volume
+		void			release(void);
+		void			invalidate(void)					{ changed = true;				}
+		bool			lock(void);							// Exclusive flash access of the firmware, can be nested
+		void			unlock(void);
+		void			poll(void);							// Background flash work of the main loop
+		void			hostWrite(void);					// Called from USB interrupt before the host writes the flash
+		void			written(void)						{ fw_written = true;			}
+		bool			hostReady(void);
+		bool			hostBusy(void);						// The USB host is writing the flash drive
+		FATFS*			fs(void)							{ return &fatfs;				}
+		uint32_t		freeClusters(void);
+	private:
+		void			maskUSB(void);
+		void			unmaskUSB(void);
+		FATFS			fatfs;
+		uint8_t			refs		= 0;					// Number of the volume users
+		bool			mounted		= false;
+		volatile bool	changed		= false;				// The volume should be mounted again
+		volatile uint32_t	host_write	= 0;				// The time of the last USB host write, ms
+		uint32_t		eject		= 0;					// The time when the firmware finished writing the volume, ms
+		uint8_t			locks		= 0;					// Nested lock() calls
+		bool			usb_irq		= false;				// The USB interrupt was enabled before lock()
+		bool			fw_written	= false;				// The volume has been written by the firmware since lock()
+		bool			ejected		= false;				// The host should re-read the volume
+};
+
+extern FSMOUNT fsmount;
+
+#endif
+
+#endif
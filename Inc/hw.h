@@ -53,6 +53,7 @@ class HW {
 		EMP_AVERAGE		t_stm32;							// Exponential average of the internal MCU temperature
 		int8_t			start_temp			= 0; 			// Startup temperature
 		const uint8_t	ambient_emp_coeff	= 30;			// Exponential average coefficient for ambient temperature
+		const uint16_t	min_ambient_value	= 40;			// About 180 degrees. The ambient sensor is shorted if the value is less than this
 		const uint16_t	max_ambient_value	= 3900;			// About -30 degrees. If the soldering IRON disconnected completely, "ambient" value is greater than this
 		const uint8_t 	sw_jbc_len			= 15;			// JBC IRON switch history length
 		const uint8_t	sw_off_value		= 14;			// JBC IRON switch off threshold
@@ -15,6 +15,7 @@ typedef enum {TIP_NONE = 0, TIP_T12, TIP_N1, TIP_JBC, TIP_C245, TIP_HOTGUN, TIP_
 
 #define	NO_TIP_CHUNK	255									// The flag showing that the tip was not found in the tipcal.dat
 #define	tip_name_sz		(5)
+#define	tip_full_name_sz (11)								// The decoded tip name with type prefix and trailing zero, see RADIX::tipName()
 
 /* RADIX 50 is an uppercase-only character encoding created by DEC for use on their DECsystem, PDP, and VAX computers.
  * Here the RADIX 50 is used to encode the soldering TIP names: Tip type + 5 letters grouped to 4-byte word.
@@ -46,6 +47,7 @@ class RADIX {
 		uint32_t	tip(void);
 		bool 		match(RADIX &r);
 		std::string tipName(void);
+		uint8_t		tipName(char buff[tip_full_name_sz]);
 		void		setCalibMask(uint8_t calib_mask);
 		TIP_TYPE_t	type(void);
 		uint32_t	word32(void);
@@ -58,32 +60,87 @@ class RADIX {
 		uint8_t		data[4] = {0};							// Use 4 bytes, not a uint32_t to decrease size of the TIP_TABLE
 };
 
+#define	TIP_PAGE		(32)								// Number of the catalogue entries read from the flash at once
+#define	TIP_UNRESOLVED	(0xFFFF)							// The catalogue index of the tip is not known yet
+
+/*
+ * The catalogue entry sorted by the tip name: the tip name and the tip index in tip_list.txt order
+ */
+typedef struct s_tip_key		TIP_KEY;
+struct s_tip_key {
+	RADIX		tip;
+	uint16_t	index;
+};
+
+/*
+ * The tip catalogue (all tips loaded from tip_list.txt) kept on the flash drive, see W25Q::loadTipIndex()
+ */
+class TIP_STORE {
+	public:
+		virtual bool	readTipNames(uint16_t first, RADIX names[], uint16_t count)	= 0;	// Tip names in tip_list.txt order
+		virtual bool	readTipKeys(uint16_t first, TIP_KEY keys[], uint16_t count)	= 0;	// Tip names in sorted order
+};
+
 /*
- * This structure presents a tip record for all possible tips, loaded from tip.list.txt
- * During controller initialization phase, the buildTipTable() function creates
- * the tip list in memory of all possible tips. If the tip is calibrated, i.e. has a record
- * in the tipcal.dat file on W25Qxx flash, the tip record saves index of the tip record in this file
+ * This structure presents a tip record for activated or calibrated tip, i.e. the tip having a record
+ * in the tipcal.dat file on W25Qxx flash. During controller initialization phase, the buildTipTable() function
+ * creates the table of these tips in memory. The tip record saves index of the tip in the catalogue
+ * and the index of the tip record in the tipcal.dat file
  */
 typedef struct s_tip_table		TIP_TABLE;
 struct s_tip_table {
 	RADIX		tip;										// Tip name in RADIX encoding and bitmap: TIP_ACTIVE, TIP_CALIBRATED
+	uint16_t	global;										// The tip index in the catalogue or TIP_UNRESOLVED
 	uint8_t		tip_index;									// The tip index in the calib.tip file
 };
 
+/*
+ * Two-tier tip store. The catalogue of all tips is kept in RAM only while it is built from tip_list.txt
+ * (create(), initTip(), buildIndex()). When the catalogue is saved on the flash drive, it is read from there by TIP_PAGE entries,
+ * see attach(). Only the Hot Air Gun and the tips having a record in tipcal.dat are kept in RAM (tip_table) sorted by the catalogue index
+ */
 class TIPS {
 	public:
 		TIPS()												{ }
-		bool			create(uint16_t size);
+		bool			create(uint16_t size);				// Allocate the catalogue in RAM
 		bool 			initTip(uint16_t index, RADIX &tip_name);
+		void			buildIndex(void);
+		bool			attach(TIP_STORE *store, uint16_t size);	// Read the catalogue from the flash, release the catalogue in RAM
 		bool			applyCalibtationIndex(RADIX &tip_name, uint8_t calib_index);
 		uint16_t		total(void)							{ return tip_count; }
+		uint16_t		calibrated(void);					// Number of tips having the record in tipcal.dat
+		uint16_t		version(void)						{ return changes; }	// Changed every time the tip activation can change
 		RADIX&			radix(uint16_t index);
 		uint8_t			tipCalibrationIndex(uint16_t index);
 		int16_t 		index(RADIX &tip_name);
+		int16_t			nextTip(uint16_t index, bool active_only);	// Next tip index after the Hot Air Gun or -1
+		int16_t			prevTip(uint16_t index, bool active_only);
 		void 			clearAllCalibration(void);
+		RADIX*			names(void)							{ return tip_names;				}	// The catalogue in RAM, see W25Q::saveTipIndex()
+		TIP_KEY*		keys(void)							{ return sorted?tip_keys:0;		}
 	private:
-		TIP_TABLE	*tip_table  = 0;						// All tips loaded from the tip_list.txt file
-		uint16_t	tip_count	= 0;						// Number of tips in tip_table
+		TIP_TABLE*		active(uint16_t index);
+		RADIX&			name(uint16_t index);
+		int16_t			find(RADIX &tip_name);
+		bool			keyPage(uint16_t page);
+		void			resolve(void);
+		void			release(void);
+		RADIX		*tip_names	= 0;						// The catalogue in RAM: all tips loaded from the tip_list.txt file
+		TIP_KEY		*tip_keys	= 0;						// The catalogue in RAM sorted by the tip name, see buildIndex()
+		bool		sorted		= false;					// tip_keys is valid
+		TIP_STORE	*store		= 0;						// The catalogue on the flash drive
+		uint32_t	*fences		= 0;						// The first tip name of every page of the sorted catalogue on the flash
+		RADIX		*name_page	= 0;						// The page of the catalogue read from the flash
+		TIP_KEY		*key_page	= 0;						// The page of the sorted catalogue read from the flash
+		uint16_t	name_first	= TIP_UNRESOLVED;			// The first catalogue index of name_page
+		uint16_t	key_first	= TIP_UNRESOLVED;			// The first sorted catalogue index of key_page
+		uint16_t	tip_count	= 0;						// Number of tips in the catalogue
+		TIP_TABLE	*tip_table  = 0;						// Activated and calibrated tips
+		uint16_t	table_size	= 0;						// Allocated entries of tip_table
+		uint16_t	table_count	= 0;						// Used entries of tip_table
+		bool		resolved	= true;						// The catalogue index of every tip_table entry is known
+		uint16_t	changes		= 0;						// The tip_table change counter, see version()
+		TIP_TABLE	hot_gun		= { RADIX(), 0, NO_TIP_CHUNK };	// The Hot Air Gun is always the first tip of the catalogue
 		RADIX		no_tip;									// Empty tip_name used when invalid index specified
 };
 
@@ -0,0 +1,57 @@
+/*
+ * kvstore.h
+ *
+ *  2025 FEB 23
+ *  	Log-structured key-value store for the configuration records
+ *
+ *  The records are appended to the config.kv file. The file has fixed size: two 4k pages (one FAT cluster each),
+ *  so the directory entry never changes and appending the record to the erased page area requires only 1->0 bit changes,
+ *  the flash sector is programmed without erasing. Every page starts with the header: the magic number and sequence number,
+ *  the active page is the valid page with the greatest sequence number.
+ *  The record is the header (key, data size and CRC) and data, padded to 4 bytes. The record is written by single f_write(),
+ *  the record with wrong CRC (not completely written on power loss) is ignored, so the previous record of the key remains valid.
+ *  When the active page is full, the latest records of all keys are copied to the other page (compaction),
+ *  the page header is written last, so the old page remains active until the new one is complete.
+ *  The offset of the latest record of every key is kept in RAM, so the lookup does not require the page scanning.
+ */
+
+#ifndef KVSTORE_H_
+#define KVSTORE_H_
+
+#include "ff.h"
+
+#define KV_PAGE_SIZE	(4096)
+#define KV_PAGES		(2)
+
+typedef enum { KV_CONFIG = 0, KV_PID, KV_KEYS } KV_KEY;
+
+class KVSTORE {
+	public:
+		KVSTORE(void)									{ }
+		bool			open(FIL* f);						// Scan the opened file, build the record index
+		bool			load(FIL* f, uint8_t key, void* data, uint8_t size);
+		bool			save(FIL* f, uint8_t key, const void* data, uint8_t size);
+		bool			erase(FIL* f, uint8_t key)			{ return save(f, key, 0, 0);			}
+		bool			has(uint8_t key)					{ return scanned && key < KV_KEYS && offset[key] != 0; }
+		void			reset(void)							{ scanned = false;						}
+	private:
+		typedef struct {
+			uint8_t		key;
+			uint8_t		size;								// Data size, 0 means the key has been removed
+			uint16_t	crc;								// CRC of the key, size and data
+		} KV_RECORD;
+		bool			format(FIL* f);
+		bool			compact(FIL* f, uint8_t key, const void* data, uint8_t size);
+		bool			append(FIL* f, uint32_t pos, uint8_t key, const void* data, uint8_t size);
+		bool			readRecord(FIL* f, uint32_t pos, KV_RECORD* rec, uint8_t* data);
+		uint16_t		recordSize(uint8_t size)			{ return (sizeof(KV_RECORD) + size + 3) & ~3;	}
+		uint16_t		crc16(uint16_t crc, const uint8_t* data, uint16_t size);
+		uint16_t		offset[KV_KEYS]	= {0};				// The latest record offset of every key in the active page
+		uint16_t		tail			= 0;				// The free area offset in the active page
+		uint32_t		seq				= 0;				// The active page sequence number
+		uint8_t			page			= 0;				// The active page
+		bool			scanned			= false;
+		const uint32_t	magic			= 0x3153564B;		// "KVS1"
+};
+
+#endif
@@ -5,6 +5,8 @@
  * 		Ported from JBC controller source code, tailored to the new hardware
  * 2024 DEC 15
  * 		Added MCALIB::ref_ready_to constant
+ * 2025 MAR 07
+ * 		MAUTOPID passes the tuned PID parameters to MTPID, they are saved after the user confirmation only
  */
 
 #include <vector>
@@ -46,12 +48,24 @@ class MSLCT : public MODE {
 		MSLCT(HW *pCore) : MODE(pCore)						{ }
 		virtual void	init(void);
 		virtual MODE*	loop(void);
+		virtual void	clean(void);
 	private:
 		void			changeTip(uint8_t index);
+		void			startProbe(void);
+		void			stopProbe(void);
+		bool			finishProbe(void);
 		TIP_ITEM		tip_list[MSLCT_LEN];
+		TIP_FPRINT		probe;								// The heat-up signature of the inserted tip
 		uint32_t 		tip_begin_select	= 0;			// The time in ms when we started to select new tip
 		uint32_t		tip_disconnected	= 0;			// When the tip has been disconnected
+		uint32_t		probe_end			= 0;			// The time in ms when the probe pulse finishes
+		uint16_t		probe_temp			= 0;			// The tip temperature before the probe pulse (internal units)
 		bool			manual_change		= false;
+		enum { PROBE_OFF = 0, PROBE_RUN, PROBE_DONE }
+						probe_phase			= PROBE_OFF;	// The tip recognition phase
+		const uint16_t	probe_power			= 300;			// The fixed power of the probe pulse
+		const uint32_t	probe_time			= 1500;			// The probe pulse duration (ms)
+		const uint16_t	probe_max_temp		= 500;			// Do not probe the hot tip, internal units
 };
 
 //---------------------- The calibrate tip mode: automatic calibration -----------
@@ -111,8 +125,10 @@ class MTPID : public MODE {
 		virtual void	init(void);
 		virtual MODE*	loop(void);
 		virtual void	clean(void);
+		void		tunedPID(void)							{ tuned = true;		}
 	private:
-		bool		confirm(void);							// Confirmation dialog
+		bool		confirm(t_msg_id msg = MSG_SAVE_Q);		// Confirmation dialog
+		bool		tuned		= false;					// The PID parameters have been tuned by MAUTOPID, save them for the current tip
 		uint32_t	data_update	= 0;						// When read the data from the sensors (ms)
 		uint32_t	check_fan	= 0;						// When not 0, time when to check Hot Gun connectivity (ms)
 		uint8_t		data_index	= 0;						// Active coefficient
@@ -128,12 +144,13 @@ class MAUTOPID : public MODE {
 	public:
 	typedef enum { TUNE_OFF, TUNE_HEATING, TUNE_BASE, TUNE_PLUS_POWER, TUNE_MINUS_POWER, TUNE_RELAY } TuneMode;
 	typedef enum { FIX_PWR_NONE = 0, FIX_PWR_DECREASED, FIX_PWR_INCREASED, FIX_PWR_DONE } FixPWR;
-		MAUTOPID(HW *pCore) : MODE(pCore)					{ }
+		MAUTOPID(HW *pCore, MTPID *pid_tune) : MODE(pCore)	{ mode_tpid = pid_tune;	}
 		virtual void	init(void);
 		virtual MODE*	loop(void);
 		virtual void	clean(void);
 		bool			updatePID(UNIT *pUnit);
 	private:
+		MTPID*		mode_tpid;								// Manual PID tune mode to confirm the tuned parameters
 		uint16_t	td_limit	= 6;						// Temperature dispersion limits
 		uint32_t	pwr_ch_to	= 5000;						// Power change timeout
 		FixPWR		pwr_change	= FIX_PWR_NONE;				// How the fixed power was adjusted
@@ -18,7 +18,7 @@ typedef enum e_msg { MSG_MENU_MAIN, MSG_MENU_SETUP = 10, MSG_MENU_T12 = 10+14, M
 					MSG_EEPROM_READ, MSG_EEPROM_WRITE, MSG_EEPROM_DIRECTORY, MSG_NO_TIP_LIST, MSG_FORMAT_EEPROM, MSG_FORMAT_FAILED,
 					MSG_SAVE_ERROR, MSG_HOT_AIR_GUN, MSG_T12_IRON, MSG_JBC_IRON, MSG_SAVE_Q, MSG_YES, MSG_NO, MSG_DELETE_FILE, MSG_FLASH_DEBUG,
 					MSG_SD_MOUNT, MSG_SD_NO_CFG, MSG_SD_NO_LANG, MSG_SD_MEMORY, MSG_SD_INCONSISTENT, MSG_DSPL_IPS, MSG_DSPL_TFT, MSG_GUN_STBY,
-					MSG_UPDATE_FLASH,
+					MSG_UPDATE_FLASH, MSG_RESET_PID_Q,
 					MSG_LAST,
 					MSG_ACTIVATE_TIPS 	= MSG_MENU_MAIN + 3,
 					MSG_ABOUT 			= MSG_MENU_MAIN + 8,
@@ -153,7 +153,8 @@ class NLS_MSG {
 				{"IPS",						std::string()},
 				{"TFT",						std::string()},
 				{"standby",					std::string()},
-				{"updating flash",			std::string()}
+				{"updating flash",			std::string()},
+				{"Reset tip PID?",			std::string()}
 		};
 		const t_msg_id menu[7] = { MSG_MENU_MAIN, MSG_MENU_SETUP, MSG_MENU_T12, MSG_MENU_JBC, MSG_MENU_GUN, MSG_MENU_CALIB, MSG_PID_MENU };
 };
@@ -32,8 +32,8 @@ class NLS {
 		std::string		messageFile(uint8_t index);
 		std::string		fontFile(uint8_t index);
 		bool			loadFont(uint8_t indx);
+		bool			readFont(std::string cfg_path);
 		bool			loadMessages(uint8_t indx);
-		FATFS			flashfs;
 		FIL				cfg_f;
 		JSON_LANG_CFG	lang_cfg;
 		JSON_MESSAGES	msg_parser;
@@ -0,0 +1,59 @@
+/*
+ * snapshot.h
+ *
+ *  2025 MAR 07
+ *  	The copy of the working data in the page of the MCU internal flash, read at startup before the flash drive
+ *
+ *  The page is not used by the firmware image (the image is less than 256k). The data records are appended to the page
+ *  one after another, the page is erased only when it is full, so the page is erased once per several saves.
+ *  The record is the header and the data padded to 4 bytes. The header fields are programmed before the data,
+ *  the magic number is programmed last, so the record not completely written on the power loss is skipped.
+ *  The latest record with correct magic number and CRC is the actual one.
+ *  The backup registers are not used: they keep the data only if the backup battery is installed and
+ *  have not enough room (84 bytes) for the working data.
+ *
+ *  While the MCU flash is programmed or erased, the instruction fetch from the flash stalls, the interrupts
+ *  (the heating control, see core.cpp) are delayed as well. Programming a half-word takes up to 70 us (tPROG),
+ *  the interrupts run between the half-words. Erasing the page takes 20-40 ms (tERASE, STM32F103xE datasheet),
+ *  so save() erases the full page only if allowed (the iron and the hot air gun are off, see CFG::commitConfig()),
+ *  and the snapshot is dropped by clearing the magic number of the records instead of erasing the page, see invalidate().
+ *
+ *  The linker script is not a part of the project sources: the page should be excluded from the FLASH region
+ *  (LENGTH = 510K). The page is not used if the firmware image overlaps it, see available(). The image end is
+ *  calculated from the linker symbols, as _sbrk() does in sysmem.c.
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "main.h"
+
+#ifndef SNAP_PAGE_ADDR
+#define SNAP_PAGE_ADDR	(0x0807F800)						// The last page of the STM32F103RE flash (512k)
+#endif
+#define SNAP_PAGE_SIZE	(2048)
+
+typedef enum { SNAP_OK = 0, SNAP_FULL, SNAP_ERROR } SNAP_STATUS;
+
+class SNAPSHOT {
+	public:
+		SNAPSHOT(void)									{ }
+		bool			load(void* data, uint16_t size, uint16_t version);
+		SNAP_STATUS		save(const void* data, uint16_t size, uint16_t version, bool may_erase = true);
+		void			invalidate(void);					// Drop the snapshot without erasing the page
+	private:
+		typedef struct {
+			uint16_t	size;								// The data size, 0xFFFF in the free area
+			uint16_t	version;							// The data format version
+			uint32_t	crc;								// CRC-32 of the data
+			uint32_t	magic;								// Programmed after the data
+		} SNAP_HDR;
+		bool			available(void);					// The page is not occupied by the firmware image
+		void			erase(void);
+		int16_t			scan(uint16_t *free);				// The latest correct record offset or -1
+		bool			program(uint32_t addr, const void* data, uint16_t size);
+		uint16_t		recordSize(uint16_t size)			{ return (sizeof(SNAP_HDR) + size + 3) & ~3;	}
+		const uint32_t	magic			= 0x50414E53;		// "SNAP"
+};
+
+#endif
@@ -1,6 +1,8 @@
 /*
  * unit.h
  *
+ * 2025 MAR 07
+ * 		startCurrentProbe() and probeCurrent(), the mean current through the unit while the power is applied
  */
 
 #ifndef UNIT_H_
@@ -16,7 +18,9 @@ class UNIT : public PID, public PIDTUNE {
 		void				init(uint8_t c_len, uint16_t c_min, uint16_t c_max, uint8_t s_len, uint16_t s_min, uint16_t s_max);
 		bool				isConnected(void) 				{ return current.status();						}
 		uint16_t			unitCurrent(void)				{ return current.read();						} // Used in debug mode only
-		void				updateCurrent(uint16_t value) 	{ current.update(value);						}
+		void				updateCurrent(uint16_t value);
+		void				startCurrentProbe(void);		// Start to accumulate the current samples
+		uint16_t			probeCurrent(void);				// Stop the accumulation and return mean current
 		uint16_t			reedInternal(void)				{ return sw.read();								}
 		void				updateReedStatus(bool on)		{ sw.update(on?100:0);							} // Update Reed switch status
 		void				updateChangeStatus(bool on)		{ change.update(on?100:0);						} // Update JBC change switch status
@@ -39,6 +43,9 @@ class UNIT : public PID, public PIDTUNE {
 		SWITCH 			current;							// The current through the unit
 		SWITCH 			sw;									// Tilt switch of T12, Reed switch of Hot Air Gun or Standby switch of JBC
 		SWITCH			change;								// JBC IRON tip change switch
+		volatile bool		c_probe		= false;			// Accumulate the current samples, see startCurrentProbe()
+		volatile uint32_t	c_summ		= 0;				// The summ of the current samples
+		volatile uint16_t	c_samples	= 0;				// The number of accumulated current samples
 };
 
 #endif
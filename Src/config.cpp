@@ -6,6 +6,38 @@
  *
  * 2024 NOV 16, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
+ * 2025 FEB 12
+ * 		tempCelsius() and humanToTemp() use the temperature translation table instead of iterative search
+ * 2025 FEB 14
+ * 		Load and save the tip calibration curve, see TIP_CURVE
+ * 2025 FEB 17
+ * 		Load and save the tip specific PID parameters, see TIP_PID
+ * 2025 FEB 19
+ * 		Match the tip fingerprints, see TIP_FPRINT
+ * 2025 MAR 04
+ * 		buildTipTable() loads tipcal.dat in one pass, see W25Q::loadTipTable()
+ * 2025 MAR 05
+ * 		loadGlobalTipList() loads the sorted tip list from tipindex.bin, tip_list.txt is parsed only if it has been changed
+ * 		The tip calibration is saved at the tip index in tipcal.dat known from the tip table, see W25Q::saveTipData()
+ * 2025 MAR 06
+ * 		The tip lists are built by TIPS::nextTip() and TIPS::prevTip(): the activated tips are kept in RAM,
+ * 		the tip catalogue is read from the flash drive by pages
+ * 2025 MAR 07
+ * 		tipList() uses the per-device list of activated tips, rebuilt only when the tip activation changes, see activeList()
+ * 		saveConfig() does not write the flash, the changes are coalesced and written by commitConfig() from the main loop
+ * 		init() loads the working data from the MCU flash snapshot if it is valid, the tip list and the tip table
+ * 		are loaded by reconcile() from the main loop then, see CFG_SNAPSHOT
+ * 		resetTipPID() removes the tip specific PID parameters, the common PID parameters of the device are used then
+ * 		findTipByFprint() reads tipfp.dat in one pass, see fprintLoaded()
+ * 		reconcile() skips the step while the USB host is writing the flash drive
+ * 		The full snapshot page is erased only when the iron and the hot air gun are off, see commitConfig()
+ * 2025 MAR 08
+ * 		commitConfig() postpones the write while the iron or the hot air gun is working and the flash drive has
+ * 		no erased sector for the record, see W25Q::writeReady()
+ * 		selectTip() keeps the loaded tip calibration if the tip data cannot be read, the selection is retried
+ * 		by reconcile() if the flash drive was busy. learnTipFprint() does not replace the fingerprint if it cannot be read
+ * 		loadSnapshot() checks the value ranges only, the tips of the configuration are checked by reconcile() when
+ * 		the tip table is loaded. commitConfig() does not write the configuration until reconcile() is complete
  *
  */
 
@@ -18,11 +50,12 @@
 CFG_STATUS CFG::init(void) {
 	FLASH_STATUS status = W25Q::init();
 	if (status == FLASH_OK) {
-		loadGlobalTipList();
-		uint8_t tips_loaded = 0;
-		if (tips.total() > 0) {								// The memory is allocated for the tip table
-			tips_loaded = buildTipTable();
+		if (loadSnapshot()) {								// The working data of the last session, load the rest later
+			reconcile_step = 1;
+			return CFG_OK;
 		}
+		loadGlobalTipList();
+		uint8_t tips_loaded = buildTipTable();				// Check tipcal.dat even if the tip table is not allocated
 
 		bool cfg_ok = loadRecord(&a_cfg);
 		if (cfg_ok) {
@@ -40,10 +73,13 @@ CFG_STATUS CFG::init(void) {
 		selectTip(a_cfg.t12_tip);							// Load T12 tip configuration data into a_tip variable
 		selectTip(a_cfg.jbc_tip);							// Load JBC tip configuration data into a_tip variable
 		CFG_CORE::syncConfig();								// Update spare configuration
+		if (tip_retry)										// The flash drive is busy, select the tips from the main loop
+			reconcile_step = 3;
 		if (tips_loaded > 0) {
 			if (!cfg_ok) {									// The current configuration was illegal
 				saveRecord(&a_cfg);
 			}
+			saveSnapshot();
 			return CFG_OK;
 		} else {
 			if (tips.total() > 1)
@@ -67,6 +103,80 @@ CFG_STATUS CFG::init(void) {
 	return CFG_OK;
 }
 
+/*
+ * Load the data skipped at the fast startup (see loadSnapshot()) step by step, so the working mode runs between the steps.
+ * Called from the main loop. The configuration in the flash drive is applied if the snapshot is outdated
+ * and the configuration has not been changed since the startup
+ */
+void CFG::reconcile(void) {
+	if (reconcile_step == 0)
+		return;
+	if (!W25Q::mount())										// The USB host is writing the flash drive, try again later
+		return;
+	keepMounted(true);
+	if (reconcile_step == 1) {
+		loadGlobalTipList();
+		++reconcile_step;
+		return;
+	}
+	if (reconcile_step == 2) {
+		if (buildTipTable() == 0)							// No tip activated, the complete initialization is required
+			snap.invalidate();
+		correctTips(&a_cfg);								// The tip of the snapshot can be deactivated by the USB host
+		correctTips(CFG_CORE::spareConfig());
+		++reconcile_step;
+		return;
+	}
+	RECORD rec;
+	if (!cfg_pending && loadRecord(&rec)) {
+		correctConfig(&rec);
+		if (!CFG_CORE::areConfigsIdentical(rec)) {			// The snapshot is outdated, i.e. the flash drive has been changed by the USB host
+			memcpy(&a_cfg, &rec, sizeof(RECORD));
+			CFG_CORE::syncConfig();
+		}
+	}
+	if (!loadPIDparams(&pid))
+		setPIDdefaults();
+	tip_retry = false;
+	selectTip(tips.radix(0));
+	selectTip(a_cfg.t12_tip);
+	selectTip(a_cfg.jbc_tip);
+	keepMounted(false);
+	W25Q::umount();
+	if (tip_retry)											// The tip data could not be read, try again later
+		return;
+	reconcile_step	= 0;
+	snap_changed	= true;									// Update the snapshot if the loaded data is different
+}
+
+// Restore the working data from the snapshot in the MCU flash
+bool CFG::loadSnapshot(void) {
+	CFG_SNAPSHOT s;
+	if (!snap.load((void *)&s, sizeof(CFG_SNAPSHOT), CFG_SNAP_VERSION))
+		return false;
+	memcpy(&a_cfg, &s.cfg, sizeof(RECORD));
+	clampConfig(&a_cfg);									// The tip table is not loaded yet, the tips are checked by reconcile()
+	memcpy(&pid, &s.pid, sizeof(PID_PARAMS));
+	TIP_CFG::loadTipRecords(s.tip);
+	CFG_CORE::syncConfig();
+	return true;
+}
+
+/*
+ * Save the accepted configuration and the working data to the snapshot. The page is not written if the data is the same.
+ * If the page is full and cannot be erased now, the snapshot is saved later
+ */
+void CFG::saveSnapshot(bool may_erase) {
+	CFG_SNAPSHOT s;
+	memset((void *)&s, 0, sizeof(CFG_SNAPSHOT));			// Clear the structure padding to compare the snapshots
+	memcpy(&s.cfg, CFG_CORE::spareConfig(), sizeof(RECORD));
+	memcpy(&s.pid, &pid, sizeof(PID_PARAMS));
+	TIP_CFG::saveTipRecords(s.tip);
+	snap_full = (SNAP_FULL == snap.save((const void *)&s, sizeof(CFG_SNAPSHOT), CFG_SNAP_VERSION, may_erase));
+	if (!snap_full)
+		snap_changed = false;
+}
+
 bool CFG::reloadTips(void) {
 	if (tips.total() > 0) {									// Tips table allocated
 		buildTipTable();
@@ -76,6 +186,12 @@ bool CFG::reloadTips(void) {
 }
 
 void CFG::correctConfig(RECORD *cfg) {
+	clampConfig(cfg);
+	correctTips(cfg);
+}
+
+// Limit the temperatures, the timeouts and the display brightness of the configuration
+void CFG::clampConfig(RECORD *cfg) {
 	uint16_t t12_tempC = cfg->t12_temp;
 	uint16_t jbc_tempC = cfg->jbc_temp;
 	uint16_t gun_tempC = cfg->gun_temp;
@@ -99,27 +215,48 @@ void CFG::correctConfig(RECORD *cfg) {
 		cfg->t12_off_timeout = 30;
 	if (cfg->jbc_off_timeout > 30)
 		cfg->jbc_off_timeout = 30;
+	cfg->dspl_bright = constrain(cfg->dspl_bright, 10, 255);
+}
+
+// Replace the tips of the configuration by the nearest activated ones, the tip table should be loaded
+void CFG::correctTips(RECORD *cfg) {
 	cfg->t12_tip = nearActiveTip(cfg->t12_tip);
 	cfg->jbc_tip = nearActiveTip(cfg->jbc_tip);
-	cfg->dspl_bright = constrain(cfg->dspl_bright, 10, 255);
 }
 
-// Load calibration data of the tip from FLASH drive. If the tip is not calibrated, initialize the calibration data with the default values
+/*
+ * Load calibration data of the tip from FLASH drive. If the tip is not calibrated, initialize the calibration data with the default values
+ * If the tip data cannot be read (TIP_IO), the loaded calibration is kept and false is returned. If the flash drive is busy
+ * (the USB host is writing it), tip_retry is set, so the caller can select the tip later
+ */
 bool CFG::selectTip(RADIX& tip_name) {
 	int16_t tip_global = tips.index(tip_name);
 	if (tip_global < 0) return false;						// The tip is not found in the global list
 
-	bool result = true;
 	uint8_t tip_index = tips.tipCalibrationIndex(tip_global);
 	tDevice dev_type = hardwareType(tip_name);
 	if (tip_index == NO_TIP_CHUNK) {
+		TIP_CFG::clearTipPID(dev_type);						// Use the common PID parameters of the device
 		TIP_CFG::resetTipCalibration(dev_type);
 		return false;
 	}
+	if (!W25Q::mount()) {
+		tip_retry = true;
+		return false;
+	}
+	bool keep = keptMounted();
+	keepMounted(true);										// Read the tip data files at once
 	TIP tip;
-	if (loadTipData(&tip, tip_index) != TIP_OK) {
+	TIP_IO_STATUS status = loadTipData(&tip, tip_index);
+	if (status == TIP_IO) {									// The tip record cannot be read, keep the loaded calibration
+		keepMounted(keep);
+		W25Q::umount();
+		return false;
+	}
+	bool result = (status == TIP_OK);
+	TIP_CFG::clearTipPID(dev_type);							// Use the common PID parameters of the device by default
+	if (!result) {
 		TIP_CFG::resetTipCalibration(dev_type);
-		result = false;
 	} else {
 		if (!(tip.name.isCalibrated())) {					// Tip is not calibrated, load default configuration
 			TIP_CFG::resetTipCalibration(dev_type);
@@ -127,8 +264,19 @@ bool CFG::selectTip(RADIX& tip_name) {
 			TIP_CFG::resetTipCalibration(dev_type);
 		} else {											// Tip configuration record is completely correct
 			TIP_CFG::load(tip, dev_type);
+			TIP_CURVE curve;
+			if (loadTipCurve(&curve, tip_index) && curve.name.match(tip.name) && curve.ambient == tip.ambient &&
+				curve.ref[0] == tip.t200 && curve.ref[1] == tip.t260 && curve.ref[2] == tip.t330 && curve.ref[3] == tip.t400) {
+				TIP_CFG::loadCurve(curve, dev_type);
+			}
+		}
+		TIP_PID tip_pid;
+		if (loadTipPIDparams(&tip_pid, tip_index) && tip_pid.name.match(tip.name)) {
+			TIP_CFG::loadTipPID(tip_pid, dev_type);
 		}
 	}
+	keepMounted(keep);
+	W25Q::umount();
 	return result;
 }
 
@@ -141,6 +289,7 @@ void CFG::changeTip(RADIX& tip_name) {
 		} else if (dev_type == d_jbc) {
 			a_cfg.jbc_tip = tip_name;
 		}
+		snap_changed = true;
 		saveConfig();
 	}
 }
@@ -174,50 +323,35 @@ uint16_t CFG::tempToHuman(uint16_t temp, int16_t ambient, tDevice dev) {
 	return tempH;
 }
 
-// Translate the temperature from human readable units (Celsius or Fahrenheit) to the internal units
+/*
+ * Translate the temperature from human readable units (Celsius or Fahrenheit) to the internal units
+ * The temperature translation table gives the inverse value directly. Because of the integer rounding,
+ * the result is adjusted by several steps to match tempToHuman() exactly
+ */
 uint16_t CFG::humanToTemp(uint16_t t, int16_t ambient, tDevice dev, bool no_lower_limit) {
-	int d = ambient - TIP_CFG::ambientTemp(dev);
-	uint16_t t200	= referenceTemp(0, dev) + d;
-	uint16_t t400	= referenceTemp(3, dev) + d;
 	uint16_t tmin	= tempMin(dev, true);					// The minimal temperature, Celsius
 	uint16_t tmax	= tempMax(dev, true);					// The maximal temperature, Celsius
 	if (no_lower_limit) tmin = 100;
 	if (!CFG_CORE::isCelsius()) {
-		t200 = celsiusToFahrenheit(t200);
-		t400 = celsiusToFahrenheit(t400);
 		tmin = celsiusToFahrenheit(tmin);
 		tmax = celsiusToFahrenheit(tmax);
 	}
 	t = constrain(t, tmin, tmax);
 
-	uint16_t left 	= 0;
-	uint16_t right 	= int_temp_max;
-	uint16_t temp = emap(t, t200, t400, TIP_CFG::calibration(0, dev), TIP_CFG::calibration(3, dev));
-
-	if (temp > (left+right)/ 2) {
-		temp -= (right-left) / 4;
-	} else {
-		temp += (right-left) / 4;
-	}
-
-	for (uint8_t i = 0; i < 20; ++i) {
+	int16_t tC		= t;
+	if (!CFG_CORE::isCelsius())
+		tC = ((t - 32) * 5 + 4) / 9;						// Fahrenheit to Celsius, rounded
+	uint16_t temp	= TIP_CFG::tempInternal(tC, ambient, dev);
+	for (uint8_t i = 0; i < 8; ++i) {
 		uint16_t tempH = tempToHuman(temp, ambient, dev);
-		if (tempH == t) {
-			return temp;
-		}
-		uint16_t new_temp;
+		if (tempH == t) break;
 		if (tempH < t) {
-			left = temp;
-			 new_temp = (left+right)/2;
-			if (new_temp == temp)
-				new_temp = temp + 1;
+			if (temp >= int_temp_max) break;
+			++temp;
 		} else {
-			right = temp;
-			new_temp = (left+right)/2;
-			if (new_temp == temp)
-				new_temp = temp - 1;
+			if (temp == 0) break;
+			--temp;
 		}
-		temp = new_temp;
 	}
 	return temp;
 }
@@ -229,14 +363,57 @@ std::string CFG::tipName(tDevice dev) {
 }
 
 // Save current configuration to the flash
+/*
+ * Accept the configuration changes. The configuration is written to the flash later by commitConfig(),
+ * so several changes made in a short time are written at once
+ */
 void CFG::saveConfig(void) {
 	if (CFG_CORE::areConfigsIdentical())
 		return;
-	saveRecord(&a_cfg);										// calculates CRC and changes ID
-	CFG_CORE::syncConfig();
+	CFG_CORE::syncConfig();									// restoreConfig() reverts to the accepted configuration
+	uint32_t now = HAL_GetTick();
+	if (!cfg_pending)
+		first_change = now;
+	cfg_pending	= true;
+	commit_due	= now + CFG_COMMIT_DELAY;					// Wait for the next change
 }
 
+/*
+ * Write the accepted configuration when there were no changes for CFG_COMMIT_DELAY ms or the changes are kept too long.
+ * Called from the main loop, force is true when the power is failing. idle is true when the iron and the hot air gun are off:
+ * erasing the MCU flash page stops the interrupts (the heating control) for 20-40 ms, see snapshot.h
+ * The flash sector erase takes up to 400 ms, so while the devices are working the record is written only when
+ * the erased sectors are available; on the legacy flash drive (no FTL) the write waits for the idle time.
+ * Nothing is written until reconcile() loads the tip table and checks the tips of the configuration
+ */
+void CFG::commitConfig(bool force, bool idle) {
+	if (reconcile_step != 0)
+		return;
+	if (cfg_pending) {
+		uint32_t now = HAL_GetTick();
+		if (!force && (int32_t)(now - commit_due) < 0 && now - first_change < CFG_COMMIT_MAX)
+			return;
+		if (!force && !idle && !writeReady())				// Try again on the next loop, the free sectors are being erased
+			return;
+		if (saveRecord(CFG_CORE::spareConfig())) {			// calculates CRC and changes ID
+			cfg_pending		= false;
+			snap_changed	= true;
+		} else {											// The flash drive is busy (locked by USB host), try again later
+			first_change	= now;
+			commit_due		= now + CFG_COMMIT_DELAY;
+			return;
+		}
+	}
+	if (snap_changed && (idle || !snap_full))	// Keep the snapshot of the working data up to date
+		saveSnapshot(idle);
+}
+
+// Save the PID parameters of the device. If the current tip has specific PID parameters, update them instead
 void CFG::savePID(PIDparam &pp, tDevice dev) {
+	if (TIP_CFG::hasTipPID(dev)) {
+		saveTipPID(pp, dev);
+		return;
+	}
 	if (dev == d_t12) {
 		pid.t12_Kp	= pp.Kp;
 		pid.t12_Ki	= pp.Ki;
@@ -251,10 +428,132 @@ void CFG::savePID(PIDparam &pp, tDevice dev) {
 		pid.jbc_Kd	= pp.Kd;
 	}
 	savePIDparams(&pid);
+	snap_changed = true;
+}
+
+// Save the PID parameters of the current tip. The tip should have the record in tipcal.dat file
+bool CFG::saveTipPID(PIDparam &pp, tDevice dev) {
+	RADIX& tip_name = currentTip(dev);
+	int16_t tip_global = tips.index(tip_name);
+	if (tip_global < 0) return false;
+	uint8_t tip_index = tips.tipCalibrationIndex(tip_global);
+	if (tip_index == NO_TIP_CHUNK) return false;
+	TIP_PID tip_pid;
+	tip_pid.name		= tip_name;
+	tip_pid.Kp			= pp.Kp;
+	tip_pid.Ki			= pp.Ki;
+	tip_pid.Kd			= pp.Kd;
+	tip_pid.reserved	= 0;
+	if (!saveTipPIDparams(&tip_pid, tip_index))
+		return false;
+	TIP_CFG::applyTipPID(pp, dev);
+	snap_changed = true;
+	return true;
+}
+
+// Remove the PID parameters of the current tip: the record with empty tip name does not match any tip, see selectTip()
+bool CFG::resetTipPID(tDevice dev) {
+	if (!TIP_CFG::hasTipPID(dev)) return true;
+	RADIX& tip_name = currentTip(dev);
+	int16_t tip_global = tips.index(tip_name);
+	if (tip_global < 0) return false;
+	uint8_t tip_index = tips.tipCalibrationIndex(tip_global);
+	if (tip_index == NO_TIP_CHUNK) return false;
+	TIP_PID tip_pid;
+	tip_pid.name.initEmpty();
+	tip_pid.Kp			= 0;
+	tip_pid.Ki			= 0;
+	tip_pid.Kd			= 0;
+	tip_pid.reserved	= 0;
+	if (!saveTipPIDparams(&tip_pid, tip_index))
+		return false;
+	TIP_CFG::clearTipPID(dev);
+	snap_changed = true;
+	return true;
+}
+
+/*
+ * Find the active calibrated tip of the device with the fingerprint closest to the probe.
+ * The difference is the sum of relative differences of the temperature rise and the current.
+ * Returns the global tip index or -1 if no one tip fingerprint is close enough
+ */
+int16_t CFG::findTipByFprint(TIP_FPRINT &probe, tDevice dev) {
+	if (tips.total() < 2 || probe.rise == 0 || probe.current == 0)
+		return -1;
+	fp_search.probe		= &probe;
+	fp_search.dev		= dev;
+	fp_search.best		= -1;
+	fp_search.best_diff	= fprint_max_diff + 1;
+	scanTipFprints();										// Calls fprintLoaded() for every correct fingerprint record
+	fp_search.probe		= 0;
+	return fp_search.best;
+}
+
+// Compare the fingerprint read by scanTipFprints() with the probe. The tip should be activated and calibrated
+void CFG::fprintLoaded(TIP_FPRINT* fp, uint8_t tip_index) {
+	if (fp_search.probe == 0 || fp->rise == 0 || fp->current == 0)
+		return;
+	int16_t i = tips.index(fp->name);
+	if (i <= 0 || tips.tipCalibrationIndex(i) != tip_index)	// Skip Hot Air Gun 'tip' and the outdated records
+		return;
+	RADIX& r = tips.radix(i);
+	if (!r.isActivated() || !r.isCalibrated() || hardwareType(r) != fp_search.dev)
+		return;
+	TIP_FPRINT *probe = fp_search.probe;
+	uint32_t diff = (uint32_t)abs(probe->rise - fp->rise) * 100 / fp->rise;
+	diff += (uint32_t)abs(probe->current - fp->current) * 100 / fp->current;
+	if (diff < fp_search.best_diff) {
+		fp_search.best_diff	= diff;
+		fp_search.best		= i;
+	}
+}
+
+/*
+ * Save the probe measurement as the fingerprint of the current tip of the device.
+ * The probe is averaged with the fingerprint saved previously
+ */
+bool CFG::learnTipFprint(TIP_FPRINT &probe, tDevice dev) {
+	if (probe.rise == 0 || probe.current == 0)
+		return false;
+	RADIX& tip_name = currentTip(dev);
+	int16_t tip_global = tips.index(tip_name);
+	if (tip_global <= 0) return false;
+	uint8_t tip_index = tips.tipCalibrationIndex(tip_global);
+	if (tip_index == NO_TIP_CHUNK) return false;
+	if (!W25Q::mount()) return false;						// The saved fingerprint cannot be read, do not replace it
+	bool keep = keptMounted();
+	keepMounted(true);
+	TIP_FPRINT fp;
+	if (loadTipFprint(&fp, tip_index) && fp.name.match(tip_name) && fp.samples > 0) {
+		uint8_t n = fp.samples;
+		fp.rise		= (fp.rise * n + probe.rise + n/2) / (n + 1);
+		fp.current	= (fp.current * n + probe.current + n/2) / (n + 1);
+		if (n < fprint_max_samples) ++fp.samples;
+	} else {
+		fp.name		= tip_name;
+		fp.rise		= probe.rise;
+		fp.current	= probe.current;
+		fp.samples	= 1;
+	}
+	bool ret = saveTipFprint(&fp, tip_index);
+	keepMounted(keep);
+	W25Q::umount();
+	return ret;
+}
+
+// PID parameters: Kp, Ki, Kd. Use the current tip PID parameters if loaded
+PIDparam CFG::pidParams(tDevice dev) {
+	PIDparam pp;
+	if (TIP_CFG::tipPID(dev, pp))
+		return pp;
+	return CFG_CORE::pidParams(dev);
 }
 
-// Save new IRON tip calibration data to the FLASH only. Do not change active configuration
-bool CFG::saveTipCalibtarion(tDevice dev, uint16_t temp[4], uint8_t mask, int8_t ambient) {
+/*
+ * Save new IRON tip calibration data to the FLASH only. Do not change active configuration
+ * If the calibration curve is not specified, the empty curve record is saved to invalidate previous one
+ */
+bool CFG::saveTipCalibtarion(tDevice dev, uint16_t temp[4], uint8_t mask, int8_t ambient, TIP_CURVE *curve) {
 	TIP tip;
 	tip.t200		= temp[0];
 	tip.t260		= temp[1];
@@ -264,10 +563,20 @@ bool CFG::saveTipCalibtarion(tDevice dev, uint16_t temp[4], uint8_t mask, int8_t
 	tip.name		= currentTip(dev);
 	if (isValidTipConfig(&tip)) {
 		tip.name.setCalibMask(mask);
-		int16_t tip_index = saveTipData(&tip);
+		int16_t global_index = (tips.total() > 1)?tips.index(tip.name):-1;
+		int16_t tip_index = saveTipData(&tip, false, (global_index >= 0)?tips.tipCalibrationIndex(global_index):-1);
 		if (tip_index >= 0) {
 			tips.applyCalibtationIndex(tip.name, tip_index);
-			return true;
+			TIP_CURVE empty;
+			if (!curve) {
+				memset((void *)&empty, 0, sizeof(TIP_CURVE));
+				curve = &empty;
+			}
+			curve->ambient	= ambient;
+			curve->name		= tip.name;
+			for (uint8_t i = 0; i < 4; ++i)
+				curve->ref[i] = temp[i];
+			return saveTipCurve(curve, tip_index);			// The calibration is incomplete without the curve
 		}
 	}
 	tip.name.clearCalibrated();								// The tip is not calibrated
@@ -305,7 +614,7 @@ bool CFG::toggleTipActivation(uint16_t global_tip_index) {
 	}
 	if (!ret) return false;
 
-	calib_index = saveTipData(&tip, true);
+	calib_index = saveTipData(&tip, true, calib_index);
 	if (calib_index >= 0) {
 		tips.applyCalibtationIndex(tip.name, calib_index);
 		return true;
@@ -328,7 +637,7 @@ bool CFG::toggleTipActivation(uint16_t global_tip_index) {
   * 	manual_change is true
   * 	dev_type is d_t12 or d_jbc
   */
-uint8_t	CFG::tipList(uint8_t current, TIP_ITEM list[], uint8_t list_len, bool active_only, bool manual_change, tDevice dev_type) {
+uint8_t	CFG::tipList(uint16_t current, TIP_ITEM list[], uint8_t list_len, bool active_only, bool manual_change, tDevice dev_type) {
 	if (tips.total() == 0) {								// If tip_table is not initialized, return empty list
 		for (uint8_t tip_index = 0; tip_index < list_len; ++tip_index) {
 			list[tip_index].tip_name.initEmpty();
@@ -336,18 +645,39 @@ uint8_t	CFG::tipList(uint8_t current, TIP_ITEM list[], uint8_t list_len, bool ac
 		return 0;
 	}
 
+	ACTIVE_LIST *al = active_only?activeList(dev_type, manual_change):0;
+	if (al) {												// Tip selection mode: use the prebuilt list of activated tips
+		uint16_t low = 0, upp = al->count;					// Binary search for the first tip not less than current one
+		while (low < upp) {
+			uint16_t mid = (low + upp) >> 1;
+			if (al->index[mid] < current)
+				low = mid + 1;
+			else
+				upp = mid;
+		}
+		uint8_t loaded = 0;
+		for (uint16_t i = (low > 3)?low-3:0; i < al->count && loaded < list_len; ++i) {
+			list[loaded].tip_index	= al->index[i];
+			list[loaded].tip_name	= tips.radix(al->index[i]);
+			++loaded;
+		}
+		for (uint8_t tip_index = loaded; tip_index < list_len; ++tip_index) {
+			list[tip_index].tip_name.initEmpty();			// Clear rest of the list
+		}
+		return loaded;
+	}
+
 	// Seek several (previous) tips backward
-	int16_t tip_index = current-1;
-	uint8_t previous = 3;
-	for (; tip_index > 0; --tip_index) {
-		if (!active_only || (tips.radix(tip_index).isActivated())) {
-			if (--previous == 0)
-				break;
+	int16_t tip_index = current;
+	for (uint8_t previous = 0; previous < 3; ++previous) {
+		tip_index = tips.prevTip(tip_index, active_only);	// The activated tips are kept in RAM, others are read from the flash by pages
+		if (tip_index < 0) {
+			tip_index = 0;
+			break;
 		}
 	}
 	uint8_t loaded = 0;
-	if (tip_index < 0) tip_index = 0;						// Ensure the tip index is not negative inside next loop, because the tip_table will be read
-	for (; tip_index < tips.total(); ++tip_index) {
+	for (; tip_index >= 0 && tip_index < tips.total(); tip_index = tips.nextTip(tip_index, active_only)) {
 		if (tip_index == 0) continue;						// Skip Hot Air Gun 'tip'
 		RADIX r = tips.radix(tip_index);					// The tip name
 		if (active_only && !(r.isActivated()))
@@ -367,20 +697,57 @@ uint8_t	CFG::tipList(uint8_t current, TIP_ITEM list[], uint8_t list_len, bool ac
 	return loaded;
 }
 
+/*
+ * The list of activated tips of the device sorted by the global tip index.
+ * The list is built again only if the tip activation has been changed (see TIPS::version()) or the selection mode has been changed.
+ * Returns zero if the device has no list or there is not enough memory
+ */
+CFG::ACTIVE_LIST* CFG::activeList(tDevice dev, bool manual_change) {
+	if (dev != d_t12 && dev != d_jbc) return 0;
+	ACTIVE_LIST *al = &active_list[(dev == d_t12)?0:1];
+	if (al->valid && al->version == tips.version() && al->manual == manual_change)
+		return al;
+
+	al->count = 0;
+	for (int16_t i = tips.nextTip(0, true); i > 0; i = tips.nextTip(i, true)) {
+		RADIX r = tips.radix(i);
+		if (manual_change && dev != hardwareType(r))
+			continue;										// Skip tip of wrong hardware type
+		if (!manual_change && dev == d_t12 && r.type() == TIP_NONE)
+			continue;										// Skip not native T12 tip
+		if (al->count >= al->size) {
+			uint16_t *p = (uint16_t *)realloc(al->index, (al->size + 8) * sizeof(uint16_t));
+			if (!p) {
+				al->valid = false;
+				return 0;
+			}
+			al->index	= p;
+			al->size	+= 8;
+		}
+		al->index[al->count++] = i;
+	}
+	al->version	= tips.version();
+	al->manual	= manual_change;
+	al->valid	= true;
+	return al;
+}
+
 // Check the current tip is active. Return nearest active tip or 1 if no one tip has been activated
 RADIX CFG::nearActiveTip(RADIX& current_tip) {
 	int16_t 	tip_index	= tips.index(current_tip);
 	TIP_TYPE_t	tip_type	= current_tip.type();
 	RADIX		res			= tips.radix(tip_index);		// Existing tip or ZERO
 	if (tip_index < 0) {
+		for (int16_t i = tips.nextTip(0, true); i > 0; i = tips.nextTip(i, true)) {
+			RADIX r = tips.radix(i);
+			if (tip_type == r.type())
+				return r;									// Activated tip of the same type
+		}
 		uint16_t existing = 65535;							// For sure non-existing tip index
-		for (uint16_t i = 0; i < tips.total(); ++i) {
+		for (uint16_t i = 0; i < tips.total(); ++i) {		// Whole catalogue, read from the flash by pages
 			RADIX r = tips.radix(i);
-			if (tip_type == r.type()) {
+			if (tip_type == r.type())
 				existing = i;
-				if (r.isActivated())
-					return r;
-			}
 		}
 		res = tips.radix(existing);
 		if (res.isEmpty()) {								// Not found tip of the type specified in the global tip list
@@ -394,24 +761,14 @@ RADIX CFG::nearActiveTip(RADIX& current_tip) {
 	// Main case: the tip has been found in the global list
 	if (res.isActivated())
 		return res;											// Current tip is activated, so use it
-	uint16_t low_index = tip_index -1;
-	for ( ; low_index > 0; --low_index) {
-		RADIX r = tips.radix(low_index);
-		if (r.isActivated())
-			break;
-	}
-	uint16_t upp_index = tip_index + 1;
-	for ( ; upp_index < tips.total(); ++upp_index) {
-		RADIX r = tips.radix(upp_index);
-		if (r.isActivated())
-			break;
-	}
-	if (low_index == 0 && upp_index >= tips.total()) {		// No near tip the specified type found
+	int16_t low_index = tips.prevTip(tip_index, true);		// Nearest activated tips
+	int16_t upp_index = tips.nextTip(tip_index, true);
+	if (low_index < 0 && upp_index < 0) {					// No near tip the specified type found
 		return res;											// Despite the current tip is not active
 	}
-	if (low_index == 0) {
+	if (low_index < 0) {
 		res = tips.radix(upp_index);
-	} else if (upp_index >= tips.total()) {
+	} else if (upp_index < 0) {
 		res = tips.radix(low_index);
 	} else {												// Both side neighbor found
 		if (abs(tip_index - low_index) < abs(upp_index - tip_index))
@@ -424,6 +781,7 @@ RADIX CFG::nearActiveTip(RADIX& current_tip) {
 
 // Initialize the configuration area. Save default configuration to the FLASH
 void CFG::initConfig(void) {
+	snap.invalidate();										// The snapshot of the previous configuration
 	if (clearConfig()) {									// Format FLASH
 		setDefaults();										// Create default configuration
 		saveRecord(&a_cfg);									// Save default config
@@ -436,12 +794,15 @@ bool CFG::clearAllTipsCalibration(void) {
 	return clearTips();
 }
 
-void CFG::applyTipCalibtarion(uint16_t temp[4], int8_t ambient, tDevice dev, bool calibrated) {
+void CFG::applyTipCalibtarion(uint16_t temp[4], int8_t ambient, tDevice dev, bool calibrated, const TIP_CURVE *curve) {
 	changeTipCalibtarion(temp, ambient, dev);
+	if (curve)
+		TIP_CFG::loadCurve(*curve, dev);
 	RADIX& tip_name = currentTip(dev);
 	tip_name.setActivated();
 	if (calibrated)
 		tip_name.setCalibrated();
+	snap_changed = true;
 }
 
 uint16_t CFG_CORE::tempMin(tDevice dev, bool force_celsius) {
@@ -475,25 +836,21 @@ uint16_t CFG_CORE::tempMax(tDevice dev, bool celsius, bool safe_iron_mode) {
  * and save index of calibrated tip into tip_table
  */
 uint8_t CFG::buildTipTable(void) {
-	TIP		tmp_tip;
-//	RADIX	r;
-	uint8_t	loaded 	= 0;
-	for (int16_t i = 0; i < tips.total(); ++i) {			// Limit this loop by whole TIP list for reliability
-		TIP_IO_STATUS ts = loadTipData(&tmp_tip, i, true);
-		if (ts == TIP_OK) {
-			if (!isValidTipConfig(&tmp_tip))
-				tmp_tip.name.clearCalibrated();
-			if (tips.applyCalibtationIndex(tmp_tip.name, i))
-				++loaded;
-		} else if (ts == TIP_IO) {
-			break;
-		}
-	}
-	W25Q::umount();
-	return loaded;
+	loadTipTable();											// Calls tipLoaded() for every correct tip record
+	uint16_t loaded = tips.calibrated();					// The tips missing in the tip list are not loaded
+	return (loaded > 255)?255:loaded;
+}
+
+// Save index of the calibrated tip into tip_table, called by W25Q::loadTipTable()
+bool CFG::tipLoaded(TIP* tip, uint8_t tip_index) {
+	if (!isValidTipConfig(tip))
+		tip->name.clearCalibrated();
+	return tips.applyCalibtationIndex(tip->name, tip_index);
 }
 
 uint16_t CFG::loadGlobalTipList(void) {
+	if (loadTipIndex(tips))									// tip_list.txt has not been changed since the index was built
+		return tips.total();
 	uint8_t tip_name[16];
 	uint16_t tip_count = 0;
 	uint8_t br = 0;
@@ -517,29 +874,32 @@ uint16_t CFG::loadGlobalTipList(void) {
 			}
 		}
 		tipListEnd();
+		tips.buildIndex();									// Sort the tip names for fast lookup
+		if (saveTipIndex(tips))								// Next time the tip list is not parsed, see W25Q::loadTipIndex()
+			loadTipIndex(tips);								// Release the tip list in RAM, read it from the flash by pages
 	}
 	return tip_count;
 }
 
-// Compare two configurations
-bool CFG_CORE::areConfigsIdentical(void) {
-	if (a_cfg.t12_temp 			!= s_cfg.t12_temp) 			return false;
-	if (a_cfg.jbc_temp 			!= s_cfg.jbc_temp) 			return false;
-	if (a_cfg.gun_temp 			!= s_cfg.gun_temp) 			return false;
-	if (a_cfg.gun_fan_speed 	!= s_cfg.gun_fan_speed)		return false;
-	if (a_cfg.t12_low_temp		!= s_cfg.t12_low_temp)		return false;
-	if (a_cfg.t12_low_to		!= s_cfg.t12_low_to)		return false;
-	if (a_cfg.t12_off_timeout 	!= s_cfg.t12_off_timeout)	return false;
-	if (a_cfg.jbc_low_temp		!= s_cfg.jbc_low_temp)		return false;
-	if (a_cfg.jbc_off_timeout 	!= s_cfg.jbc_off_timeout)	return false;
-	if (a_cfg.bit_mask			!= s_cfg.bit_mask)			return false;
-	if (a_cfg.boost				!= s_cfg.boost)				return false;
-	if (a_cfg.dspl_bright		!= s_cfg.dspl_bright)		return false;
-	if (a_cfg.gun_low_temp		!= s_cfg.gun_low_temp)		return false;
-	if (a_cfg.gun_off_timeout	!= s_cfg.gun_off_timeout)	return false;
-	if (!a_cfg.t12_tip.match(s_cfg.t12_tip))				return false;
-	if (!a_cfg.jbc_tip.match(s_cfg.jbc_tip))				return false;
-	if (strncmp(a_cfg.language, s_cfg.language, LANG_LENGTH)  != 0)	return false;
+// Compare the configuration record with the spare one
+bool CFG_CORE::areConfigsIdentical(RECORD &r_cfg) {
+	if (r_cfg.t12_temp 			!= s_cfg.t12_temp) 			return false;
+	if (r_cfg.jbc_temp 			!= s_cfg.jbc_temp) 			return false;
+	if (r_cfg.gun_temp 			!= s_cfg.gun_temp) 			return false;
+	if (r_cfg.gun_fan_speed 	!= s_cfg.gun_fan_speed)		return false;
+	if (r_cfg.t12_low_temp		!= s_cfg.t12_low_temp)		return false;
+	if (r_cfg.t12_low_to		!= s_cfg.t12_low_to)		return false;
+	if (r_cfg.t12_off_timeout 	!= s_cfg.t12_off_timeout)	return false;
+	if (r_cfg.jbc_low_temp		!= s_cfg.jbc_low_temp)		return false;
+	if (r_cfg.jbc_off_timeout 	!= s_cfg.jbc_off_timeout)	return false;
+	if (r_cfg.bit_mask			!= s_cfg.bit_mask)			return false;
+	if (r_cfg.boost				!= s_cfg.boost)				return false;
+	if (r_cfg.dspl_bright		!= s_cfg.dspl_bright)		return false;
+	if (r_cfg.gun_low_temp		!= s_cfg.gun_low_temp)		return false;
+	if (r_cfg.gun_off_timeout	!= s_cfg.gun_off_timeout)	return false;
+	if (!r_cfg.t12_tip.match(s_cfg.t12_tip))				return false;
+	if (!r_cfg.jbc_tip.match(s_cfg.jbc_tip))				return false;
+	if (strncmp(r_cfg.language, s_cfg.language, LANG_LENGTH)  != 0)	return false;
 	return true;
 };
 
@@ -755,6 +1115,36 @@ void TIP_CFG::load(const TIP& ltip, tDevice dev) {
 	tip[i].calibration[2]	= ltip.t330;
 	tip[i].calibration[3]	= ltip.t400;
 	tip[i].ambient			= ltip.ambient;
+	tip[i].curve_points		= 0;
+	buildTempLUT(tip[i].ambient, i);
+}
+
+/*
+ * Load the tip calibration curve. The curve points are sorted by the real temperature,
+ * the points breaking the monotony of the curve are skipped. At least 2 points required to build the curve
+ */
+void TIP_CFG::loadCurve(const TIP_CURVE& curve, tDevice dev) {
+	uint8_t i = uint8_t(dev);
+	if (i >= 3) return;
+	uint8_t n 		= 0;
+	uint16_t last	= 0;										// The real temperature of previous point
+	int8_t d		= tip[i].ambient - curve.ambient;			// Adjust the real temperature to the tip ambient temperature
+	while (n < TIP_CURVE_POINTS) {
+		uint8_t next = TIP_CURVE_POINTS;						// Find next point with the lowest real temperature
+		for (uint8_t j = 0; j < curve.points && j < TIP_CURVE_POINTS; ++j) {
+			if (curve.real[j] > last && (next >= TIP_CURVE_POINTS || curve.real[j] < curve.real[next]))
+				next = j;
+		}
+		if (next >= TIP_CURVE_POINTS) break;
+		last = curve.real[next];
+		if (n > 0 && curve.internal[next] <= tip[i].curve_temp[n-1])
+			continue;											// Not monotone point
+		tip[i].curve_real[n]	= curve.real[next] + d;
+		tip[i].curve_temp[n]	= curve.internal[next];
+		++n;
+	}
+	tip[i].curve_points = (n >= 2)?n:0;
+	buildTempLUT(tip[i].ambient, i);
 }
 
 void TIP_CFG::dump(TIP* ltip, tDevice dev) {
@@ -786,6 +1176,8 @@ void TIP_CFG::changeTipCalibtarion(uint16_t temp[4], int8_t ambient, tDevice dev
 		tip[i].calibration[j]	= temp[j];
 	if (tip[i].calibration[3] > int_temp_max) tip[i].calibration[3] = int_temp_max;
 	tip[i].ambient	= ambient;
+	tip[i].curve_points	= 0;
+	buildTempLUT(tip[i].ambient, i);
 }
 
 uint16_t TIP_CFG::referenceTemp(uint8_t index, tDevice dev) {
@@ -801,31 +1193,123 @@ uint16_t TIP_CFG::tempCelsius(uint16_t temp, int16_t ambient, tDevice dev) {
 	int16_t tempH 	= 0;
 	if (i > 2) return 0;
 
+	if (lut[i].ambient != ambient)								// The ambient temperature has been changed
+		buildTempLUT(ambient, i);
+	TEMP_LUT &l = lut[i];
+	uint8_t last = l.size - 1;
+	if (temp < l.temp[1]) {										// less than first calibration point
+		tempH = map(temp, l.temp[0], l.temp[1], l.celsius[0], l.celsius[1]);
+	} else if (temp <= l.temp[last]) {							// Inside calibration interval
+		uint8_t j = 2;
+		while (j < last && temp >= l.temp[j]) ++j;
+		tempH = map(temp, l.temp[j-1], l.temp[j], l.celsius[j-1], l.celsius[j]);
+	} else {													// Greater than maximum
+		tempH = emap(temp, l.ext_temp[0], l.ext_temp[1], l.ext_celsius[0], l.ext_celsius[1]);
+	}
+	tempH = constrain(tempH, ambient, 999);
+	return tempH;
+}
+
+// Translate the Celsius temperature to the internal temperature of the IRON or Hot Air Gun
+uint16_t TIP_CFG::tempInternal(uint16_t celsius, int16_t ambient, tDevice dev) {
+	uint8_t i 		= uint8_t(dev);
+	int32_t temp	= 0;
+	if (i > 2) return 0;
+
+	if (lut[i].ambient != ambient)
+		buildTempLUT(ambient, i);
+	TEMP_LUT &l = lut[i];
+	uint8_t j = 1;
+	while (j < l.size && (int16_t)celsius > l.celsius[j]) ++j;
+	if (j < l.size) {
+		temp = emap(celsius, l.celsius[j-1], l.celsius[j], l.temp[j-1], l.temp[j]);
+	} else {
+		temp = emap(celsius, l.ext_celsius[0], l.ext_celsius[1], l.ext_temp[0], l.ext_temp[1]);
+	}
+	return constrain(temp, 0, int_temp_max);
+}
+
+/*
+ * Build the temperature translation table of the tip for the ambient temperature
+ * If the tip calibration curve is loaded, the table points are the curve points. The temperature above the curve
+ * is extrapolated by the line parallel to the reference points line
+ */
+void TIP_CFG::buildTempLUT(int16_t ambient, uint8_t i) {
+	tDevice dev = tDevice(i);
 	// The temperature difference between current ambient temperature and ambient temperature during tip calibration
-	int d = ambient - tip[i].ambient;
-	if (temp < tip[i].calibration[0]) {							// less than first calibration point
-	    tempH = map(temp, 0, tip[i].calibration[0], ambient, referenceTemp(0, dev)+d);
+	int16_t d	= ambient - tip[i].ambient;
+	TEMP_LUT &l = lut[i];
+	l.temp[0]		= 0;
+	l.celsius[0]	= ambient;
+	l.ext_temp[0]		= tip[i].calibration[1];
+	l.ext_celsius[0]	= referenceTemp(1, dev) + d;
+	if (tip[i].calibration[1] < tip[i].calibration[3]) {		// If tip calibrated correctly
+		l.ext_temp[1]	= tip[i].calibration[3];
+	} else {													// Perhaps, the tip calibration process
+		l.ext_temp[1]	= int_temp_max;
+	}
+	l.ext_celsius[1]	= referenceTemp(3, dev) + d;
+	if (tip[i].curve_points >= 2) {
+		uint8_t n = tip[i].curve_points;
+		for (uint8_t j = 0; j < n; ++j) {
+			l.temp[j+1]		= tip[i].curve_temp[j];
+			l.celsius[j+1]	= tip[i].curve_real[j] + d;
+		}
+		l.size = n + 1;
+		// Move the extrapolation line to the last curve point
+		l.ext_temp[1]		= l.temp[n] + (l.ext_temp[1] - l.ext_temp[0]);
+		l.ext_celsius[1]	= l.celsius[n] + (l.ext_celsius[1] - l.ext_celsius[0]);
+		l.ext_temp[0]		= l.temp[n];
+		l.ext_celsius[0]	= l.celsius[n];
 	} else {
-		if (temp <= tip[i].calibration[3]) {					// Inside calibration interval
-			for (uint8_t j = 1; j < 4; ++j) {
-				if (temp < tip[i].calibration[j]) {
-					tempH = map(temp, tip[i].calibration[j-1], tip[i].calibration[j],
-							referenceTemp(j-1, dev)+d, referenceTemp(j, dev)+d);
-					break;
-				}
-			}
-		} else {												// Greater than maximum
-			if (tip[i].calibration[1] < tip[i].calibration[3]) { // If tip calibrated correctly
-				tempH = emap(temp, tip[i].calibration[1], tip[i].calibration[3],
-					referenceTemp(1, dev)+d, referenceTemp(3, dev)+d);
-			} else {											// Perhaps, the tip calibration process
-				tempH = emap(temp, tip[i].calibration[1], int_temp_max,
-							referenceTemp(1, dev)+d, referenceTemp(3, dev)+d);
-			}
+		for (uint8_t j = 0; j < 4; ++j) {
+			l.temp[j+1]		= tip[i].calibration[j];
+			l.celsius[j+1]	= referenceTemp(j, dev) + d;
 		}
+		l.size = 5;
 	}
-	tempH = constrain(tempH, ambient, 999);
-	return tempH;
+	l.ambient		= ambient;
+}
+
+// Restore the active tips calibration saved by saveTipRecords(), build the temperature translation tables
+void TIP_CFG::loadTipRecords(const TIP_RECORD rec[3]) {
+	for (uint8_t i = 0; i < 3; ++i) {
+		tip[i] = rec[i];
+		if (tip[i].curve_points > TIP_CURVE_POINTS)
+			tip[i].curve_points = 0;
+		buildTempLUT(tip[i].ambient, i);
+	}
+}
+
+// Load the tip specific PID parameters
+void TIP_CFG::loadTipPID(const TIP_PID& tip_pid, tDevice dev) {
+	applyTipPID(PIDparam(tip_pid.Kp, tip_pid.Ki, tip_pid.Kd), dev);
+}
+
+void TIP_CFG::applyTipPID(const PIDparam& pp, tDevice dev) {
+	uint8_t i = uint8_t(dev);
+	if (i >= 3) return;
+	tip[i].pid		= pp;
+	tip[i].has_pid	= true;
+}
+
+void TIP_CFG::clearTipPID(tDevice dev) {
+	uint8_t i = uint8_t(dev);
+	if (i >= 3) return;
+	tip[i].has_pid	= false;
+}
+
+bool TIP_CFG::hasTipPID(tDevice dev) {
+	uint8_t i = uint8_t(dev);
+	if (i >= 3) return false;
+	return tip[i].has_pid;
+}
+
+// Returns true and the tip specific PID parameters if loaded
+bool TIP_CFG::tipPID(tDevice dev, PIDparam& pp) {
+	if (!hasTipPID(dev)) return false;
+	pp = tip[uint8_t(dev)].pid;
+	return true;
 }
 
 // Return the reference temperature points of the IRON tip calibration
@@ -841,6 +1325,8 @@ void TIP_CFG::resetTipCalibration(tDevice dev) {
 	for (uint8_t i = 0; i < 4; ++i)
 		tip[dev_indx].calibration[i] = calib_default[i];
 	tip[dev_indx].ambient	= default_ambient;					// default_ambient defined in vars.cpp
+	tip[dev_indx].curve_points = 0;
+	buildTempLUT(tip[dev_indx].ambient, dev_indx);
 }
 
 void TIP_CFG::defaultCalibration(TIP *tip) {
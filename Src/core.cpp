@@ -3,6 +3,11 @@
  *
  * 2024 NOV 16, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
+ * 2025 MAR 07
+ * 		The main loop writes the changed configuration, see CFG::commitConfig()
+ * 		The main loop loads the tip list and the tip table after the fast startup, see CFG::reconcile()
+ * 		The board has no power-fail signal: the configuration is written immediately only when the AC_ZERO pulses disappear
+ * 		The MCU flash snapshot page is erased only when the iron and the hot air gun are off, see snapshot.h
  *
  *  Hardware configuration:
  *  Analog pins:
@@ -33,13 +38,13 @@
  *
  */
 
-#include <math.h>
 #include "core.h"
 #include "hw.h"
 #include "mode.h"
 #include "work_mode.h"
 #include "menu.h"
 #include "vars.h"
+#include "fsmount.h"
 
 // Activated ADC Ranks Number (hadc1.Init.NbrOfConversion)
 #define ADC1_CUR 			(5)
@@ -50,8 +55,6 @@ extern ADC_HandleTypeDef	hadc3;
 extern TIM_HandleTypeDef	htim2;
 extern TIM_HandleTypeDef	htim3;
 
-extern uint8_t				usb_flash_busy;					// Defined in usbd_storage_if.c
-
 volatile static uint32_t	errors		= 0;
 
 typedef enum { ADC_IDLE, ADC_CURRENT, ADC_TEMP } t_ADC_mode;
@@ -78,7 +81,7 @@ static	MCALIB_MANUAL	calib_manual(&core);
 static	MCALMENU		calib_menu(&core, &calib_auto, &calib_manual);
 static	MFAIL			fail(&core);
 static	MTPID			manual_pid(&core);
-static 	MAUTOPID		auto_pid(&core);
+static 	MAUTOPID		auto_pid(&core, &manual_pid);
 static	MENU_PID		pid_menu(&core, &manual_pid, &auto_pid);
 static  MABOUT			about(&core);
 static  MDEBUG			debug(&core);
@@ -172,31 +175,25 @@ extern "C" void setup(void) {
 	format.setup(&work, 0, 0);
 
 	core.dspl.clear();
-	if (usb_flash_busy) {									// Attached via usb port to the computer to upload files
-		fail.setup(&fail, &fail, &fail);					// Do not exit the fail mode
-		fail.setMessage(MSG_UPDATE_FLASH);
-		pMode	= &fail;
-	} else {
-		switch (cfg_init) {
-			case CFG_NO_TIP:
-				pMode	= &activate;						// No tip configured, run tip activation menu
-				break;
-			case CFG_READ_ERROR:							// Failed to read FLASH
-				fail.setMessage(MSG_EEPROM_READ);
-				fail.setup(&fail, &fail, &format);			// Do not enter the main working mode
-				pMode	= &fail;
-				break;
-			case CFG_NO_FILESYSTEM:
-				fail.setMessage(MSG_FORMAT_FAILED);			// Prepare the fail message
-				pMode	= &format;
-				break;
-			case CFG_NO_TIP_LIST:
-				fail.setMessage(MSG_NO_TIP_LIST);
-				pMode	= &fail;
-				break;
-			default:
-				break;
-		}
+	switch (cfg_init) {
+		case CFG_NO_TIP:
+			pMode	= &activate;							// No tip configured, run tip activation menu
+			break;
+		case CFG_READ_ERROR:								// Failed to read FLASH
+			fail.setMessage(MSG_EEPROM_READ);
+			fail.setup(&fail, &fail, &format);				// Do not enter the main working mode
+			pMode	= &fail;
+			break;
+		case CFG_NO_FILESYSTEM:
+			fail.setMessage(MSG_FORMAT_FAILED);				// Prepare the fail message
+			pMode	= &format;
+			break;
+		case CFG_NO_TIP_LIST:
+			fail.setMessage(MSG_NO_TIP_LIST);
+			pMode	= &fail;
+			break;
+		default:
+			break;
 	}
 	syncAC(1500);											// Synchronize TIM5 timer to AC power. Parameter is TIM5 counter value when TIM1 become zero
 	uint8_t br = core.cfg.getDsplBrightness();
@@ -250,12 +247,20 @@ extern "C" void loop(void) {
 	}
 
 	// If TIM3 counter has been changed since last check, we received AC_ZERO events from AC power
+	bool ac_lost = false;
 	if (HAL_GetTick() >= AC_check_time) {
-		ac_sine		= (TIM3->CNT != tim3_cntr);
+		bool ac_now	= (TIM3->CNT != tim3_cntr);
+		ac_lost		= ac_sine && !ac_now;					// The AC power has just disappeared, the supply is probably failing
+		ac_sine		= ac_now;
 		tim3_cntr	= TIM3->CNT;
 		AC_check_time = HAL_GetTick() + 41;					// 50Hz AC line generates 100Hz events. The pulse period is 10 ms
 	}
 
+	fsmount.poll();											// Write USB host data, erase free flash sectors in background
+	core.cfg.reconcile();									// Load the tip list and the tip table after the fast startup
+	bool idle = core.iron.isCold() && core.hotgun.isCold();
+	core.cfg.commitConfig(ac_lost, idle);					// Write the changed configuration; immediately if the AC power is lost
+
 	// Adjust display brightness
 	if (core.dspl.BRGT::adjust()) {
 		HAL_Delay(5);
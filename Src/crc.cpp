@@ -0,0 +1,99 @@
+/*
+ * crc.cpp
+ *
+ * 2025 MAR 07
+ * 		CRC-32 of the stored records, see crc.h
+ */
+
+#include <string.h>
+#include "main.h"
+#include "crc.h"
+
+static uint32_t	tail		= 0;							// The incomplete word of the data
+static uint8_t	tail_len	= 0;							// Number of bytes in the incomplete word
+
+#ifdef CRC_BASE
+static void crc32Reset(void) {
+	__HAL_RCC_CRC_CLK_ENABLE();
+	CRC->CR = CRC_CR_RESET;
+}
+
+static inline void crc32Word(uint32_t word) {
+	CRC->DR = word;
+}
+
+static uint32_t crc32Read(void) {
+	return CRC->DR;
+}
+
+#else
+static uint32_t	crc_table[256];
+static uint32_t	crc_value	= 0xFFFFFFFF;
+
+// Build the table of the CRC of every byte value
+static void crc32Reset(void) {
+	if (crc_table[1] == 0) {
+		for (uint16_t i = 0; i < 256; ++i) {
+			uint32_t c = (uint32_t)i << 24;
+			for (uint8_t b = 0; b < 8; ++b)
+				c = (c & 0x80000000)?((c << 1) ^ 0x04C11DB7):(c << 1);
+			crc_table[i] = c;
+		}
+	}
+	crc_value = 0xFFFFFFFF;
+}
+
+// The CRC unit shifts the word in starting from the most significant bit
+static void crc32Word(uint32_t word) {
+	for (int8_t s = 24; s >= 0; s -= 8)
+		crc_value = (crc_value << 8) ^ crc_table[((crc_value >> 24) ^ (word >> s)) & 0xFF];
+}
+
+static uint32_t crc32Read(void) {
+	return crc_value;
+}
+#endif
+
+void crc32Start(void) {
+	crc32Reset();
+	tail		= 0;
+	tail_len	= 0;
+}
+
+void crc32Update(const void* data, uint32_t size) {
+	const uint8_t* d = (const uint8_t*)data;
+	while (size > 0 && tail_len > 0) {						// Complete the word started by previous chunk
+		tail |= (uint32_t)(*d++) << (8 * tail_len);
+		--size;
+		if (++tail_len == 4) {
+			crc32Word(tail);
+			tail		= 0;
+			tail_len	= 0;
+		}
+	}
+	for ( ; size >= 4; size -= 4, d += 4) {
+		uint32_t word;
+		memcpy(&word, d, sizeof(word));						// The data can be unaligned
+		crc32Word(word);
+	}
+	for ( ; size > 0; --size) {
+		tail |= (uint32_t)(*d++) << (8 * tail_len);
+		++tail_len;
+	}
+}
+
+// Returns the CRC of the data, the incomplete word is padded by zero bytes
+uint32_t crc32Value(void) {
+	if (tail_len > 0) {
+		crc32Word(tail);
+		tail		= 0;
+		tail_len	= 0;
+	}
+	return crc32Read();
+}
+
+uint32_t crc32(const void* data, uint32_t size) {
+	crc32Start();
+	crc32Update(data, size);
+	return crc32Value();
+}
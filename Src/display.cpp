@@ -3,14 +3,20 @@
  *
  * 2024 NOV 16, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
+ * 2025 FEB 10
+ * 		pidShowGraph() normalizes the graph data using integer arithmetic
+ * 2025 MAR 07
+ * 		drawTipList() does not decode the tip names already shown, see tipName()
+ * 2025 MAR 08
+ * 		showVersion() warns if the flash drive is not wear leveled, see W25Q::migrateFTL()
  */
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
 #include "display.h"
 #include "tools.h"
+#include "fixmath.h"
 #include "main.h"					// to ensure rebuild the creation date
 
 static const uint8_t bmDegree[] = {
@@ -552,7 +558,7 @@ void DSPL::animatePower(tUnitPos pos, int16_t t) {
 }
 
 //---------------------- The Menu list display functions -------------------------
-void DSPL::drawTipList(TIP_ITEM list[], uint8_t list_len, uint8_t index, bool name_only) {
+void DSPL::drawTipList(TIP_ITEM list[], uint8_t list_len, uint16_t index, bool name_only) {
 	setFont(letter_font);
 	uint8_t  h	= getMaxCharHeight() + 5;					// Extra space between lines
 	uint16_t top = h+12;
@@ -591,7 +597,7 @@ void DSPL::drawTipList(TIP_ITEM list[], uint8_t list_len, uint8_t index, bool na
 				margin += 10+16;
 				checkBox(tip_entry, 10, 16, list[i].tip_name.isActivated());
 			}
-			strToBitmap(tip_entry, list[i].tip_name.tipName().c_str(), align_left, margin);
+			strToBitmap(tip_entry, tipName(list[i].tip_name), align_left, margin);
 			if (!(list[i].tip_name.isCalibrated())) {		// The tip is not calibrated
 				tip_entry.drawIcon(w-16-10, not_calibrated_icon_y, bmNotCalibrated, 16, 14);
 			}
@@ -604,6 +610,20 @@ void DSPL::drawTipList(TIP_ITEM list[], uint8_t list_len, uint8_t index, bool na
 	}
 }
 
+// Decoded tip name. Scrolling the tip list shows mostly the same tips, so the recently decoded names are kept
+const char* DSPL::tipName(RADIX &tip) {
+	uint32_t key = tip.tip() | 0x80000000;					// The tip name code without activation and calibration flags, never zero
+	for (uint8_t i = 0; i < TIP_NAME_CACHE; ++i) {
+		if (name_cache_key[i] == key)
+			return name_cache[i];
+	}
+	uint8_t n = name_cache_next;
+	name_cache_next = (n + 1) % TIP_NAME_CACHE;
+	tip.tipName(name_cache[n]);
+	name_cache_key[n] = key;
+	return name_cache[n];
+}
+
 void DSPL::menuShow(t_msg_id menu_id, uint8_t item, const char* value, bool modify) {
 	setFont(letter_font);
 	uint8_t  h		= getMaxCharHeight() + 10;				// Extra space between menu lines
@@ -921,11 +941,11 @@ void DSPL::pidShowGraph(void) {
 		} else {
 			int16_t t = GRAPH::temp(i);
 			if (t > 0) {
-				g1[0] = temp_zero - round((float)t * (float)temp_zero / (float)max_t);
+				g1[0] = temp_zero - fxMulDiv(t, temp_zero, max_t);
 				if (g1[0] < 1) g1[0] = 1;
 			} else {
 				int16_t neg = t * (-1);
-				g1[0] = temp_zero + round((float)neg * (float)temp_zero / (float)max_t);
+				g1[0] = temp_zero + fxMulDiv(neg, temp_zero, max_t);
 				if (g1[0] >= t_height) g1[0] = t_height - 1;
 			}
 		}
@@ -933,7 +953,7 @@ void DSPL::pidShowGraph(void) {
 		if (max_d == 0) {
 			g1[1] = disp_zero;
 		} else {
-			int16_t d = round((float)GRAPH::disp(i) * (float)d_height / (float)max_d);
+			int16_t d = fxMulDiv(GRAPH::disp(i), d_height, max_d);
 			if (d >= d_height) d = d_height-1;
 			g1[1] = disp_zero - d;
 		}
@@ -1069,7 +1089,8 @@ void DSPL::showDialog(t_msg_id msg_id, uint16_t y, bool yes, const char *paramet
 	}
 }
 
-void DSPL::showVersion(void) {
+// wear_leveling is false on the flash drive formatted by the previous firmware version that cannot be migrated, see W25Q::migrateFTL()
+void DSPL::showVersion(bool wear_leveling) {
 	static const char *name  = "IRONs & Hot Air Gun";
 	char buff[30];
 	setFont(letter_font);
@@ -1092,6 +1113,12 @@ void DSPL::showVersion(void) {
 	w = getStrWidth(buff);
 	x = (width() - w ) >> 1;
 	drawStr(x, h*3+top, buff, fg_color);
+	if (!wear_leveling) {									// Copy the files to computer, remove them and restart
+		sprintf(buff, "No flash wear leveling");
+		w = getStrWidth(buff);
+		x = (width() - w ) >> 1;
+		drawStr(x, h*4+top, buff, pid_color);
+	}
 }
 
 void DSPL::debugShow(uint16_t data[11], bool iron_on, bool gun_on, bool iron_connected, bool gun_connected, bool gun_reed, bool type_jbc, bool tilt_stby, bool jbc_change, bool gtim_ok) {
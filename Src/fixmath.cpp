@@ -0,0 +1,92 @@
+/*
+ * fixmath.cpp
+ *
+ * 2025 FEB 10
+ * 		Fixed-point math library, see fixmath.h
+ */
+
+#include "fixmath.h"
+
+// log2(1 + i/32) in Q16 format, i = [0; 32]
+static const uint32_t	log2_table[33] = {
+	    0,  2909,  5732,  8473, 11136, 13727, 16248, 18704,
+	21098, 23433, 25711, 27936, 30109, 32234, 34312, 36346,
+	38336, 40286, 42196, 44068, 45904, 47705, 49472, 51207,
+	52911, 54584, 56229, 57845, 59434, 60997, 62534, 64047,
+	65536
+};
+
+/*
+ * Binary logarithm of the integer value in Q16 format. log2(0) is undefined, returns 0
+ * The integer part is the position of the most significant bit, the fraction part is
+ * interpolated linearly between two nearest log2_table[] entries. The error is less than 0.0002
+ */
+int32_t fxLog2(uint32_t value) {
+	if (value == 0) return 0;
+	uint8_t  msb	= 31 - __builtin_clz(value);			// The integer part of the logarithm
+	uint32_t m		= value << (31 - msb);					// Normalize the mantissa: 1.xxxxx, the point is after bit 31
+	uint8_t  i		= (m >> 26) & 0x1F;						// Next 5 bits are the table index
+	uint32_t rem	= (m >> 10) & 0xFFFF;					// Next 16 bits are the interpolation position
+	uint32_t l		= log2_table[i];
+	l += ((log2_table[i+1] - l) * rem + 0x8000) >> 16;
+	return ((int32_t)msb << FX_SHIFT) + l;
+}
+
+// Natural logarithm of the integer value in Q16 format: ln(x) = log2(x) * ln(2)
+int32_t fxLn(uint32_t value) {
+	int64_t l = (int64_t)fxLog2(value) * FX_LN2;
+	return (l + (FX_ONE >> 1)) >> FX_SHIFT;
+}
+
+// Integer square root, floor(sqrt(value))
+uint32_t isqrt32(uint32_t value) {
+	uint32_t res = 0;
+	uint32_t bit = 1UL << 30;								// The highest power of 4 in 32-bits word
+	while (bit > value) bit >>= 2;
+	while (bit) {
+		if (value >= res + bit) {
+			value -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+	return res;
+}
+
+// Integer square root of 64-bits value, floor(sqrt(value))
+uint32_t isqrt64(uint64_t value) {
+	if (value <= 0xFFFFFFFFUL)
+		return isqrt32((uint32_t)value);
+	uint64_t res = 0;
+	uint64_t bit = 1ULL << 62;
+	while (bit > value) bit >>= 2;
+	while (bit) {
+		if (value >= res + bit) {
+			value -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)res;
+}
+
+// Signed division rounded to the nearest integer (half away from zero). Returns 0 if the denominator is zero
+int32_t fxDivRound(int64_t num, int64_t den) {
+	if (den == 0) return 0;
+	if (den < 0) {
+		num = -num;
+		den = -den;
+	}
+	if (num >= 0)
+		return (num + (den >> 1)) / den;
+	return -((-num + (den >> 1)) / den);
+}
+
+// Scaled division: a * b / c, rounded. The intermediate product is 64-bits long, so it does not overflow
+int32_t fxMulDiv(int32_t a, int32_t b, int32_t c) {
+	return fxDivRound((int64_t)a * b, c);
+}
@@ -6,74 +6,93 @@
  *
  * 2024 DEC 26
  * 		int16_t W25Q::saveTipData(TIP* tip, bool keep)
+ * 2025 FEB 14
+ * 		loadTipCurve() and saveTipCurve(), the complete tip calibration data
+ * 2025 FEB 17
+ * 		loadTipPIDparams() and saveTipPIDparams(), the tip specific PID parameters
+ * 2025 FEB 19
+ * 		loadTipFprint() and saveTipFprint(), the tip fingerprints
+ * 2025 FEB 22
+ * 		formatFlashDrive() creates the flash translation layer table before FAT file system, see FTL.h
+ * 2025 FEB 23
+ * 		The configuration and PID parameters records are appended to the key-value store, see kvstore.h
+ * 		The config.dat, config.bak and pid.dat files are read only if the store has no record yet
+ * 2025 FEB 26
+ * 		trimFree() reports the free clusters to the flash translation layer at startup, they are erased in background
+ * 2025 FEB 27
+ * 		The file system is mounted by the shared FSMOUNT object, see fsmount.h
+ * 2025 FEB 28
+ * 		The sector size work buffers are borrowed from the disk cache instead of the heap, see disk_buffer_acquire()
+ * 2025 MAR 01
+ * 		The flash IC initialization and formatting lock the flash against the USB host access, see fsmount.h
+ * 2025 MAR 04
+ * 		loadTipTable() reads tipcal.dat in one pass by sector size chunks instead of checking the file in init()
+ * 		and reading the tip records one by one
+ * 2025 MAR 05
+ * 		loadTipIndex() and saveTipIndex(), the sorted tip list is cached in tipindex.bin,
+ * 		so tip_list.txt is parsed only when it has been changed
+ * 		saveTipData() writes the tip record at the known index in tipcal.dat or appends new one instead of scanning the file.
+ * 		The backup copy of tipcal.dat is made only if the flash translation layer is not active
+ * 2025 MAR 06
+ * 		W25Q is the TIP_STORE: the tip catalogue is read from tipindex.bin by pages, see TIPS::attach()
+ * 2025 MAR 07
+ * 		The configuration and PID records are saved in config.kv with the version header and CRC-32, see loadKVRecord().
+ * 		The records of the previous format (16-bits checksum) and config.dat, pid.dat files are converted when loaded.
+ * 		reset() and format() fail if the flash cannot be locked, see FSMOUNT::lock()
+ * 		tipindex.bin is checked by CRC-32 calculated by the CRC unit, see crc.h
+ * 		scanTipFprints() reads tipfp.dat in one pass by sector size chunks
+ * 2025 MAR 08
+ * 		init() activates the flash translation layer on the flash drive formatted by the previous firmware version
+ * 		keeping the files, see migrateFTL()
+ * 		saveTipRecord() fills the gap before the record written beyond the end of file by the empty records
+ * 		writeReady() checks the erased free sectors are available for the configuration record, see FTL_Ready()
+ * 		The tip data files have the version header and CRC-32 of every record, see openTipFile(). The files
+ * 		of the previous format (8-bits checksum) are converted when opened, see upgradeTipFile()
  */
 #include <string.h>
+#include <stddef.h>
 #include "flash.h"
+#include "diskio.h"
+#include "fsmount.h"
 #include "W25Qxx.h"
-
-FATFS	fs;
+#include "FTL.h"
+#include "crc.h"
 
 FLASH_STATUS W25Q::init(void) {
-	if (!W25Qxx_Init()) return FLASH_ERROR;
+	if (!reset())		return FLASH_ERROR;
 	if (!mount())		return FLASH_NO_FILESYSTEM;
-
-	uint16_t	good_tips = 0;
-	if (FR_OK == f_open(&cfg_f, fn_tip_calib, FA_READ)) {	// Check the tip calibration data
-		while (true) {										// Read all tip calibration data
-			UINT	br = 0;
-			TIP		tmp_tip;
-			f_read(&cfg_f, (void *)&tmp_tip, (UINT)sizeof(TIP), &br);
-			if (br ==  (UINT)sizeof(TIP)) {
-				if (TIP_checkSum(&tmp_tip, false)) {		// CRC of the tip record is correct
-					++good_tips;
-				}
-			} else {
-				break;										// File is over
-			}
-		}
-		f_close(&cfg_f);
-	}
-	if (good_tips == 0) {									// Not tip loaded, try the backup file
-		FILINFO fno;
-		if (FR_OK == f_stat(fn_tip_backup, &fno)) {			// There is the backup file exists
-			f_unlink(fn_tip_calib);
-			f_rename(fn_tip_backup, fn_tip_calib);
-		}
+	if (migrateFTL()) {										// The volume has been shrunk, read it again
+		umount();
+		fsmount.invalidate();
+		if (!mount())	return FLASH_NO_FILESYSTEM;
 	}
+	kv.reset();												// Re-read the configuration records index
+	trimFree();
 	return FLASH_OK;
 }
 
 bool W25Q::reset() {
-	return W25Qxx_Init();
+	if (!fsmount.lock())
+		return false;
+	bool ret = W25Qxx_Init();
+	fsmount.unlock();
+	return ret;
 }
 
 bool W25Q::mount(void) {
 	if (act_f == W25Q_NOT_MOUNTED) {
-		// Try to mount flash
-		FRESULT res = f_mount(&fs, "0:/", 1);
-		if (res == FR_OK) {
-			uint32_t free_clust;
-			FATFS* fs_ptr = &fs;
-			res = f_getfree("", &free_clust, &fs_ptr);
-			if (res != FR_OK) {
-				f_mount(NULL, "", 0);						// unmount file system
-				return false;
-			}
-			act_f = W25Q_NONE;
-			return true;
-		}
-		return false;										// failed to mount file system
+		if (!fsmount.mount())
+			return false;									// failed to mount file system
+		act_f = W25Q_NONE;
 	}
 	return true;
 }
 
 void W25Q::umount(void) {
 	W25Q::close();
-	if (!keep_mounted) {
-		f_mount(NULL, "", 0);								// unmount file system
+	if (!keep_mounted && act_f == W25Q_NONE) {
+		fsmount.release();									// The volume remains mounted, see fsmount.h
 		act_f = W25Q_NOT_MOUNTED;
-	} else {
-		act_f = W25Q_NONE;
 	}
 }
 
@@ -87,10 +106,23 @@ void W25Q::close(void) {
 bool W25Q::loadRecord(RECORD* config_record) {
 	if (!mount())
 		return false;
-	W25Q::close();
 	UINT br = 0;
 	bool ret = false;
 	RECORD tmp_record;
+	if (openKV()) {
+		if (loadKVRecord(KV_CONFIG, (void *)&tmp_record, sizeof(RECORD), cfg_version)) {
+			memcpy((void *)config_record, (void *)&tmp_record, sizeof(RECORD));
+			umount();
+			return true;
+		}
+		if (kv.load(&cfg_f, KV_CONFIG, (void *)&tmp_record, sizeof(RECORD)) && CFG_checkSum(&tmp_record, false)) {
+			memcpy((void *)config_record, (void *)&tmp_record, sizeof(RECORD));
+			saveKVRecord(KV_CONFIG, (const void *)config_record, sizeof(RECORD), cfg_version); // The record of the previous format
+			umount();
+			return true;
+		}
+	}
+	W25Q::close();
 	if (FR_OK == f_open(&cfg_f, fn_cfg, FA_READ | FA_OPEN_EXISTING)) {
 		f_read(&cfg_f, (void *)&tmp_record, (UINT)sizeof(RECORD), &br);
 		if (br ==  (UINT)sizeof(RECORD)) {
@@ -119,6 +151,8 @@ bool W25Q::loadRecord(RECORD* config_record) {
 			}
 		}
 	}
+	if (ret)												// Move the configuration to config.kv
+		saveRecord(config_record);
 	umount();
 	return ret;
 }
@@ -126,9 +160,21 @@ bool W25Q::loadRecord(RECORD* config_record) {
 bool W25Q::saveRecord(RECORD* config_record) {
 	if (!mount())
 		return false;
+	CFG_checkSum(config_record, true);
+	if (openKV()) {
+		bool first = !kv.has(KV_CONFIG);
+		if (saveKVRecord(KV_CONFIG, (const void *)config_record, sizeof(RECORD), cfg_version)) {
+			W25Q::close();
+			if (first) {									// The store has the configuration now, remove old files
+				f_unlink(fn_cfg);
+				f_unlink(fn_cfg_backup);
+			}
+			umount();
+			return true;
+		}
+	}
 	W25Q::close();
 	backup(W25Q_CONFIG_CURRENT);
-	CFG_checkSum(config_record, true);
 	bool ret = false;
 	if (FR_OK == f_open(&cfg_f, fn_cfg, FA_CREATE_ALWAYS | FA_WRITE)) {
 		UINT written = 0;
@@ -143,10 +189,23 @@ bool W25Q::saveRecord(RECORD* config_record) {
 bool W25Q::loadPIDparams(PID_PARAMS* pid_params) {
 	if (!mount())
 		return false;
-	W25Q::close();
 	UINT br = 0;
 	bool ret = false;
 	PID_PARAMS tmp_record;
+	if (openKV()) {
+		if (loadKVRecord(KV_PID, (void *)&tmp_record, sizeof(PID_PARAMS), pid_version)) {
+			memcpy((void *)pid_params, (void *)&tmp_record, sizeof(PID_PARAMS));
+			umount();
+			return true;
+		}
+		if (kv.load(&cfg_f, KV_PID, (void *)&tmp_record, sizeof(PID_PARAMS)) && PID_checkSum(&tmp_record, false)) {
+			memcpy((void *)pid_params, (void *)&tmp_record, sizeof(PID_PARAMS));
+			saveKVRecord(KV_PID, (const void *)pid_params, sizeof(PID_PARAMS), pid_version); // The record of the previous format
+			umount();
+			return true;
+		}
+	}
+	W25Q::close();
 	if (FR_OK == f_open(&cfg_f, fn_pid, FA_READ | FA_OPEN_EXISTING)) {
 		f_read(&cfg_f, (void *)&tmp_record, (UINT)sizeof(PID_PARAMS), &br);
 		if (br ==  (UINT)sizeof(PID_PARAMS)) {
@@ -157,6 +216,8 @@ bool W25Q::loadPIDparams(PID_PARAMS* pid_params) {
 		}
 		f_close(&cfg_f);
 	}
+	if (ret)												// Move the PID parameters to config.kv
+		savePIDparams(pid_params);
 	umount();
 	return ret;
 }
@@ -164,12 +225,22 @@ bool W25Q::loadPIDparams(PID_PARAMS* pid_params) {
 bool W25Q::savePIDparams(PID_PARAMS* pid_params) {
 	if (!mount())
 		return false;
-	W25Q::close();
 	PID_checkSum(pid_params, true);
+	if (openKV()) {
+		bool first = !kv.has(KV_PID);
+		if (saveKVRecord(KV_PID, (const void *)pid_params, sizeof(PID_PARAMS), pid_version)) {
+			W25Q::close();
+			if (first)										// The store has the PID parameters now, remove old file
+				f_unlink(fn_pid);
+			umount();
+			return true;
+		}
+	}
+	W25Q::close();
 	bool ret = false;
 	if (FR_OK == f_open(&cfg_f, fn_pid, FA_CREATE_ALWAYS | FA_WRITE)) {
 		UINT written = 0;
-		f_write(&cfg_f, (void *)pid_params, sizeof(RECORD), &written);
+		f_write(&cfg_f, (void *)pid_params, sizeof(PID_PARAMS), &written);
 		ret = (written == sizeof(PID_PARAMS));
 		f_close(&cfg_f);
 	}
@@ -183,79 +254,204 @@ TIP_IO_STATUS W25Q::loadTipData(TIP* tip, uint8_t tip_index, bool keep) {
 		return TIP_IO;
 	if (act_f != W25Q_TIPS_CURRENT) {						// Close other configuration file
 		close();
-		if (FR_OK == f_open(&cfg_f, fn_tip_calib, FA_READ)) {
+		if (openTipFile(fn_tip_calib, sizeof(TIP), FA_READ | FA_WRITE | FA_OPEN_EXISTING)) { // saveTipData() can use the open file
 			act_f = W25Q_TIPS_CURRENT;
 		}
 	}
 	if (act_f != W25Q_TIPS_CURRENT)
 		return returnStatus(keep, TIP_IO);
 
-	if (FR_OK != f_lseek(&cfg_f, tip_index * sizeof(TIP))) { // Invalid tip index
-		return returnStatus(keep, TIP_INDEX);
+	TIP				tmp_tip;
+	TIP_IO_STATUS	status = readTipSlot((void *)&tmp_tip, sizeof(TIP), tip_index);
+	if (status == TIP_OK)									// CRC of the tip record is correct
+		memcpy((void *)tip, (const void *)&tmp_tip, sizeof(TIP)); // Copy the tip record from the data buffer
+	return returnStatus(keep, status);
+}
+
+/*
+ * Read all tip records of tipcal.dat in one pass, check the record CRC and pass the correct records to tipLoaded().
+ * If there is no correct record in the file, the backup file is restored. Returns the number of the records accepted by tipLoaded()
+ */
+uint16_t W25Q::loadTipTable(void) {
+	if (!mount())
+		return 0;
+	W25Q::close();
+	uint16_t applied	= 0;
+	uint16_t good		= scanTips(&applied);
+	if (good == 0) {										// Not tip loaded, try the backup file
+		FILINFO fno;
+		if (FR_OK == f_stat(fn_tip_backup, &fno)) {			// There is the backup file exists
+			f_unlink(fn_tip_calib);
+			f_rename(fn_tip_backup, fn_tip_calib);
+			scanTips(&applied);
+		}
 	}
-	// Read tip calibration data
-	UINT	br = 0;
-	TIP		tmp_tip;
-	f_read(&cfg_f, (void *)&tmp_tip, (UINT)sizeof(TIP), &br);
-	if (br == (UINT)sizeof(TIP)) {
-		if (TIP_checkSum(&tmp_tip, false)) {				// CRC of the tip record is correct
-			memcpy((void *)tip, (const void *)&tmp_tip, sizeof(TIP)); // Copy the tip record from the data buffer
-			return returnStatus(keep, TIP_OK);
+	umount();
+	return applied;
+}
+
+/*
+ * Read tipcal.dat by sector size chunks into the disk cache buffer. The chunk size is a multiple of the record slot size.
+ * Returns the number of the records with correct CRC
+ */
+uint16_t W25Q::scanTips(uint16_t *applied) {
+	*applied = 0;
+	if (!openTipFile(fn_tip_calib, sizeof(TIP), FA_READ | FA_OPEN_EXISTING))
+		return 0;
+	uint16_t good = 0;
+	BYTE *buff = disk_buffer_acquire(fs_drive);				// The chunk buffer
+	if (buff != 0) {
+		UINT	slot	= tipSlot(sizeof(TIP));
+		int16_t	index	= -1;								// The record index in the file, the first slot is the header
+		f_lseek(&cfg_f, 0);
+		while (index < NO_TIP_CHUNK) {						// The tip index is 8-bits value, NO_TIP_CHUNK means no record
+			UINT br = 0;
+			if (FR_OK != f_read(&cfg_f, buff, blk_size, &br))
+				break;
+			for (UINT p = 0; p + slot <= br && index < NO_TIP_CHUNK; p += slot, ++index) {
+				if (index >= 0 && validSlot(&buff[p], slot)) {	// CRC of the tip record is correct
+					++good;
+					if (tipLoaded((TIP *)&buff[p], index))
+						++*applied;
+				}
+			}
+			if (br < blk_size)								// File is over
+				break;
 		}
-		return returnStatus(keep, TIP_CHECKSUM);
+		disk_buffer_release(fs_drive, buff);
 	}
-	return returnStatus(keep, TIP_IO);
+	f_close(&cfg_f);
+	return good;
 }
 
-// Return tip index in the file or -1 if error
-int16_t W25Q::saveTipData(TIP* tip, bool keep) {
+/*
+ * Read tipfp.dat by sector size chunks into the disk cache buffer and pass the records with correct CRC to fprintLoaded().
+ * The chunk size is a multiple of the record slot size. Returns the number of the correct records
+ */
+uint16_t W25Q::scanTipFprints(void) {
 	if (!mount())
-		return -1;
-	bool new_entry = false;
-	if (act_f == W25Q_TIPS_CURRENT) {						// The tip configuration file is already opened
-		f_lseek(&cfg_f, 0);									// Rewind to the top of the file
-	} else {
-		W25Q::close();
-		backup(W25Q_TIPS_CURRENT);
-		if (FR_OK != f_open(&cfg_f, fn_tip_calib, FA_WRITE | FA_READ | FA_OPEN_EXISTING)) {
-			if (FR_OK == f_open(&cfg_f, fn_tip_calib, FA_CREATE_NEW | FA_WRITE)) {
-				new_entry = true;
-			} else {
-				return -1;
+		return 0;
+	W25Q::close();
+	uint16_t good = 0;
+	if (openTipFile(fn_tip_fprint, sizeof(TIP_FPRINT), FA_READ | FA_OPEN_EXISTING)) {
+		BYTE *buff = disk_buffer_acquire(fs_drive);			// The chunk buffer
+		if (buff != 0) {
+			UINT	slot	= tipSlot(sizeof(TIP_FPRINT));
+			int16_t	index	= -1;							// The record index in the file, the same as in tipcal.dat
+			f_lseek(&cfg_f, 0);
+			while (index < NO_TIP_CHUNK) {
+				UINT br = 0;
+				if (FR_OK != f_read(&cfg_f, buff, blk_size, &br))
+					break;
+				for (UINT p = 0; p + slot <= br && index < NO_TIP_CHUNK; p += slot, ++index) {
+					if (index >= 0 && validSlot(&buff[p], slot)) {
+						++good;
+						fprintLoaded((TIP_FPRINT *)&buff[p], index);
+					}
+				}
+				if (br < blk_size)							// File is over
+					break;
 			}
-
+			disk_buffer_release(fs_drive, buff);
 		}
+		f_close(&cfg_f);
+	}
+	umount();
+	return good;
+}
+
+/*
+ * Save the tip record at the tip_index position in tipcal.dat, so only one sector of the file is updated.
+ * tip_index is NO_TIP_CHUNK for the tip that is not in the file yet, the record is appended.
+ * If tip_index is negative or the record at the position belongs to other tip, the tip is looked up in the file.
+ * Return tip index in the file or -1 if error
+ */
+int16_t W25Q::saveTipData(TIP* tip, bool keep, int16_t tip_index) {
+	if (!mount())
+		return -1;
+	if (act_f != W25Q_TIPS_CURRENT) {						// The tip configuration file is not opened yet
+		W25Q::close();
+		if (!FTL_Active())									// The sector is not updated atomically, keep the copy of the file
+			backup(W25Q_TIPS_CURRENT);
+		if (!openTipFile(fn_tip_calib, sizeof(TIP), FA_WRITE | FA_READ | FA_OPEN_ALWAYS))
+			return -1;
 		act_f = W25Q_TIPS_CURRENT;
 	}
-	if (!new_entry) {										// Try to locate our tip in the file
-		UINT	br = 0;										// Bytes actually read from the file
-		TIP		tmp_tip;
-		while(true) {										// Looking for the tip
-			f_read(&cfg_f, (void *)&tmp_tip, (UINT)sizeof(TIP), &br);
-			if (br == (UINT)sizeof(TIP)) {
-				if (tip->name.match(tmp_tip.name)) {
-					f_lseek(&cfg_f, cfg_f.fptr-sizeof(TIP));
-					break;
-				}
-			} else {										// Tip not calibrated
+	uint16_t records = f_size(&cfg_f) / tipSlot(sizeof(TIP)) - 1;	// The first slot is the file header
+	if (tip_index == NO_TIP_CHUNK) {						// New tip, append the record
+		tip_index = records;
+	} else if (tip_index >= records) {						// The file would be expanded, look up the tip
+		tip_index = -1;
+	} else if (tip_index >= 0) {							// Check the tip record at the known position
+		TIP tmp_tip;
+		if (TIP_IO == readTipSlot((void *)&tmp_tip, sizeof(TIP), tip_index) || !tip->name.match(tmp_tip.name))
+			tip_index = -1;									// The file has been changed, look up the tip
+	}
+	if (tip_index < 0) {									// The tip position is unknown, try to locate our tip in the file
+		TIP tmp_tip;
+		for (tip_index = 0; tip_index < records; ++tip_index) {
+			if (TIP_IO == readTipSlot((void *)&tmp_tip, sizeof(TIP), tip_index) || tip->name.match(tmp_tip.name))
 				break;
-			}
 		}
 	}
 	// Update or add new tip information
-	int16_t tip_index = cfg_f.fptr / sizeof(TIP);
-	TIP_checkSum(tip, true);								// calculate CRC inside the data buffer
-	UINT	written = 0;
-	f_write(&cfg_f, (void *)tip, sizeof(TIP), &written);
-	if (written != sizeof(TIP))
+	if (tip_index >= NO_TIP_CHUNK) {						// The tip index does not fit the tip table
 		tip_index = -1;
+	} else if (!writeTipSlot((const void *)tip, sizeof(TIP), tip_index)) {
+		tip_index = -1;
+	}
 	if (!keep) {
-		f_close(&cfg_f);									// Close file for sure
+		W25Q::close();										// Close file for sure
 		W25Q::umount();
 	}
 	return tip_index;
 }
 
+// Load complete tip calibration data from file. The record index is the same as the tip index in tipcal.dat
+bool W25Q::loadTipCurve(TIP_CURVE* curve, uint8_t tip_index) {
+	TIP_CURVE tmp_curve;
+	if (!loadTipRecord(fn_tip_curve, (void *)&tmp_curve, (UINT)sizeof(TIP_CURVE), tip_index))
+		return false;
+	if (tmp_curve.version != TIP_CURVE_VERSION)
+		return false;
+	memcpy((void *)curve, (const void *)&tmp_curve, sizeof(TIP_CURVE));
+	return true;
+}
+
+// Save complete tip calibration data to the file. The record index is the same as the tip index in tipcal.dat
+bool W25Q::saveTipCurve(TIP_CURVE* curve, uint8_t tip_index) {
+	curve->version = TIP_CURVE_VERSION;
+	return saveTipRecord(fn_tip_curve, (void *)curve, (UINT)sizeof(TIP_CURVE), tip_index);
+}
+
+// Load the tip specific PID parameters from file. The record index is the same as the tip index in tipcal.dat
+bool W25Q::loadTipPIDparams(TIP_PID* tip_pid, uint8_t tip_index) {
+	TIP_PID tmp_pid;
+	if (!loadTipRecord(fn_tip_pid, (void *)&tmp_pid, (UINT)sizeof(TIP_PID), tip_index))
+		return false;
+	memcpy((void *)tip_pid, (const void *)&tmp_pid, sizeof(TIP_PID));
+	return true;
+}
+
+// Save the tip specific PID parameters to the file. The record index is the same as the tip index in tipcal.dat
+bool W25Q::saveTipPIDparams(TIP_PID* tip_pid, uint8_t tip_index) {
+	return saveTipRecord(fn_tip_pid, (void *)tip_pid, (UINT)sizeof(TIP_PID), tip_index);
+}
+
+// Load the tip fingerprint from file. The record index is the same as the tip index in tipcal.dat
+bool W25Q::loadTipFprint(TIP_FPRINT* fprint, uint8_t tip_index) {
+	TIP_FPRINT tmp_fprint;
+	if (!loadTipRecord(fn_tip_fprint, (void *)&tmp_fprint, (UINT)sizeof(TIP_FPRINT), tip_index))
+		return false;
+	memcpy((void *)fprint, (const void *)&tmp_fprint, sizeof(TIP_FPRINT));
+	return true;
+}
+
+// Save the tip fingerprint to the file. The record index is the same as the tip index in tipcal.dat
+bool W25Q::saveTipFprint(TIP_FPRINT* fprint, uint8_t tip_index) {
+	return saveTipRecord(fn_tip_fprint, (void *)fprint, (UINT)sizeof(TIP_FPRINT), tip_index);
+}
+
 bool W25Q::formatFlashDrive(void) {
 	MKFS_PARM p;
 	p.fmt		= FM_FAT | FM_SFD;							// No partition table
@@ -264,26 +460,140 @@ bool W25Q::formatFlashDrive(void) {
 	p.n_fat		= 1;										// Number of FAT copies
 	p.n_root	= 128;										// 32 bytes per entry, 4096 bytes, 1 sector!
 
-	uint8_t *buff = (uint8_t *)malloc(blk_size);
+	if (!fsmount.lock())
+		return false;
+	kv.reset();
+	bool ret = false;
+	if (FTL_Format()) {										// Wear leveling, the logical sectors remapped
+		BYTE *buff = disk_buffer_acquire(fs_drive);			// f_mkfs() work area
+		if (buff) {
+			ret = (FR_OK == f_mkfs("0:/", &p, buff, blk_size));
+			disk_buffer_release(fs_drive, buff);
+		}
+	}
+	fsmount.unlock();
+	fsmount.invalidate();									// Read new file system on next mount
+	return ret;
+}
+
+/*
+ * Walk through the FAT and trim the free clusters. The clusters released by the previous firmware version
+ * or by the USB host are erased in background then, see FTL_Poll()
+ */
+bool W25Q::trimFree(void) {
+	FATFS *fs = fsmount.fs();
+	if (fs->fs_type != FS_FAT12 && fs->fs_type != FS_FAT16 && fs->fs_type != FS_FAT32)
+		return false;
+	BYTE *buff = disk_buffer_acquire(fs->pdrv);				// FAT sector buffer
 	if (buff == 0)
 		return false;
-	bool ret = (FR_OK == f_mkfs("0:/", &p, buff, blk_size));
-	free(buff);
+	LBA_t	loaded	= (LBA_t)-1;							// FAT sector in the buffer
+	DWORD	run		= 0;									// The first free cluster of the run
+	bool	ret		= true;
+	for (DWORD clst = 2; clst <= fs->n_fatent; ++clst) {
+		bool free_clst = false;
+		if (clst < fs->n_fatent) {
+			DWORD entry = 0;
+			if (!fatEntry(fs, clst, buff, &loaded, &entry)) {
+				ret = false;
+				break;
+			}
+			free_clst = (entry == 0);
+		}
+		if (free_clst && run == 0) {
+			run = clst;
+		} else if (!free_clst && run != 0) {
+			LBA_t lba[2] = { fs->database + (run - 2) * fs->csize, fs->database + (clst - 2) * fs->csize - 1 };
+			disk_ioctl(fs->pdrv, CTRL_TRIM, lba);
+			run = 0;
+		}
+	}
+	disk_buffer_release(fs->pdrv, buff);
+	disk_ioctl(fs->pdrv, CTRL_SYNC, 0);						// Release the trimmed sectors
+	return ret;
+}
+
+/*
+ * Activate the flash translation layer on the flash drive formatted by the previous firmware version keeping the files.
+ * The volume shrinks by the FTL table and spare sectors, so the clusters at the end of the volume should be free.
+ * Otherwise the FTL remains inactive (see wearLeveling()) until the files are moved: copy them to the computer,
+ * remove them from the flash drive, restart the controller and copy the files back.
+ * Returns true if the volume has been changed and should be mounted again
+ */
+bool W25Q::migrateFTL(void) {
+	FATFS	*fs		= fsmount.fs();
+	LBA_t	sectors	= FTL_MigrateSectors();
+	if (FTL_Active() || sectors == 0 || (fs->fs_type != FS_FAT12 && fs->fs_type != FS_FAT16) || fs->volbase != 0)
+		return false;
+	if (fs->database + fs->csize > sectors)					// No data cluster in the shrunk volume
+		return false;
+	BYTE *buff = disk_buffer_acquire(fs->pdrv);				// FAT sector buffer, then the FTL work area
+	if (buff == 0)
+		return false;
+	LBA_t	loaded	= (LBA_t)-1;
+	bool	ret		= true;
+	for (DWORD clst = 2; clst < fs->n_fatent && ret; ++clst) {
+		if (fs->database + (clst - 1) * fs->csize <= sectors)	// The cluster remains in the volume
+			continue;
+		DWORD entry = 0;
+		ret = fatEntry(fs, clst, buff, &loaded, &entry) && entry == 0;
+	}
+	if (ret)
+		ret = FTL_Migrate(buff);
+	if (ret)
+		fsmount.written();									// The USB host should read new volume size
+	disk_buffer_release(fs->pdrv, buff);
 	return ret;
 }
 
+// Read the FAT entry of the cluster. The FAT sector is read into the buffer unless it has been loaded already
+bool W25Q::fatEntry(FATFS* fs, DWORD clst, BYTE* buff, LBA_t* loaded, DWORD* entry) {
+	DWORD	offset	= (fs->fs_type == FS_FAT12)?(clst + clst / 2):(clst << (fs->fs_type == FS_FAT16?1:2));
+	uint8_t	size	= (fs->fs_type == FS_FAT32)?4:2;
+	*entry = 0;
+	for (uint8_t i = 0; i < size; ++i, ++offset) {			// FAT12 entry can be split between two sectors
+		LBA_t sect = fs->fatbase + offset / blk_size;
+		if (sect != *loaded) {
+			if (RES_OK != disk_read(fs->pdrv, buff, sect, 1))
+				return false;
+			*loaded = sect;
+		}
+		*entry |= (DWORD)buff[offset % blk_size] << (i * 8);
+	}
+	if (fs->fs_type == FS_FAT12)
+		*entry = (clst & 1)?(*entry >> 4):(*entry & 0xFFF);
+	else if (fs->fs_type == FS_FAT32)
+		*entry &= 0x0FFFFFFF;
+	return true;
+}
+
+bool W25Q::wearLeveling(void) {
+	return FTL_Active();
+}
+
+// The config.kv record changes the data sector, the directory entry sector and the FAT sector
+bool W25Q::writeReady(void) {
+	return FTL_Ready(3);
+}
+
 bool W25Q::clearTips(void) {
 	if (!mount())
 		return false;
 	f_unlink(fn_tip_calib);
 	f_unlink(fn_tip_backup);
+	f_unlink(fn_tip_curve);
+	f_unlink(fn_tip_pid);
+	f_unlink(fn_tip_fprint);
 	umount();
 	return true;
 }
 
 // Remove configuration files
 bool W25Q::clearConfig(void) {
-	if (FR_OK == f_mount(&fs, "0:/", 1)) {
+	if (mount()) {
+		if (openKV())
+			kv.erase(&cfg_f, KV_CONFIG);
+		W25Q::close();
 		f_unlink(fn_cfg);
 		f_unlink(fn_cfg_backup);
 		umount();
@@ -295,8 +605,12 @@ bool W25Q::clearConfig(void) {
 bool W25Q::canDelete(const TCHAR *file_name) {
 	if (strcmp(file_name, fn_tip_calib) == 0)	return false;
 	if (strcmp(file_name, fn_tip_backup) == 0)	return false;
+	if (strcmp(file_name, fn_tip_curve) == 0)	return false;
+	if (strcmp(file_name, fn_tip_pid) == 0)		return false;
+	if (strcmp(file_name, fn_tip_fprint) == 0)	return false;
 	if (strcmp(file_name, fn_cfg) == 0)			return false;
 	if (strcmp(file_name, fn_cfg_backup) == 0)	return false;
+	if (strcmp(file_name, fn_kv) == 0)			return false;
 	return true;
 }
 
@@ -331,7 +645,7 @@ uint8_t W25Q::tipListReadNextItem(const char data[], uint8_t size) {
 		uint8_t d;
 		UINT	br1= 0;
 		while(true) {										// Read file until the end or end of line
-			f_read(&cfg_f, (void *)&d, (UINT)size, &br1);
+			f_read(&cfg_f, (void *)&d, 1, &br1);
 			if (br1 > 0) {
 				if (d == '\n') break;
 			} else {										// End of file
@@ -347,6 +661,158 @@ void W25Q::tipListEnd(void) {
 	umount();
 }
 
+/*
+ * Check tipindex.bin and read the tip catalogue from it by pages, see TIPS::attach().
+ * The index is valid if it was built from the tip_list.txt of the same size and checksum.
+ * The file time is not checked: the firmware has no real time clock, see FF_FS_NORTC.
+ * The file is: the header, the tip names in tip_list.txt order and the tip names sorted with their indexes (TIP_KEY).
+ * Returns false if the index is missing, outdated or damaged, the tip list should be parsed from tip_list.txt then
+ */
+bool W25Q::loadTipIndex(TIPS& tips) {
+	if (!mount())
+		return false;
+	close();
+	bool		ok = false;
+	uint32_t	src_size = 0;
+	uint32_t	src_crc	 = 0;
+	TIP_INDEX_HDR	hdr;
+	if (tipListCheckSum(&src_size, &src_crc) && FR_OK == f_open(&cfg_f, fn_tip_index, FA_READ)) {
+		act_f = W25Q_TIP_INDEX;
+		UINT br = 0;
+		if (FR_OK == f_read(&cfg_f, &hdr, sizeof(hdr), &br) && br == sizeof(hdr) && hdr.magic == tip_index_magic &&
+				hdr.src_size == src_size && hdr.src_crc == src_crc && hdr.count > 0 &&
+				f_size(&cfg_f) == sizeof(hdr) + hdr.count * (sizeof(RADIX) + sizeof(TIP_KEY))) {
+			BYTE *buff = disk_buffer_acquire(fs_drive);		// The chunk buffer
+			if (buff) {
+				crc32Start();
+				while (FR_OK == f_read(&cfg_f, buff, blk_size, &br)) {
+					if (br == 0) {							// End of file
+						ok = (crc32Value() == hdr.crc);
+						break;
+					}
+					crc32Update(buff, br);
+				}
+				disk_buffer_release(fs_drive, buff);
+			}
+		}
+	}
+	close();
+	if (ok) {
+		if (idx_open)										// Forget the previous catalogue file
+			f_close(&idx_f);
+		idx_open	= false;
+		idx_count	= hdr.count;
+		ok = tips.attach(this, hdr.count);
+	}
+	umount();
+	return ok;
+}
+
+// Save the tip catalogue built in RAM to tipindex.bin, should be called right after tip_list.txt has been parsed
+bool W25Q::saveTipIndex(TIPS& tips) {
+	if (tips.total() == 0 || !tips.names() || !tips.keys())
+		return false;
+	if (!mount())
+		return false;
+	close();
+	if (idx_open) {											// The file is rewritten
+		f_close(&idx_f);
+		idx_open = false;
+	}
+	bool		ok = false;
+	uint32_t	src_size = 0;
+	uint32_t	src_crc	 = 0;
+	if (tipListCheckSum(&src_size, &src_crc) && FR_OK == f_open(&cfg_f, fn_tip_index, FA_CREATE_ALWAYS | FA_WRITE)) {
+		act_f = W25Q_TIP_INDEX;
+		UINT n_size = tips.total() * sizeof(RADIX);
+		UINT k_size = tips.total() * sizeof(TIP_KEY);
+		TIP_INDEX_HDR	hdr;
+		hdr.magic		= tip_index_magic;
+		hdr.src_size	= src_size;
+		hdr.src_crc		= src_crc;
+		hdr.count		= tips.total();
+		crc32Start();
+		crc32Update(tips.names(), n_size);
+		crc32Update(tips.keys(), k_size);
+		hdr.crc			= crc32Value();
+		hdr.reserved	= 0;
+		UINT bw = 0, bw1 = 0, bw2 = 0;
+		ok = (FR_OK == f_write(&cfg_f, &hdr, sizeof(hdr), &bw) && bw == sizeof(hdr) &&
+				FR_OK == f_write(&cfg_f, tips.names(), n_size, &bw1) && bw1 == n_size &&
+				FR_OK == f_write(&cfg_f, tips.keys(), k_size, &bw2) && bw2 == k_size);
+		close();
+		if (!ok)
+			f_unlink(fn_tip_index);
+	}
+	umount();
+	return ok;
+}
+
+// TIP_STORE: read the tip names of the catalogue in tip_list.txt order
+bool W25Q::readTipNames(uint16_t first, RADIX names[], uint16_t count) {
+	if (first + count > idx_count)
+		return false;
+	return readTipIndex(sizeof(TIP_INDEX_HDR) + first * sizeof(RADIX), names, count * sizeof(RADIX));
+}
+
+// TIP_STORE: read the tip names of the catalogue sorted by the tip name
+bool W25Q::readTipKeys(uint16_t first, TIP_KEY keys[], uint16_t count) {
+	if (first + count > idx_count)
+		return false;
+	return readTipIndex(sizeof(TIP_INDEX_HDR) + idx_count * sizeof(RADIX) + first * sizeof(TIP_KEY), keys, count * sizeof(TIP_KEY));
+}
+
+/*
+ * Read the data from tipindex.bin. The file is kept open by its own file object, so the other files are not closed.
+ * If the volume has been mounted again (changed by the USB host), the file is opened again
+ */
+bool W25Q::readTipIndex(uint32_t pos, void* buff, UINT size) {
+	bool was_mounted = (act_f != W25Q_NOT_MOUNTED);
+	if (!mount())
+		return false;
+	bool ok = false;
+	for (uint8_t attempt = 0; attempt < 2 && !ok; ++attempt) {
+		if (!idx_open || attempt > 0) {
+			if (idx_open)
+				f_close(&idx_f);
+			idx_open = (FR_OK == f_open(&idx_f, fn_tip_index, FA_READ));
+			if (!idx_open)
+				break;
+		}
+		UINT br = 0;
+		ok = (FR_OK == f_lseek(&idx_f, pos) && FR_OK == f_read(&idx_f, buff, size, &br) && br == size);
+	}
+	if (!was_mounted)
+		umount();
+	return ok;
+}
+
+// Read tip_list.txt sequentially by sector size chunks and calculate its CRC. The file system should be mounted
+bool W25Q::tipListCheckSum(uint32_t *size, uint32_t *crc) {
+	BYTE *buff = disk_buffer_acquire(fs_drive);				// The chunk buffer
+	if (buff == 0)
+		return false;
+	bool ok = false;
+	if (FR_OK == f_open(&cfg_f, fn_tip_list, FA_READ)) {
+		*size	= f_size(&cfg_f);
+		crc32Start();
+		while (true) {
+			UINT br = 0;
+			if (FR_OK != f_read(&cfg_f, buff, blk_size, &br))
+				break;
+			if (br == 0) {									// End of file
+				*crc	= crc32Value();
+				ok		= true;
+				break;
+			}
+			crc32Update(buff, br);
+		}
+		f_close(&cfg_f);
+	}
+	disk_buffer_release(fs_drive, buff);
+	return ok;
+}
+
 const TCHAR*	W25Q::fileName(uint8_t index) {
 	switch (index) {
 		case 0:
@@ -359,6 +825,14 @@ const TCHAR*	W25Q::fileName(uint8_t index) {
 			return fn_cfg_backup;
 		case 4:
 			return fn_pid;
+		case 5:
+			return fn_tip_curve;
+		case 6:
+			return fn_tip_pid;
+		case 7:
+			return fn_tip_fprint;
+		case 8:
+			return fn_kv;
 		default:
 			return 0;
 	}
@@ -373,6 +847,197 @@ TIP_IO_STATUS W25Q::returnStatus(bool keep, TIP_IO_STATUS ret_code) {
 	return ret_code;
 }
 
+// Read the tip record of the additional tip data file (tipcurve.dat, tippid.dat, tipfp.dat), check the record CRC
+bool W25Q::loadTipRecord(const TCHAR* fn, void* record, UINT size, uint8_t tip_index) {
+	if (!mount())
+		return false;
+	W25Q::close();
+	bool ret = false;
+	if (openTipFile(fn, size, FA_READ | FA_OPEN_EXISTING)) {
+		ret = (TIP_OK == readTipSlot(record, size, tip_index));
+		f_close(&cfg_f);
+	}
+	umount();
+	return ret;
+}
+
+// Write the tip record to the additional tip data file (tipcurve.dat, tippid.dat, tipfp.dat)
+bool W25Q::saveTipRecord(const TCHAR* fn, void* record, UINT size, uint8_t tip_index) {
+	if (!mount())
+		return false;
+	W25Q::close();
+	bool ret = false;
+	if (openTipFile(fn, size, FA_WRITE | FA_READ | FA_OPEN_ALWAYS)) {
+		ret = writeTipSlot(record, size, tip_index);
+		ret = (FR_OK == f_close(&cfg_f)) && ret;
+	}
+	umount();
+	return ret;
+}
+
+// The record slot size in the tip data file: the power of two, so every record is kept in one flash sector
+UINT W25Q::tipSlot(UINT size) {
+	UINT slot = sizeof(TIP_FILE_HDR);
+	while (slot < size + sizeof(uint32_t))					// The record and CRC-32
+		slot <<= 1;
+	return slot;
+}
+
+// Build the header slot of the tip data file with the record of given size
+void W25Q::tipFileHeader(BYTE slot[], UINT size) {
+	TIP_FILE_HDR hdr;
+	memset(slot, 0, tipSlot(size));
+	hdr.magic		= tip_file_magic;
+	hdr.version		= tip_file_version;
+	hdr.size		= size;
+	hdr.slot		= tipSlot(size);
+	hdr.reserved	= 0;
+	hdr.crc			= crc32(&hdr, offsetof(TIP_FILE_HDR, crc));
+	memcpy(slot, &hdr, sizeof(hdr));
+}
+
+/*
+ * Open the tip data file into cfg_f and check the file header: the magic, the format version and the record size.
+ * The empty file opened for writing gets the header. The file of the previous format (no header) is converted first,
+ * see upgradeTipFile(). The file of unknown format is not changed
+ */
+bool W25Q::openTipFile(const TCHAR* fn, UINT size, BYTE mode) {
+	FILINFO fno;
+	if (FR_NO_FILE == f_stat(fn, &fno))
+		upgradeTipFile(fn, size);							// Complete the conversion interrupted by the power loss
+	UINT slot = tipSlot(size);
+	for (uint8_t i = 0; i < 2; ++i) {
+		if (FR_OK != f_open(&cfg_f, fn, mode))
+			return false;
+		if (f_size(&cfg_f) == 0 && (mode & FA_WRITE)) {	// New file
+			uint32_t	data[tip_slot_max / sizeof(uint32_t)];
+			UINT		written	= 0;
+			tipFileHeader((BYTE *)data, size);
+			if (FR_OK == f_write(&cfg_f, data, slot, &written) && written == slot)
+				return true;
+			f_close(&cfg_f);
+			return false;
+		}
+		TIP_FILE_HDR	hdr;
+		UINT			br = 0;
+		f_read(&cfg_f, &hdr, sizeof(hdr), &br);
+		if (br == sizeof(hdr) && hdr.magic == tip_file_magic && hdr.crc == crc32(&hdr, offsetof(TIP_FILE_HDR, crc))) {
+			if (hdr.version == tip_file_version && hdr.size == size && hdr.slot == slot)
+				return true;
+			f_close(&cfg_f);								// Unknown format, keep the file
+			return false;
+		}
+		f_close(&cfg_f);
+		if (i > 0 || !upgradeTipFile(fn, size))
+			return false;
+	}
+	return false;
+}
+
+/*
+ * Convert the tip data file of the previous format: the records of the same size without the file header,
+ * checked by 8-bits checksum. The correct records are written into the temporary file (.tmp) keeping their index,
+ * the other records become empty. Then the old file is replaced; if the power is lost before the temporary file
+ * is renamed, the conversion is completed when the file is opened next time. cfg_f should be closed
+ */
+bool W25Q::upgradeTipFile(const TCHAR* fn, UINT size) {
+	TCHAR tmp[13];											// 8.3 name of the temporary file
+	uint8_t n = 0;
+	for ( ; fn[n] && fn[n] != '.' && n < 8; ++n)
+		tmp[n] = fn[n];
+	strcpy(&tmp[n], ".tmp");
+	FIL in_f;
+	if (FR_OK != f_open(&in_f, fn, FA_READ | FA_OPEN_EXISTING))
+		return (FR_OK == f_rename(tmp, fn));				// The old file has been removed already
+	if (FR_OK != f_open(&cfg_f, tmp, FA_CREATE_ALWAYS | FA_WRITE | FA_READ)) {
+		f_close(&in_f);
+		return false;
+	}
+	UINT		slot	= tipSlot(size);
+	uint32_t	data[tip_slot_max / sizeof(uint32_t)];
+	UINT		written	= 0;
+	tipFileHeader((BYTE *)data, size);
+	bool ok = (FR_OK == f_write(&cfg_f, data, slot, &written)) && written == slot;
+	for (uint8_t index = 0; ok && index < NO_TIP_CHUNK; ++index) {
+		UINT br = 0;
+		if (FR_OK != f_read(&in_f, data, size, &br) || br < size)
+			break;
+		if (oldTipRecord(fn, data))
+			ok = writeTipSlot(data, size, index);
+	}
+	f_close(&in_f);
+	ok = (FR_OK == f_close(&cfg_f)) && ok;
+	if (!ok) {
+		f_unlink(tmp);
+		return false;
+	}
+	return (FR_OK == f_unlink(fn) && FR_OK == f_rename(tmp, fn));
+}
+
+// Check the record of the previous format tip data file by its 8-bits checksum, see upgradeTipFile()
+bool W25Q::oldTipRecord(const TCHAR* fn, void* record) {
+	if (fn == fn_tip_calib)
+		return TIP_checkSum((TIP *)record, false);
+	if (fn == fn_tip_curve)
+		return ((TIP_CURVE *)record)->version == TIP_CURVE_VERSION && CURVE_checkSum((TIP_CURVE *)record, false);
+	if (fn == fn_tip_pid)
+		return TPID_checkSum((TIP_PID *)record, false);
+	if (fn == fn_tip_fprint)
+		return FPRINT_checkSum((TIP_FPRINT *)record, false);
+	return false;
+}
+
+// Check CRC-32 at the end of the record slot
+bool W25Q::validSlot(const BYTE slot[], UINT slot_size) {
+	uint32_t crc;
+	memcpy(&crc, &slot[slot_size - sizeof(crc)], sizeof(crc));
+	return (crc == crc32(slot, slot_size - sizeof(crc)));
+}
+
+/*
+ * Read the record from the tip data file opened in cfg_f, see openTipFile(). The record is copied even if its CRC
+ * is wrong, so the tip name can be checked. Returns TIP_IO if the record is beyond the end of file
+ */
+TIP_IO_STATUS W25Q::readTipSlot(void* record, UINT size, uint8_t tip_index) {
+	UINT		slot	= tipSlot(size);
+	FSIZE_t		pos		= (FSIZE_t)(tip_index + 1) * slot;	// The first slot is the file header
+	uint32_t	data[tip_slot_max / sizeof(uint32_t)];
+	if (pos + slot > f_size(&cfg_f))						// f_lseek() would expand the file opened for writing
+		return TIP_IO;
+	if (FR_OK != f_lseek(&cfg_f, pos))
+		return TIP_INDEX;
+	UINT br = 0;
+	if (FR_OK != f_read(&cfg_f, data, slot, &br) || br != slot)
+		return TIP_IO;
+	memcpy(record, data, size);
+	return validSlot((const BYTE *)data, slot)?TIP_OK:TIP_CHECKSUM;
+}
+
+/*
+ * Write the record with its CRC-32 to the tip data file opened in cfg_f. If the record is beyond the end of file,
+ * the gap is filled by the empty slots (zeros, wrong CRC): the file expanded by f_lseek() would keep the stale data
+ * of the free clusters, that could be read as the valid records of other tips
+ */
+bool W25Q::writeTipSlot(const void* record, UINT size, uint8_t tip_index) {
+	UINT		slot	= tipSlot(size);
+	FSIZE_t		pos		= (FSIZE_t)(tip_index + 1) * slot;	// The first slot is the file header
+	uint32_t	data[tip_slot_max / sizeof(uint32_t)];
+	memset(data, 0, slot);
+	bool ok = (FR_OK == f_lseek(&cfg_f, f_size(&cfg_f)));
+	while (ok && f_tell(&cfg_f) < pos) {
+		UINT n			= (pos - f_tell(&cfg_f) < slot)?(UINT)(pos - f_tell(&cfg_f)):slot;
+		UINT written	= 0;
+		ok = (FR_OK == f_write(&cfg_f, data, n, &written)) && written == n;
+	}
+	if (!ok || FR_OK != f_lseek(&cfg_f, pos))
+		return false;
+	memcpy(data, record, size);
+	uint32_t crc = crc32(data, slot - sizeof(crc));
+	memcpy((BYTE *)data + slot - sizeof(crc), &crc, sizeof(crc));
+	UINT written = 0;
+	return (FR_OK == f_write(&cfg_f, data, slot, &written)) && written == slot;
+}
+
 // Checks the CRC inside tip structure. Returns true if OK, replaces the CRC with the correct value
 uint8_t W25Q::TIP_checkSum(TIP* tip, bool write) {
 	uint32_t summ = tip->t200;
@@ -387,6 +1052,45 @@ uint8_t W25Q::TIP_checkSum(TIP* tip, bool write) {
 	return res;
 }
 
+// Checks the CRC of the TIP_CURVE structure. Returns true if OK. Replace the CRC with the correct value if write is true
+uint8_t W25Q::CURVE_checkSum(TIP_CURVE* curve, bool write) {
+	uint16_t	summ		= 117;							// To avoid good check sum with all-zero, start with 117
+	uint8_t		rec_summ	= curve->crc;
+	curve->crc				= 0;
+	uint8_t*	d			= (uint8_t*)curve;
+	for (uint8_t i = 0; i < sizeof(TIP_CURVE); ++i) {
+		summ <<= 1; summ += d[i];
+	}
+	summ = (summ >> 8) ^ (summ & 0xFF);
+	bool res = (rec_summ == summ);
+	curve->crc = write?summ:rec_summ;
+	return res;
+}
+
+// Checks the CRC of the TIP_PID structure. Returns true if OK. Replace the CRC with the correct value if write is true
+uint8_t W25Q::TPID_checkSum(TIP_PID* tip_pid, bool write) {
+	uint32_t summ = tip_pid->name.word32();
+	summ <<= 1; summ += tip_pid->Kp;
+	summ <<= 1; summ += tip_pid->Ki;
+	summ <<= 1; summ += tip_pid->Kd;
+	summ += 117;											// To avoid good check sum with all-zero
+	uint8_t res = (tip_pid->crc == (summ & 0xFF));
+	if (write) tip_pid->crc = summ & 0xFF;
+	return res;
+}
+
+// Checks the CRC of the TIP_FPRINT structure. Returns true if OK. Replace the CRC with the correct value if write is true
+uint8_t W25Q::FPRINT_checkSum(TIP_FPRINT* fprint, bool write) {
+	uint32_t summ = fprint->name.word32();
+	summ <<= 1; summ += fprint->rise;
+	summ <<= 1; summ += fprint->current;
+	summ <<= 1; summ += fprint->samples;
+	summ += 117;											// To avoid good check sum with all-zero
+	uint8_t res = (fprint->crc == (summ & 0xFF));
+	if (write) fprint->crc = summ & 0xFF;
+	return res;
+}
+
 // Checks the CRC of the RECORD structure. Returns true if OK. Replace the CRC with the correct value if write is true
 uint8_t W25Q::CFG_checkSum(RECORD* cfg, bool write) {
 	uint16_t 	summ 		= 117;							// To avoid good check sum with all-zero, start with 117
@@ -415,6 +1119,49 @@ uint8_t W25Q::PID_checkSum(PID_PARAMS* pid_params, bool write) {
 	return res;
 }
 
+/*
+ * Load the record of the key from config.kv. The record is the header (REC_HDR) and the data.
+ * Returns false if the record is missing, has another format version or wrong CRC. The store should be opened.
+ * The records fit the store record size (255 bytes), it is checked at compile time, see REC_HDR
+ */
+bool W25Q::loadKVRecord(uint8_t key, void* data, uint8_t size, uint16_t version) {
+	uint32_t	buff[64];									// Word aligned buffer for the header
+	REC_HDR*	hdr = (REC_HDR *)buff;
+	uint8_t*	d	= (uint8_t *)buff + sizeof(REC_HDR);
+	if (!kv.load(&cfg_f, key, buff, sizeof(REC_HDR) + size))
+		return false;
+	if (hdr->version != version || hdr->size != size || hdr->crc != crc32(d, size))
+		return false;
+	memcpy(data, d, size);
+	return true;
+}
+
+// Save the record of the key with the header (REC_HDR) to config.kv. The store should be opened
+bool W25Q::saveKVRecord(uint8_t key, const void* data, uint8_t size, uint16_t version) {
+	uint32_t	buff[64];									// Word aligned buffer for the header
+	REC_HDR*	hdr = (REC_HDR *)buff;
+	hdr->version	= version;
+	hdr->size		= size;
+	hdr->crc		= crc32(data, size);
+	memcpy((uint8_t *)buff + sizeof(REC_HDR), data, size);
+	return kv.save(&cfg_f, key, (const void *)buff, sizeof(REC_HDR) + size);
+}
+
+// Open the key-value store file, the records index is built when the file opened first time
+bool W25Q::openKV(void) {
+	if (act_f != W25Q_CONFIG_KV) {
+		W25Q::close();
+		if (FR_OK != f_open(&cfg_f, fn_kv, FA_READ | FA_WRITE | FA_OPEN_ALWAYS))
+			return false;
+		act_f = W25Q_CONFIG_KV;
+	}
+	if (!kv.open(&cfg_f)) {
+		W25Q::close();
+		return false;
+	}
+	return true;
+}
+
 // Create backup of configuration data
 bool W25Q::backup(ACT_FILE type) {
 	if (type != W25Q_TIPS_CURRENT && type != W25Q_CONFIG_CURRENT)
@@ -426,23 +1173,24 @@ bool W25Q::backup(ACT_FILE type) {
 	if (type == W25Q_TIPS_CURRENT) {
 		FILINFO fno;
 		if (FR_OK == f_stat(fn_tip_calib, &fno)) {
-			f_size = fno.fsize;								// Ensure the file size is multiple of TIP size
-			uint16_t tips = f_size / sizeof(TIP);
-			f_size = tips * sizeof(TIPS);
+			f_size = fno.fsize;								// Ensure the file size is multiple of the record slot size
+			uint16_t tips = f_size / tipSlot(sizeof(TIP));
+			f_size = tips * tipSlot(sizeof(TIP));
 		}
 	}
 
 	// Copy data to the backup file
-	uint8_t *buff = (uint8_t *)malloc(blk_size);			// Copy buffer
+	BYTE *buff = disk_buffer_acquire(fs_drive);				// Copy buffer
 	if (buff == 0)
 		return false;
 	FIL in_f, out_f;
 	if (FR_OK != f_open(&in_f, fn, FA_READ | FA_OPEN_EXISTING)) {
-		free(buff);
+		disk_buffer_release(fs_drive, buff);
 		return false;
 	}
 	if (FR_OK != f_open(&out_f, fb, FA_CREATE_ALWAYS | FA_WRITE)) {
-		free(buff);
+		f_close(&in_f);
+		disk_buffer_release(fs_drive, buff);
 		return false;
 	}
 	bool ret = true;
@@ -467,6 +1215,6 @@ bool W25Q::backup(ACT_FILE type) {
 	}
 	f_close(&in_f);
 	f_close(&out_f);
-	free(buff);
+	disk_buffer_release(fs_drive, buff);
 	return ret;
 }
@@ -0,0 +1,152 @@
+/*
+ * fsmount.cpp
+ *
+ *  2025 FEB 27
+ *  	Shared mount of the flash drive file system, see fsmount.h
+ *
+ *  2025 MAR 01
+ *  	Flash access arbiter between the firmware and the USB host
+ *
+ *  2025 MAR 02
+ *  	The USB host data cache is flushed by lock() and served by poll(), see usbd_storage_if.c
+ *
+ *  2025 MAR 07
+ *  	mount() fails at once while the USB host is writing instead of waiting in the main loop
+ *  	lock() and mount() fail while the cached USB host data is not written to the flash
+ */
+
+#include "main.h"
+#include "fsmount.h"
+#include "FTL.h"
+#include "usbd_storage_if.h"
+
+FSMOUNT	fsmount;
+
+extern "C" void fsMediaChanged(void) {
+	fsmount.hostWrite();
+}
+
+extern "C" void fsMediaWritten(void) {
+	fsmount.written();
+}
+
+extern "C" bool fsHostReady(void) {
+	return fsmount.hostReady();
+}
+
+/*
+ * Acquire the flash. While the USB host is writing (see hostBusy()), the volume is not mounted and the function returns
+ * immediately, the caller skips the operation as if the flash drive failed or tries again later from the main loop
+ */
+bool FSMOUNT::mount(void) {
+	if (refs == 0 && hostBusy())
+		return false;
+	if (!lock())
+		return false;
+	if (changed && refs == 0) {								// Re-read the file system changed by the USB host
+		changed	= false;
+		mounted	= false;
+	}
+	if (!mounted) {
+		if (FR_OK != f_mount(&fatfs, "0:/", 1)) {
+			unlock();
+			return false;
+		}
+		DWORD	free_clust	= 0;
+		FATFS*	fs_ptr		= &fatfs;
+		if (FR_OK != f_getfree("0:", &free_clust, &fs_ptr)) {	// Check the FAT, count the free clusters once
+			f_mount(NULL, "0:", 0);
+			unlock();
+			return false;
+		}
+		mounted = true;
+	}
+	++refs;
+	return true;
+}
+
+void FSMOUNT::release(void) {
+	if (refs > 0) {
+		--refs;
+		unlock();
+	}
+}
+
+/*
+ * Mask the USB interrupt, so the USB host cannot access the flash until unlock(). The buffered host data is written to the flash.
+ * If the host data cannot be written, the flash is not locked: the firmware would read the outdated sector
+ */
+bool FSMOUNT::lock(void) {
+	if (locks == 0) {
+		maskUSB();
+		if (!STORAGE_Flush_FS()) {							// The host data remains in the buffer, see STORAGE_Poll_FS()
+			unmaskUSB();
+			return false;
+		}
+		fw_written = false;
+	}
+	++locks;
+	return true;
+}
+
+void FSMOUNT::unlock(void) {
+	if (locks == 0 || --locks > 0)
+		return;
+	if (fw_written) {										// Let the USB host know the volume has been changed
+		fw_written	= false;
+		eject		= HAL_GetTick();
+		ejected		= true;
+	}
+	unmaskUSB();
+}
+
+// Background flash work, should be called from the main loop: the USB host data cache and erasing the free sectors
+void FSMOUNT::poll(void) {
+	if (locks > 0)
+		return;
+	maskUSB();
+	STORAGE_Poll_FS();
+	FTL_Poll();
+	unmaskUSB();
+}
+
+void FSMOUNT::maskUSB(void) {
+	usb_irq = NVIC_GetEnableIRQ(USB_LP_CAN1_RX0_IRQn);
+	HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+}
+
+void FSMOUNT::unmaskUSB(void) {
+	if (usb_irq)
+		HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+}
+
+void FSMOUNT::hostWrite(void) {
+	changed		= true;
+	host_write	= HAL_GetTick();
+}
+
+// The USB host has written the flash drive less than FS_HOST_IDLE ms ago, it is probably writing the file now
+bool FSMOUNT::hostBusy(void) {
+	return (host_write != 0 && HAL_GetTick() - host_write < FS_HOST_IDLE);
+}
+
+// The drive is not ready for the host for a while after the firmware has written it, so the host re-reads the file system
+bool FSMOUNT::hostReady(void) {
+	if (ejected) {
+		if (HAL_GetTick() - eject < FS_HOST_EJECT)
+			return false;
+		ejected = false;
+	}
+	return true;
+}
+
+// Number of the free clusters, FatFS keeps it in the FATFS object after the volume has been mounted
+uint32_t FSMOUNT::freeClusters(void) {
+	if (!mounted)
+		return 0;
+	DWORD	free_clust	= 0;
+	FATFS*	fs_ptr		= &fatfs;
+	if (FR_OK != f_getfree("0:", &free_clust, &fs_ptr))
+		return 0;
+	return free_clust;
+}
@@ -7,10 +7,14 @@
  *		Separate ambientTemp() into two routines to calculate stm32 temperature and steinhart sensor temperature inside Hakko T12 handle
  *		Save MCU internal temperature at startup to adjust internal temperature. As soon as the MCU temperature is higher than actual ambient temperature,
  *		return average value between MCU temperature and MCU temperature at startup.
+ *  2025 FEB 10
+ *  	steinhartTemp() uses fixed-point arithmetic, no float operations
+ *  	steinhartTemp() returns default ambient temperature if the raw value is out of the thermistor range
  */
 
-#include <math.h>
+#include <stdlib.h>
 #include "hw.h"
+#include "fixmath.h"
 
 CFG_STATUS HW::init(uint16_t iron_temp, uint16_t gun_temp, uint16_t ambient, uint16_t vref, uint32_t t_mcu) {
 	dspl.init();
@@ -106,20 +110,21 @@ int32_t HW::internalTemp(int32_t raw_stm32) {
 	return ((v_at_25c - v_sense) * 1000 + (avg_slope>>1)) / avg_slope + 25;
 }
 
+/*
+ * The thermistor resistance is R = add_resistor * raw / (4095 - raw). As soon as add_resistor equals to the nominal resistance,
+ * ln(R/Ro) = ln(raw) - ln(4095 - raw)
+ * The Steinhart-Hart (beta) equation 1/T = 1/To + 1/B * ln(R/Ro) is transformed to T = B * To / (B + To * ln(R/Ro))
+ * to calculate it using integer fixed-point arithmetic (see fixmath.h). The temperatures are in 1/100 Kelvin
+ */
 int32_t HW::steinhartTemp(int32_t raw_ambient) {
-	static const uint16_t	add_resistor	= 10000;		// The additional resistor value (10koHm)
-	static const float 	  	normal_temp[2]= { 10000, 25 };	// nominal resistance and the nominal temperature
-	static const uint16_t 	beta 			= 3950;     	// The beta coefficient of the thermistor (usually 3000-4000)
-
-	// convert the value to resistance
-	float resistance = 4095.0 / (float)raw_ambient - 1.0;
-	resistance = (float)add_resistor / resistance;
+	static const int64_t	normal_temp_k	= 29815;		// The nominal temperature (25 Celsius) in 1/100 Kelvin
+	static const int64_t 	beta 			= 3950;     	// The beta coefficient of the thermistor (usually 3000-4000)
 
-	float steinhart = resistance / normal_temp[0];		// (R/Ro)
-	steinhart = log(steinhart);							// ln(R/Ro)
-	steinhart /= beta;									// 1/B * ln(R/Ro)
-	steinhart += 1.0 / (normal_temp[1] + 273.15);  		// + (1/To)
-	steinhart = 1.0 / steinhart;						// Invert
-	steinhart -= 273.15;								// convert to Celsius
-	return round(steinhart);
+	if (raw_ambient < min_ambient_value || raw_ambient >= max_ambient_value)	// The thermistor is shorted or open, prevent ln(0)
+		return default_ambient;
+	int32_t ln_r = fxLn(raw_ambient) - fxLn(4095 - raw_ambient);	// ln(R/Ro) in Q16 format
+	int64_t num  = beta * normal_temp_k * FX_ONE * 100;
+	int64_t den  = beta * FX_ONE * 100 + normal_temp_k * ln_r;
+	int32_t temp_k = fxDivRound(num, den);					// Temperature in 1/100 Kelvin
+	return fxDivRound(temp_k - 27315, 100);					// convert to Celsius
 }
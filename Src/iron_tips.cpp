@@ -7,8 +7,18 @@
  *  2024 AUG 14
  *  2024 OCT 05
  *  	Updated JBC tip list
+ *  2025 MAR 03
+ *  	TIPS::index() uses binary search in the tip table order sorted by the tip name, see TIPS::buildIndex()
+ *  2025 MAR 05
+ *  	TIPS::create() releases previously allocated tip table
+ *  2025 MAR 06
+ *  	Two-tier tip store: the tip catalogue is read from the flash drive by pages,
+ *  	only activated and calibrated tips are kept in RAM, see TIPS::attach()
+ *  2025 MAR 07
+ *  	RADIX::tipName() decodes the tip name into the buffer, TIPS::version() counts the tip activation changes
  */
 
+#include <stdlib.h>
 #include "iron_tips.h"
 
 /* RADIX 50 is an uppercase-only character encoding created by DEC for use on their DECsystem, PDP, and VAX computers.
@@ -99,6 +109,14 @@ bool RADIX::match(RADIX &r) {
 }
 
 std::string RADIX::tipName(void) {
+	char name[tip_full_name_sz];
+	tipName(name);
+	std::string res(name);
+	return res;
+}
+
+// Decode the tip name into the buffer without heap allocation. Returns the name length
+uint8_t RADIX::tipName(char buff[tip_full_name_sz]) {
 	uint8_t name[11];
 	uint8_t i = 11;
 	name[--i] = '\0';
@@ -119,8 +137,11 @@ std::string RADIX::tipName(void) {
 		if (name[k] != ' ') break;
 		name[k] = '\0';
 	}
-	std::string res((const char *)&name[i]);
-	return res;
+	uint8_t len = 0;
+	for ( ; name[i+len] != '\0'; ++len)
+		buff[len] = name[i+len];
+	buff[len] = '\0';
+	return len;
 }
 
 void RADIX::setCalibMask(uint8_t calib_mask) {
@@ -209,56 +230,335 @@ void RADIX::bytes(uint32_t word) {
 }
 
 bool TIPS::create(uint16_t size) {
-	tip_table = (TIP_TABLE *)malloc(size * sizeof(TIP_TABLE));
-	if (tip_table) {
+	release();												// The tip list can be allocated again, see CFG::loadGlobalTipList()
+	table_count	= 0;
+	resolved	= true;
+	clearAllCalibration();
+	tip_names = (RADIX *)malloc(size * sizeof(RADIX));
+	if (tip_names) {
 		tip_count = size;
+		tip_keys  = (TIP_KEY *)malloc(size * sizeof(TIP_KEY));	// If failed, the tips will be looked up by linear scan
 		return true;
 	}
 	return false;
 }
 
 bool TIPS::initTip(uint16_t index, RADIX &tip_name) {
-	if (index >= tip_count) return false;
-	tip_table[index].tip_index = NO_TIP_CHUNK;
-	tip_table[index].tip.init(tip_name);
+	if (index >= tip_count || !tip_names) return false;
+	tip_names[index].init(tip_name);
+	if (index == 0)
+		hot_gun.tip.init(tip_name);
+	sorted = false;											// The tip order should be built again
 	return true;
 }
 
+/*
+ * Sort the catalogue by the tip name (RADIX::tip()), should be called when all tips have been initialized.
+ * The catalogue itself keeps the tip_list.txt order shown in the menu. The insertion sort is stable,
+ * so the first tip of the duplicated names is found as before. The tip list is almost sorted, the sort is fast
+ */
+void TIPS::buildIndex(void) {
+	if (!tip_keys) return;
+	for (uint16_t i = 0; i < tip_count; ++i) {
+		uint32_t	k	= tip_names[i].tip();
+		uint16_t	j	= i;
+		for ( ; j > 0 && tip_keys[j-1].tip.tip() > k; --j)
+			tip_keys[j] = tip_keys[j-1];
+		tip_keys[j].tip.init(tip_names[i]);
+		tip_keys[j].index = i;
+	}
+	sorted = true;
+}
+
+/*
+ * Switch to the catalogue saved on the flash drive. Only the first tip name of every page of the sorted catalogue
+ * is kept in RAM, so the tip is found by single page read
+ */
+bool TIPS::attach(TIP_STORE *store, uint16_t size) {
+	if (!store || size == 0)
+		return false;
+	uint16_t	pages	= (size + TIP_PAGE - 1) / TIP_PAGE;
+	uint32_t	*f		= (uint32_t *)malloc(pages * sizeof(uint32_t));
+	RADIX		*np		= (RADIX *)malloc(TIP_PAGE * sizeof(RADIX));
+	TIP_KEY		*kp		= (TIP_KEY *)malloc(TIP_PAGE * sizeof(TIP_KEY));
+	bool		ok		= (f && np && kp);
+	for (uint16_t p = 0; ok && p < pages; ++p) {
+		TIP_KEY key;
+		ok = store->readTipKeys(p * TIP_PAGE, &key, 1);
+		if (ok)
+			f[p] = key.tip.tip();
+	}
+	RADIX gun;
+	if (ok)
+		ok = store->readTipNames(0, &gun, 1);
+	if (!ok) {
+		if (f)  free(f);
+		if (np) free(np);
+		if (kp) free(kp);
+		return false;
+	}
+	release();
+	this->store	= store;
+	fences		= f;
+	name_page	= np;
+	key_page	= kp;
+	tip_count	= size;
+	table_count	= 0;
+	resolved	= true;
+	clearAllCalibration();
+	hot_gun.tip.init(gun);
+	return true;
+}
+
+// Save the calibration index of the tip. The catalogue index of the new tip is looked up later, see resolve()
 bool TIPS::applyCalibtationIndex(RADIX &tip_name, uint8_t calib_index) {
-	int16_t indx = index(tip_name);
-	if (indx < 0) return false;
+	if (tip_count == 0) return false;
+	++changes;												// The activated tip lists should be built again
+	TIP_TABLE *t = 0;
+	if (hot_gun.tip.match(tip_name)) {
+		t = &hot_gun;
+	} else {
+		for (uint16_t i = 0; i < table_count; ++i) {
+			if (tip_table[i].tip.match(tip_name)) {
+				t = &tip_table[i];
+				break;
+			}
+		}
+	}
+	if (!t) {												// New tip
+		if (table_count >= table_size) {
+			TIP_TABLE *nt = (TIP_TABLE *)realloc(tip_table, (table_size + 8) * sizeof(TIP_TABLE));
+			if (!nt) return false;
+			tip_table	= nt;
+			table_size += 8;
+		}
+		t = &tip_table[table_count++];
+		t->tip.init(tip_name);
+		t->global	= TIP_UNRESOLVED;
+		resolved	= false;
+	}
 	uint8_t calib_mask = tip_name.getCalibMask();
-	tip_table[indx].tip_index = calib_index;
-	tip_table[indx].tip.setCalibMask(calib_mask);
+	t->tip_index = calib_index;
+	t->tip.setCalibMask(calib_mask);
 	return true;
 }
 
 void TIPS::clearAllCalibration(void) {
-	for (uint16_t i = 0; i < tip_count; ++i) {
-		tip_table[i].tip_index = NO_TIP_CHUNK;
-		tip_table[i].tip.setCalibMask(0);
-	}
+	++changes;
+	hot_gun.tip_index = NO_TIP_CHUNK;
+	hot_gun.tip.setCalibMask(0);
+	table_count	= 0;
+	resolved	= true;
+}
+
+uint16_t TIPS::calibrated(void) {
+	resolve();
+	uint16_t n = table_count;
+	if (hot_gun.tip_index != NO_TIP_CHUNK)
+		++n;
+	return n;
 }
 
 RADIX& TIPS::radix(uint16_t index) {
-	if (index < tip_count) {
-		return tip_table[index].tip;
-	} else {
+	if (index >= tip_count)
 		return no_tip;
-	}
+	if (index == 0)
+		return hot_gun.tip;
+	TIP_TABLE *t = active(index);
+	if (t)
+		return t->tip;
+	return name(index);
 }
 
 uint8_t	TIPS::tipCalibrationIndex(uint16_t index) {
 	if (index >= tip_count)
 		return NO_TIP_CHUNK;
-	return tip_table[index].tip_index;
+	if (index == 0)
+		return hot_gun.tip_index;
+	TIP_TABLE *t = active(index);
+	return t?t->tip_index:NO_TIP_CHUNK;
 }
 
+// The activated and calibrated tips are checked first, then the catalogue
 int16_t TIPS::index(RADIX &tip_name) {
-	for (uint16_t i = 0; i < tip_count; ++i) {
-		if (tip_table[i].tip.match(tip_name)) {
-			return i;
+	if (tip_count == 0)
+		return -1;
+	if (hot_gun.tip.match(tip_name))
+		return 0;
+	resolve();
+	for (uint16_t i = 0; i < table_count; ++i) {
+		if (tip_table[i].tip.match(tip_name))
+			return tip_table[i].global;
+	}
+	return find(tip_name);
+}
+
+int16_t TIPS::nextTip(uint16_t index, bool active_only) {
+	if (!active_only)
+		return (index + 1 < tip_count)?index + 1:-1;
+	resolve();
+	for (uint16_t i = 0; i < table_count; ++i) {
+		if (tip_table[i].global > index && tip_table[i].tip.isActivated())
+			return tip_table[i].global;
+	}
+	return -1;
+}
+
+int16_t TIPS::prevTip(uint16_t index, bool active_only) {
+	if (!active_only)
+		return (index > 1 && index <= tip_count)?index - 1:-1;
+	resolve();
+	for (int16_t i = table_count - 1; i >= 0; --i) {
+		if (tip_table[i].global < index && tip_table[i].tip.isActivated())
+			return tip_table[i].global;
+	}
+	return -1;
+}
+
+// Binary search of the tip in the table sorted by the catalogue index
+TIP_TABLE* TIPS::active(uint16_t index) {
+	resolve();
+	uint16_t lo = 0;
+	uint16_t hi = table_count;
+	while (lo < hi) {
+		uint16_t mid = (lo + hi) >> 1;
+		if (tip_table[mid].global < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < table_count && tip_table[lo].global == index)
+		return &tip_table[lo];
+	return 0;
+}
+
+// The tip name from the catalogue. The returned reference is valid until the next page of the catalogue is read
+RADIX& TIPS::name(uint16_t index) {
+	if (tip_names)
+		return tip_names[index];
+	if (!store)
+		return no_tip;
+	uint16_t first = index - index % TIP_PAGE;
+	if (name_first != first) {
+		uint16_t count = tip_count - first;
+		if (count > TIP_PAGE) count = TIP_PAGE;
+		name_first = first;
+		if (!store->readTipNames(first, name_page, count)) {
+			name_first = TIP_UNRESOLVED;
+			return no_tip;
 		}
 	}
+	return name_page[index - first];
+}
+
+// Binary search of the tip in the catalogue sorted by the tip name. Linear scan if the order has not been built
+int16_t TIPS::find(RADIX &tip_name) {
+	uint32_t	k	= tip_name.tip();
+	if (tip_names) {
+		if (!sorted) {
+			for (uint16_t i = 0; i < tip_count; ++i) {
+				if (tip_names[i].match(tip_name))
+					return i;
+			}
+			return -1;
+		}
+		uint16_t	lo	= 0;
+		uint16_t	hi	= tip_count;
+		while (lo < hi) {									// Looking for the first tip which name is not less than k
+			uint16_t mid = (lo + hi) >> 1;
+			if (tip_keys[mid].tip.tip() < k)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < tip_count && tip_keys[lo].tip.tip() == k)
+			return tip_keys[lo].index;
+		return -1;
+	}
+	if (!store)
+		return -1;
+	uint16_t	pages	= (tip_count + TIP_PAGE - 1) / TIP_PAGE;
+	uint16_t	lo		= 0;
+	uint16_t	hi		= pages;
+	while (lo < hi) {										// Looking for the first page which first tip name is not less than k
+		uint16_t mid = (lo + hi) >> 1;
+		if (fences[mid] < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0) {											// The tip can be at the end of the previous page
+		if (!keyPage(lo - 1))
+			return -1;
+		uint16_t first	= (lo - 1) * TIP_PAGE;
+		uint16_t count	= tip_count - first;
+		if (count > TIP_PAGE) count = TIP_PAGE;
+		uint16_t l = 0;
+		uint16_t h = count;
+		while (l < h) {
+			uint16_t mid = (l + h) >> 1;
+			if (key_page[mid].tip.tip() < k)
+				l = mid + 1;
+			else
+				h = mid;
+		}
+		if (l < count)
+			return (key_page[l].tip.tip() == k)?key_page[l].index:-1;
+	}
+	if (lo < pages && fences[lo] == k && keyPage(lo))		// The first tip of the page
+		return key_page[0].index;
 	return -1;
 }
+
+bool TIPS::keyPage(uint16_t page) {
+	uint16_t first = page * TIP_PAGE;
+	if (key_first == first)
+		return true;
+	uint16_t count = tip_count - first;
+	if (count > TIP_PAGE) count = TIP_PAGE;
+	key_first = first;
+	if (!store->readTipKeys(first, key_page, count)) {
+		key_first = TIP_UNRESOLVED;
+		return false;
+	}
+	return true;
+}
+
+// Look up the catalogue index of the tips added by applyCalibtationIndex(), remove the tips missing in the catalogue
+void TIPS::resolve(void) {
+	if (resolved) return;
+	resolved = true;
+	uint16_t n = 0;
+	for (uint16_t i = 0; i < table_count; ++i) {
+		TIP_TABLE t = tip_table[i];
+		if (t.global == TIP_UNRESOLVED) {
+			int16_t g = find(t.tip);
+			if (g <= 0) continue;							// Not in the catalogue or the Hot Air Gun
+			t.global = g;
+		}
+		uint16_t j = n++;									// Insertion sort by the catalogue index
+		for ( ; j > 0 && tip_table[j-1].global > t.global; --j)
+			tip_table[j] = tip_table[j-1];
+		tip_table[j] = t;
+	}
+	table_count = n;
+}
+
+// Release the catalogue
+void TIPS::release(void) {
+	if (tip_names)	free(tip_names);
+	if (tip_keys)	free(tip_keys);
+	if (fences)		free(fences);
+	if (name_page)	free(name_page);
+	if (key_page)	free(key_page);
+	tip_names	= 0;
+	tip_keys	= 0;
+	fences		= 0;
+	name_page	= 0;
+	key_page	= 0;
+	store		= 0;
+	sorted		= false;
+	name_first	= TIP_UNRESOLVED;
+	key_first	= TIP_UNRESOLVED;
+	tip_count	= 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * kvstore.cpp
+ *
+ *  2025 FEB 23
+ *  	Log-structured key-value store for the configuration records, see kvstore.h
+ */
+
+#include <string.h>
+#include "kvstore.h"
+
+// Read the page headers and index the latest record of every key in the active page
+bool KVSTORE::open(FIL* f) {
+	if (scanned)
+		return true;
+	if (f_size(f) != KV_PAGE_SIZE * KV_PAGES)				// New file or damaged file
+		return format(f);
+
+	int8_t act = -1;
+	for (uint8_t p = 0; p < KV_PAGES; ++p) {				// Looking for the active page
+		uint32_t hdr[2];									// magic, seq
+		UINT br = 0;
+		if (FR_OK != f_lseek(f, p * KV_PAGE_SIZE) || FR_OK != f_read(f, hdr, sizeof(hdr), &br) || br != sizeof(hdr))
+			return false;
+		if (hdr[0] == magic && hdr[1] != 0xFFFFFFFF && (act < 0 || hdr[1] > seq)) {
+			act	= p;
+			seq	= hdr[1];
+		}
+	}
+	if (act < 0)
+		return format(f);
+
+	page	= act;
+	tail	= KV_PAGE_SIZE;
+	memset(offset, 0, sizeof(offset));
+	uint8_t		data[256];
+	KV_RECORD	rec;
+	for (uint16_t pos = 2 * sizeof(uint32_t); pos + sizeof(KV_RECORD) <= KV_PAGE_SIZE; ) {
+		UINT br = 0;
+		if (FR_OK != f_lseek(f, page * KV_PAGE_SIZE + pos) || FR_OK != f_read(f, &rec, sizeof(rec), &br) || br != sizeof(rec))
+			return false;
+		if (rec.key == 0xFF && rec.size == 0xFF && rec.crc == 0xFFFF) {
+			tail = pos;										// The free area found
+			break;
+		}
+		if (pos + recordSize(rec.size) > KV_PAGE_SIZE)		// Damaged record, the page is full
+			break;
+		if (readRecord(f, page * KV_PAGE_SIZE + pos, &rec, data) && rec.key < KV_KEYS)
+			offset[rec.key] = (rec.size > 0)?pos:0;			// Record with zero size removes the key
+		pos += recordSize(rec.size);
+	}
+	scanned = true;
+	return true;
+}
+
+bool KVSTORE::load(FIL* f, uint8_t key, void* data, uint8_t size) {
+	if (key >= KV_KEYS || !open(f) || offset[key] == 0)
+		return false;
+	KV_RECORD	rec;
+	uint8_t		buff[256];
+	if (!readRecord(f, page * KV_PAGE_SIZE + offset[key], &rec, buff) || rec.key != key || rec.size != size)
+		return false;
+	memcpy(data, buff, size);
+	return true;
+}
+
+// Append new record of the key. If the active page is full, compact the records into the other page
+bool KVSTORE::save(FIL* f, uint8_t key, const void* data, uint8_t size) {
+	if (key >= KV_KEYS || !open(f))
+		return false;
+	if (tail + recordSize(size) > KV_PAGE_SIZE)
+		return compact(f, key, data, size);
+	if (!append(f, page * KV_PAGE_SIZE + tail, key, data, size))
+		return false;
+	offset[key] = (size > 0)?tail:0;
+	tail += recordSize(size);
+	return true;
+}
+
+// Create new store: fill both pages with 0xFF (erased flash) and write the header of the first page
+bool KVSTORE::format(FIL* f) {
+	scanned = false;
+	uint8_t buff[64];
+	memset(buff, 0xFF, sizeof(buff));
+	if (FR_OK != f_lseek(f, 0) || FR_OK != f_truncate(f))
+		return false;
+	for (uint16_t i = 0; i < (KV_PAGE_SIZE * KV_PAGES) / sizeof(buff); ++i) {
+		UINT bw = 0;
+		if (FR_OK != f_write(f, buff, sizeof(buff), &bw) || bw != sizeof(buff))
+			return false;
+	}
+	uint32_t hdr[2] = { magic, 1 };
+	UINT bw = 0;
+	if (FR_OK != f_lseek(f, 0) || FR_OK != f_write(f, hdr, sizeof(hdr), &bw) || bw != sizeof(hdr))
+		return false;
+	if (FR_OK != f_sync(f))
+		return false;
+	memset(offset, 0, sizeof(offset));
+	page	= 0;
+	seq		= 1;
+	tail	= sizeof(hdr);
+	scanned	= true;
+	return true;
+}
+
+/*
+ * Copy the latest records of all keys and the new record of the key into the other page.
+ * The page header is written after all records have been saved
+ */
+bool KVSTORE::compact(FIL* f, uint8_t key, const void* data, uint8_t size) {
+	uint8_t		np		= (page + 1) % KV_PAGES;
+	uint32_t	base	= np * KV_PAGE_SIZE;
+	uint8_t		buff[256];
+	memset(buff, 0xFF, sizeof(buff));
+	if (FR_OK != f_lseek(f, base))
+		return false;
+	for (uint16_t i = 0; i < KV_PAGE_SIZE / sizeof(buff); ++i) {	// Clear the new page
+		UINT bw = 0;
+		if (FR_OK != f_write(f, buff, sizeof(buff), &bw) || bw != sizeof(buff))
+			return false;
+	}
+
+	uint16_t	new_offset[KV_KEYS];
+	uint16_t	pos = 2 * sizeof(uint32_t);
+	for (uint8_t k = 0; k < KV_KEYS; ++k) {
+		new_offset[k] = 0;
+		const uint8_t*	d = (const uint8_t*)data;
+		uint8_t			s = size;
+		if (k != key) {										// Copy the latest record from the active page
+			KV_RECORD rec;
+			if (offset[k] == 0 || !readRecord(f, page * KV_PAGE_SIZE + offset[k], &rec, buff))
+				continue;
+			d = buff;
+			s = rec.size;
+		} else if (size == 0) {								// The key has been removed
+			continue;
+		}
+		if (pos + recordSize(s) > KV_PAGE_SIZE || !append(f, base + pos, k, d, s))
+			return false;
+		new_offset[k] = pos;
+		pos += recordSize(s);
+	}
+	if (FR_OK != f_sync(f))									// Make sure the records are written before the header
+		return false;
+
+	uint32_t hdr[2] = { magic, seq + 1 };
+	UINT bw = 0;
+	if (FR_OK != f_lseek(f, base) || FR_OK != f_write(f, hdr, sizeof(hdr), &bw) || bw != sizeof(hdr))
+		return false;
+	if (FR_OK != f_sync(f))
+		return false;
+	memcpy(offset, new_offset, sizeof(offset));
+	page	= np;
+	seq		= hdr[1];
+	tail	= pos;
+	return true;
+}
+
+// Write the record by single f_write() call: header, data and padding
+bool KVSTORE::append(FIL* f, uint32_t pos, uint8_t key, const void* data, uint8_t size) {
+	uint8_t		buff[sizeof(KV_RECORD) + 256];
+	KV_RECORD*	rec = (KV_RECORD *)buff;
+	uint16_t	len = recordSize(size);
+	memset(buff, 0xFF, len);
+	rec->key	= key;
+	rec->size	= size;
+	if (size > 0)
+		memcpy(&buff[sizeof(KV_RECORD)], data, size);
+	rec->crc	= crc16(0xFFFF, buff, 2);
+	rec->crc	= crc16(rec->crc, &buff[sizeof(KV_RECORD)], size);
+	UINT bw = 0;
+	if (FR_OK != f_lseek(f, pos) || FR_OK != f_write(f, buff, len, &bw))
+		return false;
+	return (bw == len);
+}
+
+// Read the record at the file position and check its CRC
+bool KVSTORE::readRecord(FIL* f, uint32_t pos, KV_RECORD* rec, uint8_t* data) {
+	UINT br = 0;
+	if (FR_OK != f_lseek(f, pos) || FR_OK != f_read(f, rec, sizeof(KV_RECORD), &br) || br != sizeof(KV_RECORD))
+		return false;
+	if (rec->size > 0) {
+		if (FR_OK != f_read(f, data, rec->size, &br) || br != rec->size)
+			return false;
+	}
+	uint16_t crc = crc16(0xFFFF, (uint8_t *)rec, 2);
+	crc = crc16(crc, data, rec->size);
+	return (crc == rec->crc);
+}
+
+// CRC-16/CCITT
+uint16_t KVSTORE::crc16(uint16_t crc, const uint8_t* data, uint16_t size) {
+	for (uint16_t i = 0; i < size; ++i) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (uint8_t b = 0; b < 8; ++b)
+			crc = (crc & 0x8000)?((crc << 1) ^ 0x1021):(crc << 1);
+	}
+	return crc;
+}
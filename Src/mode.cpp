@@ -4,12 +4,22 @@
  * 2024 NOV 27, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
  *
+ * 2025 FEB 19
+ * 		MSLCT recognizes just inserted T12 tip by its heat-up signature, see TIP_FPRINT
+ * 2025 MAR 07
+ * 		MSLCT keeps the global tip index in 16 bits, the tip catalogue can be longer than 255 tips
+ * 		FFORMAT drops the working data snapshot in the MCU flash, see CFG_SNAPSHOT
+ * 		MAUTOPID does not save the tuned PID parameters, MTPID saves them as the tip parameters after the confirmation
+ * 		MTPID resets the tip specific PID parameters by long press of the upper encoder button
+ * 		MSLCT uses the mean current of the whole probe pulse in the tip fingerprint
+ *
  */
 
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
+#include <stdlib.h>
 #include "mode.h"
+#include "fixmath.h"
 #include "cfgtypes.h"
 #include "core.h"
 #include "unit.h"
@@ -57,6 +67,7 @@ void MSLCT::init(void) {;
 
 	manual_change		= false;
 	tip_disconnected	= 0;
+	stopProbe();
 	if (dev_type == d_unknown) {							// Manual TIP selection mode
 		manual_change = true;
 		dev_type = d_t12;
@@ -73,9 +84,9 @@ void MSLCT::init(void) {;
 
 	// The current tip could be inactive, so we should find nearest tip (by ID) in the list
 	uint16_t closest	= 0;								// The index of the list of closest tip ID
-	uint8_t diff  		= 0xff;
+	uint16_t diff  		= 0xffff;
 	for (uint8_t i = 0; i < list_len; ++i) {
-		uint8_t delta;
+		uint16_t delta;
 		if ((delta = abs(tip_index - tip_list[i].tip_index)) < diff) {
 			diff 	= delta;
 			closest = i;
@@ -109,19 +120,36 @@ MODE* MSLCT::loop(void) {
 		update_screen 		= 0;
 	}
 
-	if (button > 0 && (manual_change || dev_type != d_t12)) { // The button was pressed
+	if (button > 0 && (manual_change || dev_type != d_t12 || probe_phase == PROBE_DONE)) { // The button was pressed
 		changeTip(index);
 		return mode_return;
 	}
 
+	if (probe_phase != PROBE_OFF && !pUnit->isConnected()) {	// The tip has been removed again, restart the recognition
+		stopProbe();
+		tip_disconnected = HAL_GetTick();
+	}
+
 	if (!manual_change && tip_disconnected > 0 && (pUnit->isConnected() || !isACsine())) {	// See core.cpp for isACsine()
 		// Prevent bouncing event, when the IRON connection restored back too quickly.
 		if (tip_begin_select && (HAL_GetTick() - tip_begin_select) < 1000) {
 			return 0;
 		}
 		if (HAL_GetTick() > tip_disconnected + 1000) {		// Wait at least 1 second before reconnect the IRON tip again
-			changeTip(index);
-			return mode_return;
+			if (probe_phase == PROBE_OFF && dev_type == d_t12 && isACsine() && pCore->iron.temp() < probe_max_temp) {
+				startProbe();								// Cold tip inserted, heat it up to recognize the tip
+				return this;
+			}
+			if (probe_phase == PROBE_RUN) {
+				if (HAL_GetTick() < probe_end)
+					return this;
+				if (finishProbe())							// The tip recognized, wait for the user confirmation
+					return this;
+			}
+			if (probe_phase != PROBE_DONE) {
+				changeTip(index);
+				return mode_return;
+			}
 		}
 	}
 
@@ -142,7 +170,7 @@ MODE* MSLCT::loop(void) {
 			break;
 		}
 	}
-	uint8_t tip_index = tip_list[index].tip_index;
+	uint16_t tip_index = tip_list[index].tip_index;
 	for (uint8_t i = 0; i < MSLCT_LEN; ++i)
 		tip_list[i].tip_name.initEmpty();
 	uint8_t list_len = pCFG->tipList(tip_index, tip_list, MSLCT_LEN, true, manual_change, dev_type);
@@ -161,12 +189,76 @@ MODE* MSLCT::loop(void) {
 	return this;
 }
 
+void MSLCT::clean(void) {
+	if (probe_phase == PROBE_RUN)
+		pCore->iron.fixPower(0);
+}
+
 void MSLCT::changeTip(uint8_t index) {
 	pCore->cfg.changeTip(tip_list[index].tip_name);
+	if (probe.rise > 0 && probe.current > 0)				// The tip heat-up signature has been measured
+		pCore->cfg.learnTipFprint(probe, dev_type);
 	// Clear temperature history and switch iron mode to "power off"
 	pCore->iron.reset();
 }
 
+// Apply the fixed power to the just inserted cold tip to measure its heat-up signature
+void MSLCT::startProbe(void) {
+	probe_temp	= pCore->iron.temp();
+	probe_end	= HAL_GetTick() + probe_time;
+	probe_phase	= PROBE_RUN;
+	pCore->iron.startCurrentProbe();
+	pCore->iron.fixPower(probe_power);
+}
+
+void MSLCT::stopProbe(void) {
+	if (probe_phase == PROBE_RUN) {
+		pCore->iron.fixPower(0);
+		pCore->iron.probeCurrent();
+	}
+	probe_phase		= PROBE_OFF;
+	probe.rise		= 0;
+	probe.current	= 0;
+	probe.samples	= 0;
+}
+
+/*
+ * Finish the probe pulse and look for the tip with the closest fingerprint.
+ * Returns true if the tip has been found: the tip list is rebuilt around this tip and the user should confirm the choice.
+ * The current through the tip is averaged over the whole pulse (see UNIT::probeCurrent()),
+ * the higher the heater resistance the lower the current
+ */
+bool MSLCT::finishProbe(void) {
+	CFG*	pCFG	= &pCore->cfg;
+	uint16_t t		= pCore->iron.temp();
+	probe.current	= pCore->iron.probeCurrent();
+	probe.rise		= (t > probe_temp)?(t - probe_temp):0;
+	probe.samples	= 1;
+	pCore->iron.fixPower(0);
+	probe_phase		= PROBE_OFF;
+	int16_t found	= pCFG->findTipByFprint(probe, dev_type);
+	if (found < 0)
+		return false;
+
+	for (uint8_t i = 0; i < MSLCT_LEN; ++i)
+		tip_list[i].tip_name.initEmpty();
+	uint8_t list_len = pCFG->tipList(found, tip_list, MSLCT_LEN, true, manual_change, dev_type);
+	if (list_len == 0)
+		return false;
+	uint8_t ii = 0;
+	for (uint8_t i = 0; i < list_len; ++i) {
+		if ((uint16_t)found == tip_list[i].tip_index) {
+			ii = i;
+			break;
+		}
+	}
+	pCore->l_enc.reset(ii, 0, list_len-1, 1, 1, false);
+	tip_begin_select	= 0;
+	update_screen		= 0;								// Force to redraw the screen
+	probe_phase			= PROBE_DONE;
+	return true;
+}
+
 //---------------------- The Activate tip mode: select tips to use ---------------
 void MTACT::init(void) {
 	CFG*	pCFG	= &pCore->cfg;
@@ -227,6 +319,7 @@ MODE* MTACT::loop(void) {
 // but during calibration procedure we will use more points to cover whole set
 // of the internal temperature values. Then use the Ordinary Least Squares method
 // to build a calibration line and calculate the temperature in the reference points.
+// All the entered points are saved as the tip calibration curve (see TIP_CURVE).
 void MCALIB::init(void) {
 	CFG*	pCFG	= &pCore->cfg;
 	UNIT*	pUnit	= unit();
@@ -267,16 +360,17 @@ void MCALIB::init(void) {
 /*
  * Calculate tip calibration parameter using linear approximation by Ordinary Least Squares method
  * Y = a * X + b, where
- * Y - internal temperature, X - real temperature. a and b are double coefficients
- * a = (N * sum(Xi*Yi) - sum(Xi) * sum(Yi)) / ( N * sum(Xi^2) - (sum(Xi))^2)
+ * Y - internal temperature, X - real temperature. a and b are rational coefficients
+ * a = (N * sum(Xi*Yi) - sum(Xi) * sum(Yi)) / ( N * sum(Xi^2) - (sum(Xi))^2) = a_num / a_den
  * b = 1/N * (sum(Yi) - a * sum(Xi))
+ * So, Y = (a_num * (N * X - sum(Xi)) + a_den * sum(Yi)) / (a_den * N), calculated using 64-bit integers
  */
 bool MCALIB::calibrationOLS(uint16_t* tip, uint16_t min_temp, uint16_t max_temp) {
-	long sum_XY = 0;											// sum(Xi * Yi)
-	long sum_X 	= 0;											// sum(Xi)
-	long sum_Y  = 0;											// sum(Yi)
-	long sum_X2 = 0;											// sum(Xi^2)
-	long N		= 0;
+	int32_t sum_XY	= 0;										// sum(Xi * Yi)
+	int32_t sum_X	= 0;										// sum(Xi)
+	int32_t sum_Y	= 0;										// sum(Yi)
+	int32_t sum_X2	= 0;										// sum(Xi^2)
+	int32_t N		= 0;
 
 	for (uint8_t i = 0; i < MCALIB_POINTS; ++i) {
 		uint16_t X 	= calib_temp[0][i];
@@ -293,14 +387,15 @@ bool MCALIB::calibrationOLS(uint16_t* tip, uint16_t min_temp, uint16_t max_temp)
 	if (N <= 2)													// Not enough real temperatures have been entered
 		return false;
 
-	double	a  = (double)N * (double)sum_XY - (double)sum_X * (double)sum_Y;
-			a /= (double)N * (double)sum_X2 - (double)sum_X * (double)sum_X;
-	double 	b  = (double)sum_Y - a * (double)sum_X;
-			b /= (double)N;
+	int64_t	a_num = (int64_t)N * sum_XY - (int64_t)sum_X * sum_Y;
+	int64_t a_den = (int64_t)N * sum_X2 - (int64_t)sum_X * sum_X;
+	if (a_den == 0)												// All the real temperatures are the same
+		return false;
 
 	for (uint8_t i = 0; i < 4; ++i) {
-		double temp = a * (double)pCore->cfg.referenceTemp(i, dev_type) + b;
-		tip[i] = round(temp);
+		int32_t X		= pCore->cfg.referenceTemp(i, dev_type);
+		int32_t temp	= fxDivRound(a_num * (N * X - sum_X) + a_den * sum_Y, a_den * N);
+		tip[i] = constrain(temp, 0, 65535);
 	}
 	if (tip[3] > int_temp_max) tip[3] = int_temp_max;			// Maximal possible temperature (main.h)
 	return true;
@@ -372,8 +467,18 @@ void MCALIB::buildFinishCalibration(void) {
 		}
 		if (tip[3] > int_temp_max) tip[3] = int_temp_max;	// Maximal possible temperature (main.h)
 		int16_t ambient 	= pCore->ambientTemp();
-		bool ok = pCFG->saveTipCalibtarion(dev_type, tip, TIP_ACTIVE | TIP_CALIBRATED, ambient);
-		pCFG->applyTipCalibtarion(tip, ambient, dev_type, ok);
+		TIP_CURVE curve;									// Save all entered calibration points as well
+		memset((void *)&curve, 0, sizeof(TIP_CURVE));
+		for (uint8_t i = 0; i < MCALIB_POINTS && curve.points < TIP_CURVE_POINTS; ++i) {
+			if (calib_temp[0][i] > 0) {						// The real temperature was entered
+				curve.real[curve.points]		= calib_temp[0][i];
+				curve.internal[curve.points]	= calib_temp[1][i];
+				++curve.points;
+			}
+		}
+		curve.ambient		= ambient;
+		bool ok = pCFG->saveTipCalibtarion(dev_type, tip, TIP_ACTIVE | TIP_CALIBRATED, ambient, &curve);
+		pCFG->applyTipCalibtarion(tip, ambient, dev_type, ok, &curve);
 		if (ok) pCore->buzz.shortBeep(); else pCore->buzz.failedBeep();
 	} else {
 		pCore->buzz.failedBeep();
@@ -837,7 +942,8 @@ MODE* MTPID::loop(void) {
 		return mode_lpress;
 	}
 
-	if (pCore->u_enc.buttonStatus() > 0) {						// Emergency OFF
+	uint8_t	up_button = pCore->u_enc.buttonStatus();
+	if (up_button > 0) {										// Emergency OFF
 		on = false;
 		pUnit->switchPower(on);
 	}
@@ -854,7 +960,7 @@ MODE* MTPID::loop(void) {
     	}
     }
 
-	if (button || old_index != index)
+	if (button || up_button || old_index != index)
 		update_screen = 0;
 
 	if (HAL_GetTick() >= data_update) {
@@ -929,12 +1035,25 @@ MODE* MTPID::loop(void) {
 		} else if (button == 2) {							// Long button press: save the parameters and return to menu
 			if (confirm()) {
 				PIDparam pp = pPID->dump();
-				pCFG->savePID(pp, dev_type);
+				if (!tuned || !pCFG->saveTipPID(pp, dev_type))	// The tip is not calibrated, the tuned parameters are the device ones
+					pCFG->savePID(pp, dev_type);
 				pCore->buzz.shortBeep();
 			} else {
 				pCore->buzz.failedBeep();
 			}
 			return mode_lpress;
+		} else if (up_button == 2 && pCFG->hasTipPID(dev_type)) {	// Upper encoder long press: use the common PID parameters of the device
+			if (confirm(MSG_RESET_PID_Q) && pCFG->resetTipPID(dev_type)) {
+				PIDparam pp = pCFG->pidParams(dev_type);
+				pPID->load(pp);
+				tuned = false;
+				pCore->buzz.shortBeep();
+			} else {
+				pCore->buzz.failedBeep();
+			}
+			pEnc->reset(data_index, 0, 2, 1, 1, true);
+			reset_dspl = true;
+			return this;
 		}
 
 		if (reset_dspl) {									// Flag indicating we should completely redraw display
@@ -950,7 +1069,7 @@ MODE* MTPID::loop(void) {
 	return this;
 }
 
-bool MTPID::confirm(void) {
+bool MTPID::confirm(t_msg_id msg) {
 	pCore->l_enc.reset(0, 0, 1, 1, 1, true);
 	pCore->dspl.clear();
 	pCore->buzz.shortBeep();
@@ -969,12 +1088,13 @@ bool MTPID::confirm(void) {
 		uint8_t answer = pCore->l_enc.read();
 		if (pCore->l_enc.buttonStatus() > 0)
 			return answer == 0;
-		pCore->dspl.showDialog(MSG_SAVE_Q, 150, answer == 0);
+		pCore->dspl.showDialog(msg, 150, answer == 0);
 	}
 	return false;
 }
 
 void MTPID::clean(void) {
+	tuned = false;
 	pCore->dspl.pidDestroyData();
 }
 
@@ -1263,12 +1383,16 @@ MODE* MAUTOPID::loop(void) {
  * diff  = alpha^2 - epsilon^2, where
  * alpha	- the amplitude of temperature oscillations
  * epsilon	- the temperature hysteresis (see max_delta_temp)
+ * The new PID parameters are loaded to the UNIT only. The manual PID tune mode saves them as the specific parameters
+ * of the current tip after the user confirmation
  */
 bool MAUTOPID::updatePID(UNIT *pUnit) {
 	uint32_t alpha	= (pUnit->tempMax() - pUnit->tempMin() + 1) / 2;
 	int32_t diff	= alpha*alpha - delta_temp*delta_temp;
 	if (diff > 0) {
 		pUnit->newPIDparams(delta_power, diff, pUnit->autoTunePeriod());
+		if (mode_tpid)
+			mode_tpid->tunedPID();
 		pCore->buzz.shortBeep();
 		return true;
 	}
@@ -1334,7 +1458,7 @@ MODE* MABOUT::loop(void) {
 	if (HAL_GetTick() < update_screen) return this;
 	update_screen = HAL_GetTick() + 60000;
 
-	pD->showVersion();
+	pD->showVersion(pCore->cfg.wearLeveling());
 	return this;
 }
 
@@ -1448,6 +1572,7 @@ MODE* FFORMAT::loop(void) {
 			if (!pCore->cfg.formatFlashDrive()) {
 				return 0;										// Failed to format the FLASH
 			}
+			pCore->cfg.dropSnapshot();							// The snapshot does not match the empty flash drive
 		}
 		return mode_return;										// The main working mode
 	}
@@ -3,18 +3,22 @@
  *
  * 2024 NOV 16, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
+ * 2025 FEB 27
+ * 		The flash drive is mounted by the shared FSMOUNT object, see fsmount.h
  */
 
 #include <string.h>
 #include "nls_cfg.h"
+#include "fsmount.h"
 
 void NLS::init(NLS_MSG *pMsg) {
 	msg_parser.setNLS_MSG(pMsg);							// Setup pointer to the NLS_MSG class instance to use NLS_MSG::set() method in the value callback procedure
-	if (FR_OK == f_mount(&flashfs, "0:/", 1)) {				// Try to mount SPI flash
+	if (fsmount.mount()) {									// Try to mount SPI flash
 		std::string cfg_path = "0:" + std::string(fn_cfg);	// fn_cfg defined in vars.h, "cfg.json"
 		if (FR_OK == f_open(&cfg_f, cfg_path.c_str(), FA_READ)) {
 			lang_cfg.readConfig(&cfg_f);					// readConfig closes the file automatically
 		}
+		fsmount.release();
 	}
 	lang_cfg.addEnglish();									// Add default language to the list
 	language_index	= 0;									// Current language index (English)
@@ -89,12 +93,17 @@ std::string NLS::fontFile(uint8_t index) {
 }
 
 bool NLS::loadFont(uint8_t indx) {
-	if (FR_OK != f_mount(&flashfs, "0:/", 1))				// Try to mount SPI flash
-		return false;
 	std::string f = fontFile(indx);
 	if (f.empty())
 		return true;
-	std::string cfg_path = "0:" + f;
+	if (!fsmount.mount())									// Try to mount SPI flash
+		return false;
+	bool ret = readFont("0:" + f);
+	fsmount.release();
+	return ret;
+}
+
+bool NLS::readFont(std::string cfg_path) {
 	FILINFO fno;
 	if (FR_OK != f_stat(cfg_path.c_str(), &fno))
 		return false;
@@ -119,12 +128,13 @@ bool NLS::loadFont(uint8_t indx) {
 }
 
 bool NLS::loadMessages(uint8_t indx) {
-	if (FR_OK != f_mount(&flashfs, "0:/", 1))				// Try to mount SPI flash
+	if (!fsmount.mount())									// Try to mount SPI flash
 		return false;
 	std::string cfg_path = "0:" + messageFile(indx);		// Here messageFile is not null for sure
-	if (FR_OK != f_open(&cfg_f, cfg_path.c_str(), FA_READ))
-		return false;
-	msg_parser.readConfig(&cfg_f);							// readConfig closes the file automatically
-	return true;
+	bool ret = (FR_OK == f_open(&cfg_f, cfg_path.c_str(), FA_READ));
+	if (ret)
+		msg_parser.readConfig(&cfg_f);						// readConfig closes the file automatically
+	fsmount.release();
+	return ret;
 }
 
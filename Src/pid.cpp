@@ -3,11 +3,13 @@
  *
  * 2024 NOV 16, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
+ * 2025 FEB 10
+ * 		newPIDparams() uses integer arithmetic
  */
 
 #include "pid.h"
 #include "tools.h"
-#include <math.h>
+#include "fixmath.h"
 
 PIDparam::PIDparam(int32_t Kp, int32_t Ki, int32_t Kd) {
 	this->Kp	= Kp;
@@ -76,12 +78,15 @@ int32_t PID::changePID(uint8_t p, int32_t k) {
  * Kp = 0.6*Ku; Ti = 0.5*Pu; Td = 0.125*Pu;
  * Ki = Kp*T/Ti;
  * Kd = Kp*Td/T;
+ *
+ * Kp = 0.6 * Ku * denominator = delta_power * denominator * (2.4/PI) / SQRT(diff)
+ * 2.4/PI in Q16 format is 50066, SQRT(diff) is calculated with 8 fractional bits
  */
 void PID::newPIDparams(uint16_t delta_power, uint32_t diff, uint32_t period) {
-	double Ku  = 4 * delta_power;
-	Ku /= M_PI * sqrt(diff);
-	uint32_t denominator = 1 << denominator_p;
-	Kp = round(Ku * 0.6 * denominator);						// Translate Kp to the numerator of implemented PID
+	uint32_t sqrt_diff = isqrt64((uint64_t)diff << 16);	// SQRT(diff) * 256
+	if (sqrt_diff == 0) sqrt_diff = 1;
+	int64_t num = ((int64_t)delta_power << denominator_p) * 50066;
+	Kp = fxDivRound(num, (int64_t)sqrt_diff << 8);			// Translate Kp to the numerator of implemented PID
 	Ki = (Kp * T * 2 + period/2) / period;
 	Kd = (Kp * period) >> 3;								// 1/8 = 0.125
 	Kd += T/2;
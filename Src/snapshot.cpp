@@ -0,0 +1,140 @@
+/*
+ * snapshot.cpp
+ *
+ *  2025 MAR 07
+ *  	The working data copy in the MCU internal flash page, see snapshot.h
+ *  	The page is erased by save() only if allowed, invalidate() does not erase the page.
+ *  	The page is not used if the firmware image overlaps it
+ *  2025 MAR 08
+ *  	The linker symbol addresses are cast via uintptr_t, so the file is built on the host, see HostTest
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "snapshot.h"
+#include "crc.h"
+
+static_assert((SNAP_PAGE_ADDR & (SNAP_PAGE_SIZE - 1)) == 0, "SNAP_PAGE_ADDR is not the flash page address");
+static_assert(SNAP_PAGE_ADDR + SNAP_PAGE_SIZE - 1 <= FLASH_BANK1_END, "SNAP_PAGE_ADDR is out of the MCU flash");
+
+extern "C" uint8_t _sidata;									// Symbols defined in the linker script
+extern "C" uint8_t _sdata;
+extern "C" uint8_t _edata;
+
+bool SNAPSHOT::load(void* data, uint16_t size, uint16_t version) {
+	if (!available())
+		return false;
+	uint16_t free = 0;
+	int16_t	 last = scan(&free);
+	if (last < 0)
+		return false;
+	const SNAP_HDR* hdr = (const SNAP_HDR *)(SNAP_PAGE_ADDR + last);
+	if (hdr->size != size || hdr->version != version)		// The data format has been changed
+		return false;
+	memcpy(data, (const uint8_t *)(SNAP_PAGE_ADDR + last + sizeof(SNAP_HDR)), size);
+	return true;
+}
+
+/*
+ * Append new record to the page. The record is not written if the latest one has the same data.
+ * If the page is full and may_erase is false, nothing is written and SNAP_FULL is returned, try again later
+ */
+SNAP_STATUS SNAPSHOT::save(const void* data, uint16_t size, uint16_t version, bool may_erase) {
+	if (!available() || recordSize(size) > SNAP_PAGE_SIZE)
+		return SNAP_ERROR;
+	uint16_t free	= 0;
+	int16_t	 last	= scan(&free);
+	uint32_t crc	= crc32(data, size);
+	if (last >= 0) {
+		const SNAP_HDR* hdr = (const SNAP_HDR *)(SNAP_PAGE_ADDR + last);
+		if (hdr->size == size && hdr->version == version && hdr->crc == crc &&
+				memcmp(data, (const uint8_t *)(SNAP_PAGE_ADDR + last + sizeof(SNAP_HDR)), size) == 0)
+			return SNAP_OK;
+	}
+	if (free + recordSize(size) > SNAP_PAGE_SIZE) {			// The page is full
+		if (!may_erase)
+			return SNAP_FULL;
+		erase();
+		free = 0;
+	}
+	SNAP_HDR hdr;
+	hdr.size	= size;
+	hdr.version	= version;
+	hdr.crc		= crc;
+	hdr.magic	= magic;
+	uint32_t addr = SNAP_PAGE_ADDR + free;
+	HAL_FLASH_Unlock();
+	bool ok = program(addr, &hdr, sizeof(SNAP_HDR) - sizeof(uint32_t)) &&	// The magic number is programmed last
+			program(addr + sizeof(SNAP_HDR), data, size) &&
+			program(addr + offsetof(SNAP_HDR, magic), &hdr.magic, sizeof(uint32_t));
+	HAL_FLASH_Lock();
+	return ok?SNAP_OK:SNAP_ERROR;
+}
+
+// Clear the magic number of every record, so no record is loaded. A programmed half-word can be overwritten by zero
+void SNAPSHOT::invalidate(void) {
+	if (!available())
+		return;
+	const uint32_t zero = 0;
+	uint16_t pos = 0;
+	HAL_FLASH_Unlock();
+	while (pos + sizeof(SNAP_HDR) <= SNAP_PAGE_SIZE) {
+		const SNAP_HDR* hdr = (const SNAP_HDR *)(SNAP_PAGE_ADDR + pos);
+		if (hdr->size == 0xFFFF || pos + recordSize(hdr->size) > SNAP_PAGE_SIZE)
+			break;
+		if (hdr->magic == magic)
+			program(SNAP_PAGE_ADDR + pos + offsetof(SNAP_HDR, magic), &zero, sizeof(uint32_t));
+		pos += recordSize(hdr->size);
+	}
+	HAL_FLASH_Lock();
+}
+
+// The firmware image ends before the page: the code size and the initial values of the variables
+bool SNAPSHOT::available(void) {
+	uint32_t image_end = (uint32_t)(uintptr_t)&_sidata + (uint32_t)(&_edata - &_sdata);
+	return image_end <= SNAP_PAGE_ADDR;
+}
+
+void SNAPSHOT::erase(void) {
+	FLASH_EraseInitTypeDef er;
+	er.TypeErase	= FLASH_TYPEERASE_PAGES;
+	er.Banks		= FLASH_BANK_1;
+	er.PageAddress	= SNAP_PAGE_ADDR;
+	er.NbPages		= 1;
+	uint32_t page_error = 0;
+	HAL_FLASH_Unlock();
+	HAL_FLASHEx_Erase(&er, &page_error);
+	HAL_FLASH_Lock();
+}
+
+// Walk through the records of the page. Returns the offset of the latest correct record, free is the offset of the free area
+int16_t SNAPSHOT::scan(uint16_t *free) {
+	int16_t	 last	= -1;
+	uint16_t pos	= 0;
+	while (pos + sizeof(SNAP_HDR) <= SNAP_PAGE_SIZE) {
+		const SNAP_HDR* hdr = (const SNAP_HDR *)(SNAP_PAGE_ADDR + pos);
+		if (hdr->size == 0xFFFF)							// The free area found
+			break;
+		if (pos + recordSize(hdr->size) > SNAP_PAGE_SIZE) {	// Damaged record, the page is full
+			pos = SNAP_PAGE_SIZE;
+			break;
+		}
+		if (hdr->magic == magic && hdr->crc == crc32((const uint8_t *)(SNAP_PAGE_ADDR + pos + sizeof(SNAP_HDR)), hdr->size))
+			last = pos;
+		pos += recordSize(hdr->size);
+	}
+	*free = pos;
+	return last;
+}
+
+// Program the data by half-words, the odd size data is padded by 0xFF. The flash should be unlocked
+bool SNAPSHOT::program(uint32_t addr, const void* data, uint16_t size) {
+	const uint8_t* d = (const uint8_t *)data;
+	for (uint16_t i = 0; i < size; i += 2) {
+		uint16_t hw = d[i];
+		hw |= (i + 1 < size)?((uint16_t)d[i+1] << 8):0xFF00;
+		if (HAL_OK != HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr + i, hw))
+			return false;
+	}
+	return true;
+}
@@ -3,6 +3,8 @@
  *
  * 2024 NOV 16, v.1.00
  * 		Ported from JBC controller source code, tailored to the new hardware
+ * 2025 MAR 07
+ * 		The current samples are accumulated to calculate the mean current of the tip probe pulse
  */
 
 #include "unit.h"
@@ -15,6 +17,30 @@ void UNIT::init(uint8_t c_len, uint16_t c_min, uint16_t c_max, uint8_t s_len, ui
 	change.reset(0);										// The JBC change button is not pressed
 }
 
+// Called from the ADC interrupt handler when the unit is powered
+void UNIT::updateCurrent(uint16_t value) {
+	current.update(value);
+	if (c_probe && c_samples < 0xFFFF) {
+		c_summ += value;
+		++c_samples;
+	}
+}
+
+void UNIT::startCurrentProbe(void) {
+	c_probe		= false;
+	c_summ		= 0;
+	c_samples	= 0;
+	c_probe		= true;
+}
+
+// Returns the mean value of the current samples accumulated since startCurrentProbe() or 0 if no sample
+uint16_t UNIT::probeCurrent(void) {
+	c_probe = false;										// The interrupt handler does not change the summ now
+	if (c_samples == 0)
+		return 0;
+	return (c_summ + c_samples/2) / c_samples;
+}
+
 bool UNIT::isReedSwitch(bool reed) {
 	if (reed)
 		return sw.status();									// TRUE if switch is open (IRON in use)
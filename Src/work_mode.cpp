@@ -28,6 +28,10 @@ void MWORK::init(void) {
 	temp				= pCFG->tempPresetHuman(d_gun);
 	temp_i				= pCFG->humanToTemp(temp, ambient, d_gun);
 	pCore->hotgun.setTemp(temp_i);
+	PIDparam pp			= pCFG->pidParams(iron_dev);		// The tip could be changed, load its PID parameters
+	pCore->iron.PID::load(pp);
+	pp					= pCFG->pidParams(d_gun);
+	pCore->hotgun.PID::load(pp);
 
 	if (start && (iron_dev == d_t12) && pCFG->isAutoStart()) { // The T12 IRON can be started just after power-on. Default DASH mode is DM_T12_GUN
 		pCore->iron.switchPower(true);
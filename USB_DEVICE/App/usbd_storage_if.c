@@ -23,6 +23,10 @@
 
 /* USER CODE BEGIN INCLUDE */
 #include "W25Qxx.h"
+#include "FTL.h"
+#include "fsmount.h"
+#include "diskio.h"
+#include <string.h>
 
 /* USER CODE END INCLUDE */
 
@@ -32,7 +36,7 @@
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
-uint8_t			usb_flash_busy = 0;							// The flag indicating the controller is connected to PC via usb port to update FLASH files
+uint8_t			usb_flash_busy = 0;							// The flag indicating the controller is connected to PC via usb port
 
 /* USER CODE END PV */
 
@@ -69,6 +73,21 @@ uint8_t			usb_flash_busy = 0;							// The flag indicating the controller is con
 #define STORAGE_BLK_SIZ                  0x200
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+/*
+ * Write-combining and read-ahead cache of the host data (2025 MAR 02)
+ * The host rewrites the FAT and directory sectors after every chunk of the file data, every rewrite used to program
+ * the whole 4k flash sector. One sector is kept in RAM: the buffer is borrowed from the FatFS disk cache while
+ * the firmware does not use the file system (see disk_buffer_acquire()) and returned by STORAGE_Flush_FS().
+ * The sector rewritten by the host (the FAT, directory or the last cluster of the growing file) stays in the buffer,
+ * the sequential file data and other sectors pass through to the flash. The dirty sector is written to the flash from the main loop (STORAGE_Poll_FS()) when
+ * the host has not written for MSC_CACHE_IDLE ms or the data is older than MSC_CACHE_AGE ms.
+ * On sequential reads the next sector is read into the clean buffer by STORAGE_Poll_FS() while the host
+ * receives the current one.
+ */
+#define MSC_CACHE_IDLE		(300)					// Write the dirty sector if the host is idle for this time, ms
+#define MSC_CACHE_AGE		(1000)					// Maximum time the host data is kept in RAM, ms
+#define MSC_HISTORY			(4)						// Number of recently written sectors to detect the rewrites
+#define MSC_NONE			(0xFFFF)
 
 /* USER CODE END PRIVATE_DEFINES */
 
@@ -115,6 +134,17 @@ const int8_t STORAGE_Inquirydata_FS[] = {/* 36 */
 /* USER CODE END INQUIRY_DATA_FS */
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+static uint8_t*				msc_buff		= 0;			// The sector buffer, borrowed from the disk cache
+static uint16_t				msc_sector		= MSC_NONE;		// The sector kept in msc_buff
+static uint8_t				msc_dirty		= 0;			// The buffer data has not been written to the flash yet
+static uint8_t				msc_hot			= 0;			// The buffered sector is rewritten by the host
+static uint32_t				msc_since		= 0;			// The buffer became dirty, ms
+static volatile uint32_t	msc_write		= 0;			// The last host write, ms
+static volatile uint16_t	msc_next		= MSC_NONE;		// The sector to be read ahead
+static uint16_t				msc_read_end	= MSC_NONE;		// The sector next to the last read one
+static uint16_t				msc_write_end	= MSC_NONE;		// The sector next to the last written one
+static uint16_t				msc_history[MSC_HISTORY] = { MSC_NONE, MSC_NONE, MSC_NONE, MSC_NONE };
+static uint8_t				msc_hist_pos	= 0;
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -151,6 +181,8 @@ static int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uin
 static int8_t STORAGE_GetMaxLun_FS(void);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static bool		STORAGE_Recent(uint16_t sector);
+static bool		STORAGE_WriteBack(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -180,8 +212,8 @@ int8_t STORAGE_Init_FS(uint8_t lun)
 {
   /* USER CODE BEGIN 2 */
     UNUSED(lun);
-    if (W25Qxx_SectorCount() > 0) {
-    	usb_flash_busy = 1;				// Prevent to run main application
+    if (FTL_SectorCount() > 0) {
+    	usb_flash_busy = 1;				// The main application keeps working, the flash access is arbitrated, see fsmount.h
     	return (USBD_OK);
     }
     return USBD_FAIL;
@@ -199,7 +231,7 @@ int8_t STORAGE_GetCapacity_FS(uint8_t lun, uint32_t *block_num, uint16_t *block_
 {
   /* USER CODE BEGIN 3 */
     UNUSED(lun);
-    uint16_t sectors = W25Qxx_SectorCount();
+    uint16_t sectors = FTL_SectorCount();			// Logical sectors, see FTL.h
     if (sectors > 0) {
     	*block_num  = sectors;
     	*block_size = 4096;
@@ -218,7 +250,8 @@ int8_t STORAGE_IsReady_FS(uint8_t lun)
 {
   /* USER CODE BEGIN 4 */
   UNUSED(lun);
-
+  if (!fsHostReady())							// The firmware has changed the drive, the host should re-read it
+      return USBD_FAIL;
   return (USBD_OK);
   /* USER CODE END 4 */
 }
@@ -250,8 +283,18 @@ int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t bl
     UNUSED(blk_addr);
     UNUSED(blk_len);
     USBD_StatusTypeDef ret = USBD_OK;
-    if (W25Qxx_RET_OK !=  W25Qxx_Read(blk_addr << 12, buf, blk_len << 12))
-    	ret = USBD_FAIL;
+    for (uint16_t i = 0; i < blk_len; ++i) {
+    	uint16_t sector = blk_addr + i;
+    	if (msc_buff && sector == msc_sector) {		// The buffered data is newer than the flash data
+    		memcpy(buf + (i << 12), msc_buff, 4096);
+    	} else if (W25Qxx_RET_OK !=  FTL_Read(sector, buf + (i << 12), 1)) {
+    		ret = USBD_FAIL;
+    		break;
+    	}
+    }
+    if (blk_addr == msc_read_end && !msc_dirty)	// Sequential read, prefetch the next sector
+    	msc_next = blk_addr + blk_len;
+    msc_read_end = blk_addr + blk_len;
     return ret;
   /* USER CODE END 6 */
 }
@@ -269,8 +312,44 @@ int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t b
     UNUSED(blk_addr);
     UNUSED(blk_len);
     USBD_StatusTypeDef ret = USBD_OK;
-    if (W25Qxx_RET_OK !=  W25Qxx_Write(blk_addr << 12, buf, blk_len << 12))
-    	ret = USBD_FAIL;
+    fsMediaChanged();							// The file system should be mounted again, see fsmount.h
+    msc_next = MSC_NONE;
+    for (uint16_t i = 0; i < blk_len; ++i) {
+    	uint16_t sector = blk_addr + i;
+    	uint8_t *data	= buf + (i << 12);
+    	if (msc_buff && sector == msc_sector) {		// Combine the rewrites of the buffered sector
+    		if (!msc_dirty)
+    			msc_since = HAL_GetTick();
+    		msc_dirty	= 1;
+    		msc_hot		= 1;
+    		memcpy(msc_buff, data, 4096);
+    		msc_write_end = sector + 1;
+    		continue;
+    	}
+    	bool recent = STORAGE_Recent(sector);
+    	if (msc_buff && sector != msc_write_end && !(msc_dirty && msc_hot)) {	// Keep the new sector in the buffer
+    		if (!STORAGE_WriteBack()) {
+    			ret = USBD_FAIL;
+    			break;
+    		}
+    		memcpy(msc_buff, data, 4096);
+    		msc_sector	= sector;
+    		msc_dirty	= 1;
+    		msc_hot		= recent;
+    		msc_since	= HAL_GetTick();
+    	} else {									// Sequential data or the hot sector is buffered, write through
+    		if (sector != msc_write_end) {
+    			msc_history[msc_hist_pos] = sector;
+    			msc_hist_pos = (msc_hist_pos + 1) % MSC_HISTORY;
+    		}
+    		if (W25Qxx_RET_OK !=  FTL_Write(sector, data)) {
+    			ret = USBD_FAIL;
+    			break;
+    		}
+    	}
+    	msc_write_end = sector + 1;
+    }
+    msc_write = HAL_GetTick();
     return ret;
   /* USER CODE END 7 */
 }
@@ -288,6 +367,71 @@ int8_t STORAGE_GetMaxLun_FS(void)
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+// Check the sector has been written by the host recently
+static bool STORAGE_Recent(uint16_t sector)
+{
+    for (uint8_t i = 0; i < MSC_HISTORY; ++i) {
+    	if (msc_history[i] == sector)
+    		return true;
+    }
+    return false;
+}
+
+// Write the buffered host data to the flash, the sector remains in the buffer as a clean one
+static bool STORAGE_WriteBack(void)
+{
+    if (!msc_dirty)
+    	return true;
+    if (W25Qxx_RET_OK != FTL_Write(msc_sector, msc_buff))
+    	return false;
+    msc_history[msc_hist_pos] = msc_sector;
+    msc_hist_pos = (msc_hist_pos + 1) % MSC_HISTORY;
+    msc_dirty = 0;
+    return true;
+}
+
+/*
+ * Should be called periodically from the main loop while USB interrupt is masked, see FSMOUNT::poll().
+ * Borrows the buffer, writes the old host data to the flash and reads ahead the next sector
+ */
+void STORAGE_Poll_FS(void)
+{
+    if (!usb_flash_busy)							// Not connected to the host
+    	return;
+    if (msc_buff == 0) {
+    	msc_buff = disk_buffer_acquire(0);
+    	msc_sector = MSC_NONE;
+    	if (msc_buff == 0)
+    		return;
+    }
+    uint32_t now = HAL_GetTick();
+    if (msc_dirty && (now - msc_write >= MSC_CACHE_IDLE || now - msc_since >= MSC_CACHE_AGE))
+    	STORAGE_WriteBack();
+    uint16_t next = msc_next;
+    if (!msc_dirty && next != MSC_NONE) {
+    	msc_next	= MSC_NONE;
+    	msc_sector	= MSC_NONE;
+    	if (next < FTL_SectorCount() && W25Qxx_RET_OK == FTL_Read(next, msc_buff, 1))
+    		msc_sector = next;
+    }
+}
+
+/*
+ * Write the host data to the flash and return the buffer to the file system, see FSMOUNT::lock()
+ * If the data cannot be written, the buffer is kept dirty and false is returned, the firmware should not use the flash
+ */
+bool STORAGE_Flush_FS(void)
+{
+    if (msc_buff == 0)
+    	return true;
+    if (!STORAGE_WriteBack())
+    	return false;
+    disk_buffer_release(0, msc_buff);
+    msc_buff	= 0;
+    msc_sector	= MSC_NONE;
+    msc_next	= MSC_NONE;
+    return true;
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
@@ -30,6 +30,7 @@
 #include "usbd_msc.h"
 
 /* USER CODE BEGIN INCLUDE */
+#include <stdbool.h>
 
 /* USER CODE END INCLUDE */
 
@@ -104,6 +105,8 @@ extern USBD_StorageTypeDef USBD_Storage_Interface_fops_FS;
   */
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+void STORAGE_Poll_FS(void);
+bool STORAGE_Flush_FS(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
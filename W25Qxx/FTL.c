@@ -0,0 +1,762 @@
+/*
+ * FTL.c
+ *
+ *  Created on: 2025 Feb 22
+ *
+ *  Flash translation layer, see FTL.h
+ *  The translation table sector layout:
+ *  	0x000 - 0x0FF	header page, written last when new snapshot created
+ *  	0x100 - 0x8FF	snapshot: logical to physical map and erase counters of the physical sectors
+ *  	0x900 - 0xFFF	journal: 8-bytes records of the map changes
+ *
+ *  2025 Feb 24
+ *  	The free physical sectors are erased in background by FTL_Poll(), so writing the changed logical sector
+ *  	usually requires page programming only. The bitmap of erased free sectors is kept in RAM only
+ *
+ *  2025 Feb 26
+ *  	FTL_Trim() only marks the sectors released by FatFS. The trimmed sectors are released by FTL_Sync() after
+ *  	the FAT has been written, so the file data is not lost if the power fails before the sync.
+ *  	On the legacy flash drive and out of managed area the trimmed sectors are erased by FTL_Poll() in background
+ *
+ *  2025 Mar 07
+ *  	FTL_Write() programs the mapped sector in place only if one page is changed, see FTL_Write() for the power loss risk
+ *
+ *  2025 Mar 08
+ *  	FTL_Migrate() activates the FTL on the legacy flash drive keeping the files, FTL_Init() completes the migration
+ *  	interrupted by the power loss
+ *  	FTL_Ready() checks the sectors can be written without waiting for the sector erase. The next translation table
+ *  	sector is erased in background as well. After the static wear leveling move the erased free sector is allocated
+ */
+
+#include <string.h>
+#include "FTL.h"
+
+#define FTL_MAGIC			(0x314C5446)					// "FTL1"
+#define FTL_NONE			(0xFFFF)						// The logical sector is not mapped
+#define FTL_TABLES			(2)								// Number of the translation table sectors
+#define FTL_SNAPSHOT		(0x100)							// Snapshot offset in the table sector
+#define FTL_JOURNAL			(FTL_SNAPSHOT + sizeof(ftl_table))
+#define FTL_RECORDS			((0x1000 - FTL_JOURNAL) / sizeof(FTL_RECORD))
+#define FTL_BS_TOTSEC16		(19)							// The FAT boot sector fields, see FTL_BootSectors()
+#define FTL_BS_TOTSEC32		(32)
+#define FTL_BS_55AA			(510)
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	seq;										// Snapshot sequence number, the newest table wins
+	uint16_t	sectors;									// Flash size, 4k sectors
+	uint16_t	managed;									// Managed physical sectors
+	uint16_t	logical;									// Managed logical sectors
+	uint16_t	crc;
+} FTL_HEADER;
+
+typedef struct {
+	uint16_t	logical;
+	uint16_t	physical;									// FTL_NONE if the logical sector has been trimmed
+	uint16_t	erased;										// Erase counter of the physical sector
+	uint8_t		reserved;
+	uint8_t		crc;
+} FTL_RECORD;
+
+static struct {
+	uint16_t	map[FTL_MAX_SECTORS];						// Logical to physical sector map
+	uint16_t	erased[FTL_MAX_SECTORS];					// Erase counters of the physical sectors
+} ftl_table;
+
+#if (FTL_SNAPSHOT + FTL_MAX_SECTORS * 4 + 0x100) > 0x1000
+#error "FTL_MAX_SECTORS is too big, the translation table does not fit the sector"
+#endif
+
+static uint8_t	ftl_free[FTL_MAX_SECTORS / 8];				// Bitmap of the free physical sectors
+static uint8_t	ftl_blank[FTL_MAX_SECTORS / 8];				// Bitmap of the free physical sectors known to be erased
+static uint16_t	ftl_erasing	= 0xFFFF;						// The physical sector being erased in background
+static uint16_t	ftl_scan	= 0;							// Next physical sector to be checked by FTL_Poll()
+static uint8_t	ftl_trim[FTL_TRIM_SECTORS / 8];				// Bitmap of the trimmed logical sectors, not released yet
+static uint8_t	ftl_dirty[FTL_TRIM_SECTORS / 8];			// Bitmap of the released direct mapped sectors to be erased
+static uint16_t	ftl_dirty_scan = 0;							// Next direct mapped sector to be checked by FTL_Poll()
+static bool		ftl_init	= false;
+static bool		ftl_active	= false;
+static uint16_t	ftl_sectors	= 0;							// Flash size, 4k sectors
+static uint16_t	ftl_managed	= 0;							// Managed physical sectors
+static uint16_t	ftl_logical	= 0;							// Managed logical sectors
+static uint8_t	ftl_tbl		= 0;							// Active translation table sector
+static uint16_t	ftl_record	= 0;							// Next journal record index
+static uint32_t	ftl_seq		= 0;
+static bool		ftl_tbl_blank = false;						// The next translation table sector is erased, see FTL_Snapshot()
+static bool		ftl_hold	= false;						// Do not start new background erase, see FTL_Ready()
+static uint32_t	ftl_hold_tick = 0;							// Time (ms) of the last FTL_Ready() call waiting for the erase
+
+static uint16_t		FTL_HeaderCRC(FTL_HEADER *h);
+static uint8_t		FTL_RecordCRC(FTL_RECORD *r);
+static bool			FTL_Load(uint8_t tbl, uint32_t seq);
+static W25Qxx_RET	FTL_Snapshot(void);
+static W25Qxx_RET	FTL_Journal(uint16_t logical, uint16_t physical);
+static W25Qxx_RET	FTL_Erase(uint16_t physical);
+static W25Qxx_RET	FTL_Move(uint16_t logical, uint16_t physical);
+static W25Qxx_RET	FTL_Copy(uint16_t from, uint16_t to);
+static bool			FTL_Resume(void);
+static bool			FTL_Remap(uint16_t logical);
+static uint32_t		FTL_BootSectors(uint8_t bs[], uint8_t sign[]);
+static uint32_t		FTL_VolumeSectors(uint16_t physical);
+static uint16_t		FTL_Allocate(void);
+static uint16_t		FTL_LeastWorn(void);
+static uint16_t		FTL_Blanks(void);
+static uint8_t		FTL_Changes(uint16_t physical, uint8_t buff[], uint8_t *pages);
+static bool			FTL_IsFree(uint16_t physical);
+static void			FTL_SetFree(uint16_t physical, bool free);
+static void			FTL_BuildFree(void);
+static bool			FTL_IsBlank(uint16_t physical);
+static void			FTL_SetBlank(uint16_t physical, bool blank);
+static void			FTL_Erased(uint16_t sector, W25Qxx_RET res, void *ctx);
+static uint16_t		FTL_NextFree(void);
+static uint16_t		FTL_NextDirty(void);
+static bool			FTL_IsErased(uint16_t physical);
+static bool			FTL_GetBit(uint8_t map[], uint16_t n);
+static void			FTL_SetBit(uint8_t map[], uint16_t n, bool set);
+
+// Read the translation table. Returns true if the FTL is active
+bool FTL_Init(void) {
+	ftl_init	= true;
+	ftl_active	= false;
+	ftl_tbl_blank = false;
+	ftl_sectors	= W25Qxx_SectorCount();
+	if (ftl_sectors == 0)
+		return false;
+	int8_t		tbl	= -1;
+	uint32_t	seq	= 0;
+	for (uint8_t i = 0; i < FTL_TABLES; ++i) {				// Look for the newest translation table
+		FTL_HEADER h;
+		if (W25Qxx_RET_OK != W25Qxx_Read((uint32_t)i << 12, (uint8_t *)&h, sizeof(h)))
+			continue;
+		if (h.magic != FTL_MAGIC || h.crc != FTL_HeaderCRC(&h) || h.sectors != ftl_sectors)
+			continue;
+		if (h.managed > FTL_MAX_SECTORS || h.managed > ftl_sectors || h.logical + FTL_TABLES > h.managed)
+			continue;
+		if (tbl < 0 || h.seq > seq) {
+			tbl 		= i;
+			seq			= h.seq;
+			ftl_managed	= h.managed;
+			ftl_logical	= h.logical;
+		}
+	}
+	if (tbl < 0)											// No translation table, legacy flash drive
+		return FTL_Resume();
+	ftl_active = FTL_Load(tbl, seq);
+	return ftl_active;
+}
+
+/*
+ * Create new empty translation table. All logical sectors become unmapped, the data on the flash is lost
+ * The erase counters are kept if the FTL has been active
+ */
+bool FTL_Format(void) {
+	if (!ftl_init)
+		FTL_Init();
+	ftl_sectors = W25Qxx_SectorCount();
+	if (ftl_sectors <= FTL_TABLES + FTL_SPARES)
+		return false;
+	if (!ftl_active) {
+		memset(ftl_table.erased, 0, sizeof(ftl_table.erased));
+		ftl_seq = 0;
+	}
+	ftl_managed	= (ftl_sectors < FTL_MAX_SECTORS)?ftl_sectors:FTL_MAX_SECTORS;
+	ftl_logical	= ftl_managed - FTL_TABLES - FTL_SPARES;
+	memset(ftl_table.map, 0xFF, sizeof(ftl_table.map));		// All sectors are unmapped
+	memset(ftl_trim, 0, sizeof(ftl_trim));
+	memset(ftl_dirty, 0, sizeof(ftl_dirty));
+	uint16_t boot = FTL_MigrateSectors();					// Drop the boot sector copy, see FTL_Resume()
+	if (boot > 0 && FTL_VolumeSectors(boot) > 0 && W25Qxx_RET_OK != W25Qxx_Erase(boot, 1))
+		return false;
+	for (uint8_t i = 0; i < FTL_TABLES; ++i) {
+		if (W25Qxx_RET_OK != W25Qxx_Erase(i, 1))
+			return false;
+	}
+	ftl_tbl		= FTL_TABLES - 1;							// The snapshot will be written to the table 0
+	ftl_active	= (W25Qxx_RET_OK == FTL_Snapshot());
+	FTL_BuildFree();
+	return ftl_active;
+}
+
+bool FTL_Active(void) {
+	if (!ftl_init)
+		FTL_Init();
+	return ftl_active;
+}
+
+// Number of the logical sectors
+uint16_t FTL_SectorCount(void) {
+	if (!ftl_init)
+		FTL_Init();
+	if (!ftl_active)
+		return W25Qxx_SectorCount();
+	return ftl_sectors - FTL_TABLES - FTL_SPARES;
+}
+
+// Number of the logical sectors of the legacy flash drive after FTL_Migrate() or 0 if the flash cannot be migrated
+uint16_t FTL_MigrateSectors(void) {
+	uint16_t sectors = W25Qxx_SectorCount();
+	if (sectors > FTL_MAX_SECTORS || sectors <= FTL_TABLES + FTL_SPARES)
+		return 0;											// The direct mapped sectors would be shifted
+	return sectors - FTL_TABLES - FTL_SPARES;
+}
+
+/*
+ * Activate the FTL on the legacy flash drive keeping the data, buff is 4k work area. The FAT volume is shrunk
+ * to FTL_MigrateSectors(), the caller checks the clusters at the end of the volume are free.
+ * Physical sectors 0 and 1 (the boot sector and the first FAT sector) become the translation table sectors,
+ * so they are copied into the first two sectors after the logical ones and remapped, the other logical sectors
+ * keep their physical location. The boot sector is copied after the FAT sector and the translation table
+ * is written last, so the power loss leaves the legacy drive intact or FTL_Init() completes the migration
+ */
+bool FTL_Migrate(uint8_t buff[]) {
+	uint16_t logical = FTL_MigrateSectors();
+	if (FTL_Active() || logical == 0)
+		return false;
+	if (W25Qxx_RET_OK != W25Qxx_Read(0, buff, 0x1000))
+		return false;
+	uint32_t volume = FTL_BootSectors(buff, &buff[FTL_BS_55AA]);
+	if (volume == 0)										// No FAT volume on the flash
+		return false;
+	if (volume > logical) {									// Shrink the volume
+		if ((buff[FTL_BS_TOTSEC16] | buff[FTL_BS_TOTSEC16 + 1]) != 0) {
+			buff[FTL_BS_TOTSEC16]		= logical & 0xFF;
+			buff[FTL_BS_TOTSEC16 + 1]	= logical >> 8;
+		} else {
+			memset(&buff[FTL_BS_TOTSEC32], 0, 4);
+			buff[FTL_BS_TOTSEC32]		= logical & 0xFF;
+			buff[FTL_BS_TOTSEC32 + 1]	= logical >> 8;
+		}
+	}
+	uint16_t boot = logical;
+	if (W25Qxx_RET_OK != W25Qxx_Erase(boot + 1, 1) || W25Qxx_RET_OK != FTL_Copy(1, boot + 1))
+		return false;
+	if (W25Qxx_RET_OK != W25Qxx_Erase(boot, 1) || W25Qxx_RET_OK != W25Qxx_Write((uint32_t)boot << 12, buff, 0x1000))
+		return false;
+	return FTL_Remap(logical);
+}
+
+W25Qxx_RET FTL_Read(uint16_t sector, uint8_t buff[], uint16_t count) {
+	if (!FTL_Active())
+		return W25Qxx_Read((uint32_t)sector << 12, buff, count << 12);
+	if (count == 0 || sector + count > FTL_SectorCount())
+		return W25Qxx_RET_ADDR;
+	for ( ; count > 0; --count, ++sector, buff += 0x1000) {
+		W25Qxx_RET r = W25Qxx_RET_OK;
+		if (sector >= ftl_logical) {						// The sector is out of managed area
+			r = W25Qxx_Read((uint32_t)(sector + FTL_TABLES + FTL_SPARES) << 12, buff, 0x1000);
+		} else if (ftl_table.map[sector] == FTL_NONE) {		// Not written yet or trimmed
+			memset(buff, 0xFF, 0x1000);
+		} else {
+			r = W25Qxx_Read((uint32_t)ftl_table.map[sector] << 12, buff, 0x1000);
+		}
+		if (r != W25Qxx_RET_OK)
+			return r;
+	}
+	return W25Qxx_RET_OK;
+}
+
+/*
+ * Write one logical 4k sector. Nothing is written if the data is the same. The sector is programmed in-place
+ * only if one page is changed and only 1->0 bit changes are necessary, so the record appended to the file
+ * (config.kv) costs no erase. This update is not atomic: if the power is lost during the page program, the changed bytes
+ * of the page may be left undefined, the unchanged bytes keep their value. The config.kv records are checked by CRC,
+ * so the interrupted record is skipped and the previous one is used, see kvstore.h.
+ * Otherwise the data is written into new physical sector and the journal record is appended,
+ * so the old data is kept until the journal record is written
+ */
+W25Qxx_RET FTL_Write(uint16_t sector, uint8_t buff[]) {
+	if (sector < FTL_TRIM_SECTORS) {						// The sector keeps the data again
+		FTL_SetBit(ftl_trim, sector, false);
+		FTL_SetBit(ftl_dirty, sector, false);
+	}
+	if (!FTL_Active())
+		return W25Qxx_Write((uint32_t)sector << 12, buff, 0x1000);
+	if (sector >= FTL_SectorCount())
+		return W25Qxx_RET_ADDR;
+	if (sector >= ftl_logical)								// The sector is out of managed area
+		return W25Qxx_Write((uint32_t)(sector + FTL_TABLES + FTL_SPARES) << 12, buff, 0x1000);
+
+	uint16_t old = ftl_table.map[sector];
+	if (old != FTL_NONE) {
+		uint8_t pages	= 0;
+		uint8_t state	= FTL_Changes(old, buff, &pages);
+		if (state == 0)										// The data is the same
+			return W25Qxx_RET_OK;
+		if (state == 1 && pages == 1)						// Program one page without erase
+			return W25Qxx_Write((uint32_t)old << 12, buff, 0x1000);
+	}
+
+	uint16_t phys = FTL_Allocate();
+	if (phys == FTL_NONE)
+		return W25Qxx_RET_WRITE;
+	if (!FTL_IsBlank(phys) && W25Qxx_Compare((uint32_t)phys << 12, buff, 0x1000) == 2) {
+		W25Qxx_RET r = FTL_Erase(phys);
+		if (r != W25Qxx_RET_OK)
+			return r;
+	}
+	W25Qxx_RET r = W25Qxx_Write((uint32_t)phys << 12, buff, 0x1000);
+	if (r != W25Qxx_RET_OK)
+		return r;
+	r = FTL_Journal(sector, phys);							// Commit the new sector location
+	if (r != W25Qxx_RET_OK)
+		return r;
+	ftl_table.map[sector] = phys;
+	FTL_SetFree(phys, false);
+	if (old != FTL_NONE)
+		FTL_SetFree(old, true);
+	return W25Qxx_RET_OK;
+}
+
+/*
+ * Check the logical sectors can be written now without waiting for the flash IC: no erase is running,
+ * the erased free sectors (one more for the static wear leveling move) and the journal records are available.
+ * If only the running background erase prevents the write, FTL_Poll() does not start the next one for FTL_HOLD ms,
+ * so the caller retries soon. Always false on the legacy flash drive, the sector is erased before it is written
+ */
+bool FTL_Ready(uint16_t sectors) {
+	if (!FTL_Active())
+		return false;
+	if (FTL_Blanks() <= sectors)							// FTL_Poll() erases the free sectors
+		return false;
+	if (!ftl_tbl_blank && ftl_record + 2u * sectors > FTL_RECORDS)
+		return false;										// FTL_Poll() erases the next translation table sector
+	if (!W25Qxx_Poll() || ftl_erasing != FTL_NONE) {
+		ftl_hold		= true;
+		ftl_hold_tick	= HAL_GetTick();
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Background erasing of the free physical sectors and released direct mapped sectors, should be called periodically
+ * from the main loop. Checks one sector per call: the blank sector is marked as erased, otherwise the erase operation
+ * is started and FTL_Poll() returns immediately. The next translation table sector is erased first
+ */
+void FTL_Poll(void) {
+	if (!ftl_init || !W25Qxx_Poll() || ftl_erasing != FTL_NONE)
+		return;												// The flash is busy
+	if (ftl_hold && HAL_GetTick() - ftl_hold_tick < FTL_HOLD)
+		return;												// The sectors are about to be written, see FTL_Ready()
+	ftl_hold = false;
+	uint16_t phys = FTL_NONE;
+	if (ftl_active && !ftl_tbl_blank)
+		phys = (ftl_tbl + 1) % FTL_TABLES;
+	else
+		phys = FTL_NextFree();
+	if (phys == FTL_NONE)
+		phys = FTL_NextDirty();
+	if (phys == FTL_NONE)									// All free sectors are erased already
+		return;
+	if (FTL_IsErased(phys)) {
+		if (ftl_active && phys < FTL_TABLES)
+			ftl_tbl_blank = true;
+		else if (ftl_active && phys < ftl_managed)
+			FTL_SetBlank(phys, true);
+		return;
+	}
+	if (W25Qxx_EraseAsync(phys, FTL_Erased, 0)) {
+		ftl_erasing = phys;
+		W25Qxx_Poll();										// Start the erase operation
+	}
+}
+
+// The logical sectors do not keep data anymore. The sectors are released by FTL_Sync()
+W25Qxx_RET FTL_Trim(uint16_t sector, uint16_t count) {
+	if (count == 0 || sector + count > FTL_SectorCount())
+		return W25Qxx_RET_ADDR;
+	for ( ; count > 0 && sector < FTL_TRIM_SECTORS; --count, ++sector)
+		FTL_SetBit(ftl_trim, sector, true);
+	return W25Qxx_RET_OK;
+}
+
+// FatFS has written the FAT, release the trimmed sectors
+W25Qxx_RET FTL_Sync(void) {
+	for (uint16_t sector = 0; sector < FTL_TRIM_SECTORS; ++sector) {
+		if (ftl_trim[sector >> 3] == 0) {					// Skip 8 sectors at once
+			sector |= 7;
+			continue;
+		}
+		if (!FTL_GetBit(ftl_trim, sector))
+			continue;
+		if (!FTL_Active() || sector >= ftl_logical) {		// Direct mapped sector, erase it in background
+			FTL_SetBit(ftl_dirty, sector, true);
+		} else if (ftl_table.map[sector] != FTL_NONE) {
+			uint16_t old = ftl_table.map[sector];
+			W25Qxx_RET r = FTL_Journal(sector, FTL_NONE);
+			if (r != W25Qxx_RET_OK)
+				return r;
+			ftl_table.map[sector] = FTL_NONE;
+			FTL_SetFree(old, true);
+		}
+		FTL_SetBit(ftl_trim, sector, false);
+	}
+	return W25Qxx_RET_OK;
+}
+
+static uint16_t FTL_HeaderCRC(FTL_HEADER *h) {
+	uint8_t *p = (uint8_t *)h;
+	uint16_t summ = 117;									// To avoid good check sum with all-zero
+	for (uint8_t i = 0; i < sizeof(FTL_HEADER) - sizeof(h->crc); ++i) {
+		summ = (summ << 1 | summ >> 15) + p[i];
+	}
+	return summ;
+}
+
+static uint8_t FTL_RecordCRC(FTL_RECORD *r) {
+	uint8_t *p = (uint8_t *)r;
+	uint8_t summ = 117;
+	for (uint8_t i = 0; i < sizeof(FTL_RECORD) - sizeof(r->crc); ++i) {
+		summ = (summ << 1 | summ >> 7) + p[i];
+	}
+	return summ;
+}
+
+// Load the snapshot and apply the journal records
+static bool FTL_Load(uint8_t tbl, uint32_t seq) {
+	uint32_t addr = (uint32_t)tbl << 12;
+	if (W25Qxx_RET_OK != W25Qxx_Read(addr + FTL_SNAPSHOT, (uint8_t *)&ftl_table, sizeof(ftl_table)))
+		return false;
+	ftl_tbl		= tbl;
+	ftl_seq		= seq;
+	ftl_record	= 0;
+	ftl_tbl_blank = false;
+	FTL_RECORD	journal[256 / sizeof(FTL_RECORD)];
+	for (uint16_t i = 0; i < FTL_RECORDS; i += 256 / sizeof(FTL_RECORD)) {	// Read journal by 256-bytes pages
+		if (W25Qxx_RET_OK != W25Qxx_Read(addr + FTL_JOURNAL + i * sizeof(FTL_RECORD), (uint8_t *)journal, sizeof(journal)))
+			return false;
+		for (uint8_t j = 0; j < 256 / sizeof(FTL_RECORD) && i + j < FTL_RECORDS; ++j) {
+			FTL_RECORD *r = &journal[j];
+			if (r->logical == 0xFFFF && r->physical == 0xFFFF && r->crc == 0xFF)
+				continue;									// Empty record
+			ftl_record = i + j + 1;							// Append the records after the last written one
+			if (r->crc != FTL_RecordCRC(r) || r->logical >= ftl_logical)
+				continue;									// The record was not completely written on power loss
+			if (r->physical != FTL_NONE) {
+				if (r->physical < FTL_TABLES || r->physical >= ftl_managed)
+					continue;
+				ftl_table.erased[r->physical] = r->erased;
+			}
+			ftl_table.map[r->logical] = r->physical;
+		}
+	}
+	FTL_BuildFree();
+	return true;
+}
+
+/*
+ * Write the translation table into the next table sector. The header page is written last.
+ * The sector is not erased if FTL_Poll() has erased it in background
+ */
+static W25Qxx_RET FTL_Snapshot(void) {
+	uint8_t		tbl		= (ftl_tbl + 1) % FTL_TABLES;
+	uint32_t	addr	= (uint32_t)tbl << 12;
+	W25Qxx_RET	r		= W25Qxx_RET_OK;
+	if (!ftl_tbl_blank)
+		r = W25Qxx_Erase(tbl, 1);
+	if (r != W25Qxx_RET_OK)
+		return r;
+	ftl_tbl_blank	= false;
+	r = W25Qxx_Write(addr + FTL_SNAPSHOT, (uint8_t *)&ftl_table, sizeof(ftl_table));
+	if (r != W25Qxx_RET_OK)
+		return r;
+	uint8_t page[256];
+	memset(page, 0xFF, sizeof(page));
+	FTL_HEADER *h	= (FTL_HEADER *)page;
+	h->magic		= FTL_MAGIC;
+	h->seq			= ftl_seq + 1;
+	h->sectors		= ftl_sectors;
+	h->managed		= ftl_managed;
+	h->logical		= ftl_logical;
+	h->crc			= FTL_HeaderCRC(h);
+	r = W25Qxx_Write(addr, page, sizeof(page));
+	if (r != W25Qxx_RET_OK)
+		return r;
+	ftl_tbl		= tbl;
+	ftl_seq		= h->seq;
+	ftl_record	= 0;
+	return W25Qxx_RET_OK;
+}
+
+// Append the map change record to the journal. Create new snapshot if the journal is full
+static W25Qxx_RET FTL_Journal(uint16_t logical, uint16_t physical) {
+	if (ftl_record >= FTL_RECORDS) {
+		W25Qxx_RET r = FTL_Snapshot();
+		if (r != W25Qxx_RET_OK)
+			return r;
+	}
+	uint32_t	offset	= FTL_JOURNAL + ftl_record * sizeof(FTL_RECORD);
+	uint32_t	page	= ((uint32_t)ftl_tbl << 12) + (offset & 0xF00);
+	uint8_t		buff[256];
+	W25Qxx_RET	r		= W25Qxx_Read(page, buff, sizeof(buff));
+	if (r != W25Qxx_RET_OK)
+		return r;
+	FTL_RECORD *rec	= (FTL_RECORD *)&buff[offset & 0xFF];
+	rec->logical	= logical;
+	rec->physical	= physical;
+	rec->erased		= (physical != FTL_NONE)?ftl_table.erased[physical]:0xFFFF;
+	rec->reserved	= 0xFF;
+	rec->crc		= FTL_RecordCRC(rec);
+	r = W25Qxx_Write(page, buff, sizeof(buff));				// Only 1->0 bit changes, no erase required
+	if (r == W25Qxx_RET_OK)
+		++ftl_record;
+	return r;
+}
+
+static W25Qxx_RET FTL_Erase(uint16_t physical) {
+	W25Qxx_RET r = W25Qxx_Erase(physical, 1);
+	if (r == W25Qxx_RET_OK && ftl_table.erased[physical] < 0xFFFF)
+		++ftl_table.erased[physical];
+	return r;
+}
+
+// Background erase completion callback, see FTL_Poll()
+static void FTL_Erased(uint16_t sector, W25Qxx_RET res, void *ctx) {
+	(void)ctx;
+	ftl_erasing = FTL_NONE;
+	if (res != W25Qxx_RET_OK || !ftl_active || sector >= ftl_managed)
+		return;
+	if (ftl_table.erased[sector] < 0xFFFF)
+		++ftl_table.erased[sector];
+	if (sector == (ftl_tbl + 1) % FTL_TABLES)
+		ftl_tbl_blank = true;
+	else if (FTL_IsFree(sector))
+		FTL_SetBlank(sector, true);
+}
+
+// Copy the logical sector data into the free physical sector
+static W25Qxx_RET FTL_Move(uint16_t logical, uint16_t physical) {
+	uint16_t	old	= ftl_table.map[logical];
+	W25Qxx_RET	r	= W25Qxx_RET_OK;
+	if (!FTL_IsBlank(physical))
+		r = FTL_Erase(physical);
+	if (r == W25Qxx_RET_OK)
+		r = FTL_Copy(old, physical);
+	if (r != W25Qxx_RET_OK)
+		return r;
+	r = FTL_Journal(logical, physical);
+	if (r != W25Qxx_RET_OK)
+		return r;
+	ftl_table.map[logical] = physical;
+	FTL_SetFree(physical, false);
+	FTL_SetFree(old, true);
+	return W25Qxx_RET_OK;
+}
+
+// Copy the physical sector into the erased one page by page
+static W25Qxx_RET FTL_Copy(uint16_t from, uint16_t to) {
+	uint8_t buff[256];
+	for (uint16_t p = 0; p < 0x1000; p += 256) {
+		W25Qxx_RET r = W25Qxx_Read(((uint32_t)from << 12) + p, buff, sizeof(buff));
+		if (r == W25Qxx_RET_OK)
+			r = W25Qxx_Write(((uint32_t)to << 12) + p, buff, sizeof(buff));
+		if (r != W25Qxx_RET_OK)
+			return r;
+	}
+	return W25Qxx_RET_OK;
+}
+
+/*
+ * The power was lost in FTL_Migrate() after the boot sector had been copied: the table sector 0 does not keep
+ * the boot sector anymore, but the translation table has not been written. Complete the migration
+ */
+static bool FTL_Resume(void) {
+	uint16_t logical = FTL_MigrateSectors();
+	if (logical == 0 || FTL_VolumeSectors(0) > 0)			// The legacy flash drive is intact
+		return false;
+	uint32_t volume = FTL_VolumeSectors(logical);
+	if (volume == 0 || volume > logical)					// No boot sector copy of the shrunk volume
+		return false;
+	return FTL_Remap(logical);
+}
+
+/*
+ * Write the translation table of the migrated legacy flash drive: the boot sector and the first FAT sector
+ * are in the first two sectors after the logical ones, other logical sectors are not moved
+ */
+static bool FTL_Remap(uint16_t logical) {
+	ftl_sectors	= W25Qxx_SectorCount();
+	ftl_managed	= ftl_sectors;
+	ftl_logical	= logical;
+	ftl_seq		= 0;
+	memset(ftl_table.map, 0xFF, sizeof(ftl_table.map));
+	memset(ftl_table.erased, 0, sizeof(ftl_table.erased));
+	for (uint16_t i = FTL_TABLES; i < ftl_logical; ++i)
+		ftl_table.map[i] = i;
+	ftl_table.map[0] = logical;
+	ftl_table.map[1] = logical + 1;
+	memset(ftl_trim, 0, sizeof(ftl_trim));					// The legacy drive sector numbers
+	memset(ftl_dirty, 0, sizeof(ftl_dirty));
+	ftl_tbl		= FTL_TABLES - 1;							// The snapshot will be written to the table 0, the old boot sector
+	ftl_active	= (W25Qxx_RET_OK == FTL_Snapshot());
+	FTL_BuildFree();
+	return ftl_active;
+}
+
+// Number of the sectors of the FAT volume or 0 if the data is not a boot sector, sign is the boot sector signature
+static uint32_t FTL_BootSectors(uint8_t bs[], uint8_t sign[]) {
+	if ((bs[0] != 0xEB && bs[0] != 0xE9) || sign[0] != 0x55 || sign[1] != 0xAA)
+		return 0;
+	uint32_t n = bs[FTL_BS_TOTSEC16] | (uint32_t)bs[FTL_BS_TOTSEC16 + 1] << 8;
+	if (n == 0)
+		n = bs[FTL_BS_TOTSEC32] | (uint32_t)bs[FTL_BS_TOTSEC32 + 1] << 8 |
+			(uint32_t)bs[FTL_BS_TOTSEC32 + 2] << 16 | (uint32_t)bs[FTL_BS_TOTSEC32 + 3] << 24;
+	return n;
+}
+
+// Number of the sectors of the FAT volume which boot sector is in the physical sector
+static uint32_t FTL_VolumeSectors(uint16_t physical) {
+	uint8_t bs[FTL_BS_TOTSEC32 + 4];
+	uint8_t sign[2];
+	if (W25Qxx_RET_OK != W25Qxx_Read((uint32_t)physical << 12, bs, sizeof(bs)) ||
+		W25Qxx_RET_OK != W25Qxx_Read(((uint32_t)physical << 12) + FTL_BS_55AA, sign, sizeof(sign)))
+		return 0;
+	return FTL_BootSectors(bs, sign);
+}
+
+/*
+ * Returns the least worn free physical sector, the erased sectors are preferred. If all free sectors are worn much more
+ * than the sector keeping cold data, the cold data is moved into the worn sector, so the less worn sector becomes free.
+ * The released sector is erased in background, another erased sector is allocated if any
+ */
+static uint16_t FTL_Allocate(void) {
+	uint16_t best = FTL_LeastWorn();
+	if (best == FTL_NONE || ftl_table.erased[best] < FTL_WL_DELTA)
+		return best;
+
+	uint16_t cold = FTL_NONE;								// The logical sector in the least worn physical sector
+	for (uint16_t i = 0; i < ftl_logical; ++i) {
+		uint16_t p = ftl_table.map[i];
+		if (p != FTL_NONE && (cold == FTL_NONE || ftl_table.erased[p] < ftl_table.erased[ftl_table.map[cold]]))
+			cold = i;
+	}
+	if (cold != FTL_NONE && ftl_table.erased[best] - ftl_table.erased[ftl_table.map[cold]] > FTL_WL_DELTA) {
+		if (W25Qxx_RET_OK == FTL_Move(cold, best))
+			best = FTL_LeastWorn();
+	}
+	return best;
+}
+
+// The least worn free physical sector, the erased sectors are preferred
+static uint16_t FTL_LeastWorn(void) {
+	uint16_t best = FTL_NONE;
+	for (uint16_t i = FTL_TABLES; i < ftl_managed; ++i) {
+		if (!FTL_IsFree(i) || i == ftl_erasing)
+			continue;
+		if (best == FTL_NONE || FTL_IsBlank(i) > FTL_IsBlank(best) ||
+			(FTL_IsBlank(i) == FTL_IsBlank(best) && ftl_table.erased[i] < ftl_table.erased[best]))
+			best = i;
+	}
+	return best;
+}
+
+// Number of the erased free physical sectors
+static uint16_t FTL_Blanks(void) {
+	uint16_t n = 0;
+	for (uint16_t i = 0; i < (ftl_managed + 7) / 8; ++i) {
+		for (uint8_t b = ftl_blank[i]; b; b &= b - 1)
+			++n;
+	}
+	return n;
+}
+
+/*
+ * Compare the data with the physical sector page by page. Returns the number of changed pages and
+ * 0 - the data is the same, 1 - the data can be written without erasing, 2 - the sector should be erased
+ */
+static uint8_t FTL_Changes(uint16_t physical, uint8_t buff[], uint8_t *pages) {
+	uint8_t state	= 0;
+	*pages			= 0;
+	for (uint16_t p = 0; p < 0x1000; p += 256) {
+		uint8_t s = W25Qxx_Compare(((uint32_t)physical << 12) + p, &buff[p], 256);
+		if (s == 0)
+			continue;
+		++*pages;
+		if (s > state)
+			state = s;
+		if (state == 2)										// The sector is remapped anyway
+			break;
+	}
+	return state;
+}
+
+// Next free physical sector to be erased or FTL_NONE
+static uint16_t FTL_NextFree(void) {
+	if (!ftl_active)
+		return FTL_NONE;
+	for (uint16_t n = FTL_TABLES; n < ftl_managed; ++n) {
+		if (++ftl_scan >= ftl_managed || ftl_scan < FTL_TABLES)
+			ftl_scan = FTL_TABLES;
+		if (FTL_IsFree(ftl_scan) && !FTL_IsBlank(ftl_scan))
+			return ftl_scan;
+	}
+	return FTL_NONE;
+}
+
+// Next released direct mapped sector to be erased (physical sector number) or FTL_NONE
+static uint16_t FTL_NextDirty(void) {
+	for (uint16_t n = 0; n < FTL_TRIM_SECTORS; ++n) {
+		if (++ftl_dirty_scan >= FTL_TRIM_SECTORS)
+			ftl_dirty_scan = 0;
+		if (!FTL_GetBit(ftl_dirty, ftl_dirty_scan))
+			continue;
+		FTL_SetBit(ftl_dirty, ftl_dirty_scan, false);
+		uint16_t phys = ftl_dirty_scan;
+		if (ftl_active)
+			phys += FTL_TABLES + FTL_SPARES;
+		if (phys < ftl_sectors)
+			return phys;
+	}
+	return FTL_NONE;
+}
+
+// Read the physical sector and check it is blank
+static bool FTL_IsErased(uint16_t physical) {
+	uint8_t ff[256];
+	memset(ff, 0xFF, sizeof(ff));
+	for (uint16_t p = 0; p < 0x1000; p += sizeof(ff)) {
+		if (W25Qxx_Compare(((uint32_t)physical << 12) + p, ff, sizeof(ff)) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool FTL_GetBit(uint8_t map[], uint16_t n) {
+	return map[n >> 3] & (1 << (n & 7));
+}
+
+static void FTL_SetBit(uint8_t map[], uint16_t n, bool set) {
+	if (set)
+		map[n >> 3] |=  (1 << (n & 7));
+	else
+		map[n >> 3] &= ~(1 << (n & 7));
+}
+
+static bool FTL_IsFree(uint16_t physical) {
+	return FTL_GetBit(ftl_free, physical);
+}
+
+static void FTL_SetFree(uint16_t physical, bool free) {
+	FTL_SetBit(ftl_free, physical, free);
+	FTL_SetBlank(physical, false);							// The free sector has to be checked again
+}
+
+static bool FTL_IsBlank(uint16_t physical) {
+	return FTL_GetBit(ftl_blank, physical);
+}
+
+static void FTL_SetBlank(uint16_t physical, bool blank) {
+	FTL_SetBit(ftl_blank, physical, blank);
+}
+
+// All managed physical sectors except the translation tables and mapped ones are free
+static void FTL_BuildFree(void) {
+	memset(ftl_free, 0, sizeof(ftl_free));
+	memset(ftl_blank, 0, sizeof(ftl_blank));
+	for (uint16_t i = FTL_TABLES; i < ftl_managed; ++i)
+		FTL_SetFree(i, true);
+	for (uint16_t i = 0; i < ftl_logical; ++i) {
+		if (ftl_table.map[i] != FTL_NONE)
+			FTL_SetFree(ftl_table.map[i], false);
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * FTL.h
+ *
+ *  Created on: 2025 Feb 22
+ *
+ *  Flash translation layer between FatFS (diskio.c), USB mass storage and W25Qxx driver.
+ *  FatFS rewrites the same FAT and directory sectors every time the configuration is saved,
+ *  so these physical sectors wear out much faster than others.
+ *  The FTL exposes logical 4k sectors and remaps them to the physical ones:
+ *  the changed logical sector is written into the least worn free physical sector, the old one becomes free.
+ *  Only the sector with one changed page not requiring erase is programmed in place. Such update is not atomic:
+ *  the power loss during the page program may leave the changed bytes undefined, the rest of the sector is intact.
+ *  When the free sectors are worn much more than the sectors keeping cold data (fonts, language files),
+ *  the cold data is moved to the worn sector (static wear leveling).
+ *
+ *  The first FTL_MAX_SECTORS physical sectors of the flash are managed, the rest of the flash is mapped directly.
+ *  Physical sectors 0 and 1 keep the translation table: the header page, the snapshot of the logical to physical map
+ *  and erase counters of the physical sectors, and the journal of the map changes. The journal record is appended
+ *  after the data has been written, so the sector update is atomic on the power loss. When the journal is full,
+ *  the new snapshot is written into another table sector (the table garbage collection).
+ *
+ *  The FTL is activated when the flash drive is formatted, see FTL_Format(). If there is no translation table
+ *  on the flash (the drive formatted by previous firmware version), the logical sectors are the physical ones.
+ *  Such legacy drive is migrated at startup keeping the files, see FTL_Migrate(): the FAT volume shrinks by
+ *  FTL_TABLES + FTL_SPARES sectors, so the last sectors of the volume should be free. The flash bigger than
+ *  FTL_MAX_SECTORS cannot be migrated in place, the drive should be formatted.
+ *
+ *  FTL_Poll() erases the free physical sectors in background without waiting for the flash IC,
+ *  so the sector erase time (up to 400 ms) is not spent when the configuration is saved.
+ *  FTL_Ready() tells the caller the sectors can be written without waiting for the erase, otherwise the caller
+ *  should postpone the write (see CFG::commitConfig()).
+ *  The sectors of the removed files are reported by FatFS (CTRL_TRIM) and released on the next sync.
+ */
+
+#ifndef FTL_H_
+#define FTL_H_
+
+#include "W25Qxx.h"
+
+#ifndef FTL_MAX_SECTORS
+#define FTL_MAX_SECTORS		(512)							// Managed physical sectors, 4 bytes of RAM per sector
+#endif
+#define FTL_SPARES			(16)							// Number of spare physical sectors in the managed area
+#define FTL_WL_DELTA		(64)							// Erase count difference to start static wear leveling
+#define FTL_HOLD			(100)							// Time (ms) the background erase waits for the write, see FTL_Ready()
+#ifndef FTL_TRIM_SECTORS
+#define FTL_TRIM_SECTORS	(2048)							// Logical sectors tracked by FTL_Trim(), 2 bits of RAM per sector
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool		FTL_Init(void);
+bool		FTL_Format(void);
+bool		FTL_Active(void);
+uint16_t	FTL_SectorCount(void);
+uint16_t	FTL_MigrateSectors(void);
+bool		FTL_Migrate(uint8_t buff[]);
+W25Qxx_RET	FTL_Read(uint16_t sector, uint8_t buff[], uint16_t count);
+W25Qxx_RET	FTL_Write(uint16_t sector, uint8_t buff[]);
+W25Qxx_RET	FTL_Trim(uint16_t sector, uint16_t count);
+W25Qxx_RET	FTL_Sync(void);
+bool		FTL_Ready(uint16_t sectors);
+void		FTL_Poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,6 +15,28 @@
  *
  *  2024 Jun 20
  *  	Removed HAL_Delay(10) from W25Qxx_Wait() to prevent hang inside interrupt calls
+ *
+ *  2025 Feb 21
+ *  	W25Qxx_Write() compares the data with the flash content page by page: skips unchanged pages,
+ *  	programs the page without erase if only 1->0 bit changes required, erases the sector only when necessary
+ *
+ *  2025 Feb 22
+ *  	W25Qxx_Compare() checks how the data can be written to the flash, used by the flash translation layer
+ *
+ *  2025 Feb 24
+ *  	Asynchronous sector erase queue: W25Qxx_EraseAsync() queues the operation, W25Qxx_Poll() starts it and checks
+ *  	the completion without waiting, then calls the completion callback. Synchronous operations wait for the
+ *  	running erase to finish as before
+ *
+ *  2025 Feb 25
+ *  	SPI mode: data blocks (read data and page program) are transferred by SPI2 DMA channels.
+ *  	The DMA interrupts are not used: the driver is called from USB interrupt handler, so the transfer completion is polled
+ *
+ *  2025 Mar 07
+ *  	W25Qxx_Write() does not erase the sector if the data does not cover the whole sector
+ *
+ *  2025 Mar 08
+ *  	The SPI2 DMA channel interrupts are disabled in NVIC, the completion is polled only, see W25Qxx_Transfer()
  */
 
 #include "W25Qxx.h"
@@ -63,22 +85,37 @@ typedef enum {
 
 static uint16_t sector_count = 0;							// Number of the 4k sectors on the device
 
+#define W25Qxx_QUEUE_LEN	(4)								// Asynchronous operations queue length
+static struct {
+	uint16_t		sector;
+	W25Qxx_DONE		done;									// Completion callback
+	void*			ctx;									// Callback context
+} op_queue[W25Qxx_QUEUE_LEN];
+static uint8_t		op_head		= 0;						// The first operation in the queue
+static uint8_t		op_count	= 0;						// Number of queued operations
+static bool			op_running	= false;					// The first operation has been started
+static uint32_t		op_start	= 0;						// When the running operation has been started (ms)
+
 // Static function forward declarations
 static bool			W25Qxx_WriteEnable(void);
 static uint32_t		W25Qxx_JEDEC_ID(void);
 static uint16_t		W25Qxx_Status(bool r1_only);
 static bool			W25Qxx_Command(uint8_t cmd);
 static bool			W25Qxx_EraseSector(uint32_t addr);
+static bool			W25Qxx_EraseCmd(uint32_t addr);
 static bool			W25Qxx_ProgramPage(uint32_t addr, uint8_t buff[256]);
-static bool			W25Qxx_EraseSector(uint32_t addr);
+static void			W25Qxx_OpDone(W25Qxx_RET res);
 static bool			W25Qxx_Wait(uint32_t to);
-static bool			W25Qxx_IsSectorEmpty(uint32_t addr);
+static uint8_t		W25Qxx_PageState(uint32_t addr, uint8_t buff[256]);
+static bool			W25Qxx_IsBlank(uint8_t buff[256]);
 
 #ifdef QSPI
 static bool			W25Qxx_WriteStatusRegister(uint16_t status);
 #else
 static void			W25Qxx_Select(void);
 static void			W25Qxx_Unselect(void);
+static bool			W25Qxx_Transfer(uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t to);
+#define W25Qxx_DMA_MIN		(16)							// Minimal data size to be transferred by DMA
 #endif
 
 // JEDDEC ID are a three bytes in double word:
@@ -209,7 +246,7 @@ W25Qxx_RET W25Qxx_Read(uint32_t addr, uint8_t buff[], uint16_t size) {
 	W25Qxx_RET status = W25Qxx_RET_READ;
 	W25Qxx_Select();
 	if (HAL_OK == HAL_SPI_Transmit(&FLASH_SPI_PORT, (uint8_t *)cmd, cmd_length, 100)) {
-		if (HAL_OK == HAL_SPI_Receive(&FLASH_SPI_PORT, buff, size, 1000))
+		if (W25Qxx_Transfer(0, buff, size, 1000))
 			status = W25Qxx_RET_OK;
 	}
 	W25Qxx_Unselect();
@@ -217,13 +254,19 @@ W25Qxx_RET W25Qxx_Read(uint32_t addr, uint8_t buff[], uint16_t size) {
 }
 #endif
 
-// Write data by 256-bytes pages; Usually write whole 4k sector
+/*
+ * Write data by 256-bytes pages; Usually write whole 4k sector
+ * The data is compared with the flash content page by page. The pages that are not changed are skipped,
+ * the pages requiring only 1->0 bit changes are programmed without erasing. The sector is erased only
+ * if some bit should be changed 0->1; In this case the data should cover the whole sector,
+ * because the rest of the sector would be lost. Otherwise W25Qxx_RET_ALIGN is returned and the sector is not changed
+ */
 W25Qxx_RET W25Qxx_Write(uint32_t addr, uint8_t buff[], uint16_t size) {
 	if (addr & 0xFF)										// Address should be aligned to the page border, divided by 256, i.e. 0xXXXXXX00
 		return W25Qxx_RET_ALIGN;
 	if (size < 0x100 || (size & 0xFF))
 		return W25Qxx_RET_SIZE;
-	if (sector_count < (addr >> 12))						// addr / 4096
+	if (((addr + size - 1) >> 12) >= sector_count)			// The last byte address / 4096
 		return W25Qxx_RET_ADDR;
 
 	if (!W25Qxx_Wait(1000))									// Wait for device ready
@@ -232,21 +275,46 @@ W25Qxx_RET W25Qxx_Write(uint32_t addr, uint8_t buff[], uint16_t size) {
 	if (!W25Qxx_WriteEnable())								// Failed to enable write operation
 		return W25Qxx_RES_RO;
 
-	// If we are trying to write to the begin of the sector, check the sector has been erased
-	if (((addr & 0xFFF) == 0) && !W25Qxx_IsSectorEmpty(addr))
-		if (!W25Qxx_EraseSector(addr))
-			return W25Qxx_RET_ERASE;
-
-	if (!W25Qxx_Wait(5000))									// Wait for erase process to finish
-		return W25Qxx_RES_BUSY;
-
-	// Write data by 256-bytes long pages
-	for (uint16_t start = 0; start < size; start += 256) {
-		if (!W25Qxx_ProgramPage(addr, &buff[start]))
-			return W25Qxx_RET_WRITE;
-		addr += 256;
-		if (!W25Qxx_Wait(1000))								// Wait for device ready
-			return W25Qxx_RES_BUSY;
+	uint16_t start = 0;
+	while (start < size) {									// Write data sector by sector
+		uint16_t chunk = 0x1000 - (addr & 0xFFF);			// The data size to be written into this sector
+		if (chunk > size - start)
+			chunk = size - start;
+		uint16_t program	= 0;							// The bit mask of the sector pages to be programmed
+		bool	 erase		= false;
+		for (uint16_t p = 0; p < chunk; p += 256) {
+			uint8_t state = W25Qxx_PageState(addr + p, &buff[start + p]);
+			if (state == 2) {								// Some bits should be set to 1, the sector should be erased
+				erase = true;
+				break;
+			}
+			if (state == 1)
+				program |= 1 << ((addr + p) >> 8 & 0xF);
+		}
+		if (erase) {
+			if ((addr & 0xFFF) || chunk != 0x1000)			// The beginning or the tail of the sector would be lost
+				return W25Qxx_RET_ALIGN;
+			if (!W25Qxx_EraseSector(addr))
+				return W25Qxx_RET_ERASE;
+			if (!W25Qxx_Wait(5000))							// Wait for erase process to finish
+				return W25Qxx_RES_BUSY;
+			program = 0;
+			for (uint16_t p = 0; p < chunk; p += 256) {		// Program all the pages but blank ones
+				if (!W25Qxx_IsBlank(&buff[start + p]))
+					program |= 1 << (p >> 8);
+			}
+		}
+		// Write data by 256-bytes long pages
+		for (uint16_t p = 0; p < chunk; p += 256) {
+			if ((program & (1 << ((addr + p) >> 8 & 0xF))) == 0)
+				continue;
+			if (!W25Qxx_ProgramPage(addr + p, &buff[start + p]))
+				return W25Qxx_RET_WRITE;
+			if (!W25Qxx_Wait(1000))							// Wait for device ready
+				return W25Qxx_RES_BUSY;
+		}
+		addr	+= chunk;
+		start	+= chunk;
 	}
 	return W25Qxx_RET_OK;
 }
@@ -270,6 +338,79 @@ W25Qxx_RET W25Qxx_Erase(uint16_t start_sector, uint16_t n_sectors) {
 	return W25Qxx_RET_OK;
 }
 
+// Queue the sector erase operation. The callback is called from W25Qxx_Poll() when the operation finishes
+bool W25Qxx_EraseAsync(uint16_t sector, W25Qxx_DONE done, void *ctx) {
+	if (sector >= sector_count || op_count >= W25Qxx_QUEUE_LEN)
+		return false;
+	uint8_t i = (op_head + op_count) % W25Qxx_QUEUE_LEN;
+	op_queue[i].sector	= sector;
+	op_queue[i].done	= done;
+	op_queue[i].ctx		= ctx;
+	++op_count;
+	return true;
+}
+
+/*
+ * Check the running operation status and start the next one. Never waits for the flash IC.
+ * Should be called periodically from the main loop. Returns true if the queue is empty
+ */
+bool W25Qxx_Poll(void) {
+	if (op_running) {
+		if (W25Qxx_Status(true) & S_BUSY) {
+			if (HAL_GetTick() - op_start < 10000)
+				return false;
+			W25Qxx_OpDone(W25Qxx_RES_BUSY);					// Timeout
+		} else {
+			W25Qxx_OpDone(W25Qxx_RET_OK);
+		}
+	}
+	if (op_count == 0)
+		return true;
+	if (W25Qxx_Status(true) & S_BUSY)						// Synchronous operation is still running
+		return false;
+	if (!W25Qxx_EraseCmd((uint32_t)op_queue[op_head].sector << 12)) {
+		W25Qxx_OpDone(W25Qxx_RET_ERASE);
+		return (op_count == 0);
+	}
+	op_running	= true;
+	op_start	= HAL_GetTick();
+	return false;
+}
+
+/*
+ * Compare the data with the flash content. The address and the size should be aligned to the 256-byte page. Returns
+ * 0 - the data is the same, 1 - the data can be written without erasing, 2 - the sector should be erased
+ */
+uint8_t W25Qxx_Compare(uint32_t addr, uint8_t buff[], uint16_t size) {
+	uint8_t state = 0;
+	for (uint16_t p = 0; p < size; p += 256) {
+		uint8_t s = W25Qxx_PageState(addr + p, &buff[p]);
+		if (s == 2)
+			return 2;
+		if (s > state)
+			state = s;
+	}
+	return state;
+}
+
+// Remove the finished operation from the queue and call its callback
+static void W25Qxx_OpDone(W25Qxx_RET res) {
+	uint16_t	sector	= op_queue[op_head].sector;
+	W25Qxx_DONE	done	= op_queue[op_head].done;
+	void*		ctx		= op_queue[op_head].ctx;
+	op_head		= (op_head + 1) % W25Qxx_QUEUE_LEN;
+	--op_count;
+	op_running	= false;
+	if (done)
+		done(sector, res, ctx);
+}
+
+static bool W25Qxx_EraseSector(uint32_t addr) {
+	if (!W25Qxx_EraseCmd(addr))
+		return false;
+	return W25Qxx_Wait(10000);
+}
+
 static bool W25Qxx_WriteEnable(void)  {
 	uint16_t stat = W25Qxx_Status(true);
 	if ((stat & S_WEL) == 0) {								// Read only
@@ -279,20 +420,32 @@ static bool W25Qxx_WriteEnable(void)  {
 	return (stat & S_WEL);
 }
 
-static bool W25Qxx_IsSectorEmpty(uint32_t addr) {
-	addr &= 0xFFFFF000;										// Align to the sector border, divided by 4096, i.e. 0xXXXXY000
-	uint8_t buff[32];										// The buffer to read data into
-	for (uint16_t i = 0; i < 128; ++i) {					// 4K sector is 128 chunks of 32 bytes
-		if (W25Qxx_RET_OK == W25Qxx_Read(addr, buff, 32)) {
-			for (uint8_t j = 0; j < 32; ++j) {
-				if (buff[j] != 0xFF) {
-					return false;
-				}
-			}
-		} else {
+/*
+ * Compare the new page data with the flash content. Returns
+ * 0 - the page is not changed, nothing to do
+ * 1 - the page can be programmed without erasing: only 1->0 bit changes required
+ * 2 - the sector should be erased (or the page cannot be read)
+ */
+static uint8_t W25Qxx_PageState(uint32_t addr, uint8_t buff[256]) {
+	uint8_t page[256];										// The buffer to read flash page into
+	if (W25Qxx_RET_OK != W25Qxx_Read(addr, page, 256))
+		return 2;
+	uint8_t state = 0;
+	for (uint16_t i = 0; i < 256; ++i) {
+		if (page[i] == buff[i])
+			continue;
+		if ((page[i] & buff[i]) != buff[i])					// Some bit should be changed 0->1
+			return 2;
+		state = 1;
+	}
+	return state;
+}
+
+// Check the page data is all 0xFF, it is not necessary to program such page after erase
+static bool W25Qxx_IsBlank(uint8_t buff[256]) {
+	for (uint16_t i = 0; i < 256; ++i) {
+		if (buff[i] != 0xFF)
 			return false;
-		}
-		addr += 32;
 	}
 	return true;
 }
@@ -441,7 +594,8 @@ static bool W25Qxx_ProgramPage(uint32_t addr, uint8_t buff[256]) {
 	return res;
 }
 
-static bool W25Qxx_EraseSector(uint32_t addr) {
+// Start sector erasing, do not wait for the operation to finish
+static bool W25Qxx_EraseCmd(uint32_t addr) {
 	if (sector_count < (addr >> 12))							// addr / 4096
 		return false;
 	if (!W25Qxx_WriteEnable())
@@ -465,11 +619,7 @@ static bool W25Qxx_EraseSector(uint32_t addr) {
 	scmd.DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
 	scmd.SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_OK != HAL_QSPI_Command(&FLASH_QSPI, &scmd, HAL_QSPI_TIMEOUT_DEFAULT_VALUE))
-		return false;
-	if (W25Qxx_Wait(1000))						// Wait for device ready
-		return true;
-	return false;
+	return (HAL_OK == HAL_QSPI_Command(&FLASH_QSPI, &scmd, HAL_QSPI_TIMEOUT_DEFAULT_VALUE));
 }
 
 
@@ -569,7 +719,7 @@ static bool W25Qxx_ProgramPage(uint32_t addr, uint8_t buff[256]) {
 	}
 	W25Qxx_Select();
 	if (HAL_OK == HAL_SPI_Transmit(&FLASH_SPI_PORT, (uint8_t *)cmd, cmd_length, 100)) {
-		if (HAL_OK == HAL_SPI_Transmit(&FLASH_SPI_PORT, (uint8_t *)buff, 256, 1000)) {
+		if (W25Qxx_Transfer(buff, 0, 256, 1000)) {
 			W25Qxx_Unselect();
 			res = W25Qxx_Wait(1000);
 		}
@@ -578,21 +728,17 @@ static bool W25Qxx_ProgramPage(uint32_t addr, uint8_t buff[256]) {
 	return res;
 }
 
-static bool W25Qxx_EraseSector(uint32_t addr) {
+// Start sector erasing, do not wait for the operation to finish
+static bool W25Qxx_EraseCmd(uint32_t addr) {
 	if (!W25Qxx_WriteEnable())
 		return false;
 
 	// Align to the sector border, divided by 4096, i.e. 0xXXXXY000
 	uint8_t cmd[4] = { CMD_ERASE_SECTOR_20, (addr >> 16) & 0xFF, (addr >> 8) & 0xF0, 0 };
 	W25Qxx_Select();
-	if (HAL_OK == HAL_SPI_Transmit(&FLASH_SPI_PORT, (uint8_t *)cmd, 4, 100)) {
-		W25Qxx_Unselect();
-		if (W25Qxx_Wait(10000)) {
-			return true;
-		}
-	}
+	bool ret = (HAL_OK == HAL_SPI_Transmit(&FLASH_SPI_PORT, (uint8_t *)cmd, 4, 100));
 	W25Qxx_Unselect();
-	return false;
+	return ret;
 }
 
 static bool W25Qxx_Wait(uint32_t to) {
@@ -615,6 +761,45 @@ static bool W25Qxx_Wait(uint32_t to) {
 	}
 	return false;
 }
+/*
+ * Transfer the data block: send tx buffer or receive data into rx buffer. The DMA channels are started
+ * without interrupts and the completion is polled, so the function can be called from any interrupt handler.
+ * The dummy byte is sent while receiving, the received bytes are dropped while sending
+ */
+static bool W25Qxx_Transfer(uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t to) {
+	SPI_HandleTypeDef *hspi = &FLASH_SPI_PORT;
+	if (size < W25Qxx_DMA_MIN || !hspi->hdmarx || !hspi->hdmatx) {
+		if (rx)
+			return (HAL_OK == HAL_SPI_Receive(hspi, rx, size, to));
+		return (HAL_OK == HAL_SPI_Transmit(hspi, tx, size, to));
+	}
+	static uint8_t	dummy_tx = W25Qxx_DUMMY_BYTE;
+	static uint8_t	dummy_rx;
+	// Memory address is incremented for the data buffer only
+	MODIFY_REG(hspi->hdmarx->Instance->CCR, DMA_CCR_MINC, rx?DMA_CCR_MINC:0);
+	MODIFY_REG(hspi->hdmatx->Instance->CCR, DMA_CCR_MINC, tx?DMA_CCR_MINC:0);
+	__HAL_SPI_ENABLE(hspi);
+	__HAL_SPI_CLEAR_OVRFLAG(hspi);							// Drop the byte received by previous transfer
+	if (HAL_OK != HAL_DMA_Start(hspi->hdmarx, (uint32_t)(uintptr_t)&hspi->Instance->DR, (uint32_t)(uintptr_t)(rx?rx:&dummy_rx), size))
+		return false;
+	SET_BIT(hspi->Instance->CR2, SPI_CR2_RXDMAEN);			// RX channel should be started first
+	if (HAL_OK != HAL_DMA_Start(hspi->hdmatx, (uint32_t)(uintptr_t)(tx?tx:&dummy_tx), (uint32_t)(uintptr_t)&hspi->Instance->DR, size)) {
+		HAL_DMA_Abort(hspi->hdmarx);
+		CLEAR_BIT(hspi->Instance->CR2, SPI_CR2_RXDMAEN);
+		return false;
+	}
+	SET_BIT(hspi->Instance->CR2, SPI_CR2_TXDMAEN);
+	// The last byte has been received, so the transfer is complete
+	bool ok = (HAL_OK == HAL_DMA_PollForTransfer(hspi->hdmarx, HAL_DMA_FULL_TRANSFER, to));
+	ok = (HAL_OK == HAL_DMA_PollForTransfer(hspi->hdmatx, HAL_DMA_FULL_TRANSFER, to)) && ok;
+	CLEAR_BIT(hspi->Instance->CR2, SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+	if (!ok) {
+		HAL_DMA_Abort(hspi->hdmarx);
+		HAL_DMA_Abort(hspi->hdmatx);
+	}
+	return ok;
+}
+
 static void W25Qxx_Select(void) {
 	HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
 }
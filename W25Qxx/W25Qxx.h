@@ -9,7 +9,8 @@
  *
  *  W25QXX SPI flash IC driver. Tested on W25Q16 device at 42 Mbit/s SPI bus.
  *  Read can be performed from any available address,
- *  Write operation should be aligned to 256-byte page
+ *  Write operation should be aligned to 256-byte page. The unchanged pages are not written,
+ *  the sector is erased only if some bit should be changed 0->1
  *
  *  Driver is working with FatFS library.
  *  As soon as data on the flash drive can be erased by sector (4k)
@@ -81,6 +82,9 @@ typedef enum {
 #include <stdbool.h>
 #endif
 
+// Asynchronous operation completion callback
+typedef void (*W25Qxx_DONE)(uint16_t sector, W25Qxx_RET res, void *ctx);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -90,6 +94,9 @@ uint16_t	W25Qxx_SectorCount(void);
 W25Qxx_RET	W25Qxx_Read(uint32_t addr, uint8_t buff[], uint16_t size);
 W25Qxx_RET	W25Qxx_Write(uint32_t addr, uint8_t buff[], uint16_t size);
 W25Qxx_RET	W25Qxx_Erase(uint16_t start_sector, uint16_t n_sectors);
+uint8_t		W25Qxx_Compare(uint32_t addr, uint8_t buff[], uint16_t size);
+bool		W25Qxx_EraseAsync(uint16_t sector, W25Qxx_DONE done, void *ctx);
+bool		W25Qxx_Poll(void);
 
 #ifdef QSPI
 bool		W25Qxx_QSPI_MemoryMapped(void);